@@ -0,0 +1,288 @@
+/**
+ * Checks and times StreamCompaction::Efficient's templated compaction.
+ *
+ * First the ScanEngine it is built on is compared with CPU::ScanEngine for
+ * exclusive, inclusive and max scans, in place and not, on sizes either side
+ * of one, two and three tile levels.
+ *
+ * Then every variant (int compact, PathSegment partition, zipped PathSegment +
+ * ShadeableIntersection compact and partition) is compared with the host
+ * reference in StreamCompaction::CPU on sizes around powers of two, odd and
+ * even, including 1. One Workspace is reused across all of them, as in the
+ * bounce loop. Then Efficient::partition is timed against thrust::partition
+ * on PathSegments. pathtrace() now compacts a list of path slots instead;
+ * path_state_bench compares the two layouts.
+ *
+ * Needs a GPU. Exits with 1 if any check fails.
+ *
+ * Usage: compact_bench [PATHS] [ITERATIONS]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thrust/execution_policy.h>
+#include <thrust/partition.h>
+
+#include "sceneStructs.h"
+#include "testing_helpers.hpp"
+#include "../stream_compaction/cpu.h"
+#include "../stream_compaction/efficient.h"
+
+using namespace StreamCompaction;
+
+struct PathAlive {
+    __host__ __device__ bool operator()(const PathSegment& path) const {
+        return path.remainingBounces > 0;
+    }
+};
+
+struct PathHit {
+    __host__ __device__ bool operator()(const PathSegment& path, const ShadeableIntersection& isect) const {
+        return path.remainingBounces > 0 && isect.t > 0.0f;
+    }
+};
+
+struct IsOdd {
+    __host__ __device__ bool operator()(int x) const {
+        return x & 1;
+    }
+};
+
+static void genPaths(int n, std::vector<PathSegment>& paths, std::vector<ShadeableIntersection>& isects) {
+    paths.resize(n);
+    isects.resize(n);
+    for (int i = 0; i < n; i++) {
+        paths[i] = PathSegment();
+        paths[i].pixelIndex = i;
+        paths[i].remainingBounces = rand() % 3;    // about a third terminated
+        isects[i] = ShadeableIntersection();
+        isects[i].t = (rand() % 4) ? 1.0f : -1.0f;
+        isects[i].materialId = i;
+    }
+}
+
+template <typename T>
+static T* upload(const std::vector<T>& v) {
+    T* dev;
+    cudaMalloc((void**)&dev, sizeof(T) * v.size());
+    cudaMemcpy(dev, v.data(), sizeof(T) * v.size(), cudaMemcpyHostToDevice);
+    return dev;
+}
+
+template <typename T>
+static std::vector<T> download(const T* dev, int n) {
+    std::vector<T> v(n);
+    cudaMemcpy(v.data(), dev, sizeof(T) * n, cudaMemcpyDeviceToHost);
+    return v;
+}
+
+static std::vector<int> pixelIndices(const std::vector<PathSegment>& paths) {
+    std::vector<int> v(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        v[i] = paths[i].pixelIndex;
+    }
+    return v;
+}
+
+static std::vector<int> materialIds(const std::vector<ShadeableIntersection>& isects) {
+    std::vector<int> v(isects.size());
+    for (size_t i = 0; i < isects.size(); i++) {
+        v[i] = isects[i].materialId;
+    }
+    return v;
+}
+
+struct Max {
+    __host__ __device__ int operator()(int a, int b) const {
+        return a > b ? a : b;
+    }
+};
+
+static int failures = 0;
+
+static void check(int count, int expectedCount, int n, std::vector<int> a, std::vector<int> b) {
+    int bad = count != expectedCount || cmpArrays(n, a.data(), b.data());
+    if (bad) {
+        printf("    expected count %d, got %d\n", expectedCount, count);
+    }
+    printf("    %s \n", bad ? "FAIL" : "passed");
+    failures += bad;
+}
+
+static void checkScan(int n, Efficient::ScanEngine<int>& engine) {
+    CPU::ScanEngine<int> reference;
+    std::vector<int> a(n), expected(n);
+    genArray(n, a.data(), 50);
+    int* dev_in = upload(a);
+    int* dev_out;
+    cudaMalloc((void**)&dev_out, sizeof(int) * n);
+    char desc[64];
+
+    reference.exclusiveScan(n, expected.data(), a.data());
+    engine.exclusiveScan(n, dev_out, dev_in);
+    sprintf(desc, "exclusive scan n = %d", n);
+    printDesc(desc);
+    check(n, n, n, download(dev_out, n), expected);
+
+    reference.inclusiveScan(n, expected.data(), a.data());
+    engine.inclusiveScan(n, dev_out, dev_in);
+    sprintf(desc, "inclusive scan n = %d", n);
+    printDesc(desc);
+    check(n, n, n, download(dev_out, n), expected);
+
+    reference.scan(n, expected.data(), a.data(), Max(), -1, true);
+    cudaMemcpy(dev_out, dev_in, sizeof(int) * n, cudaMemcpyDeviceToDevice);
+    engine.scan(n, dev_out, dev_out, Max(), -1, true);
+    sprintf(desc, "inclusive max scan, in place, n = %d", n);
+    printDesc(desc);
+    check(n, n, n, download(dev_out, n), expected);
+
+    cudaFree(dev_in);
+    cudaFree(dev_out);
+    checkCUDAError("checkScan");
+}
+
+static void checkSize(int n, Efficient::Workspace& ws) {
+    char desc[64];
+
+    // int compact, device templates
+    std::vector<int> ints(n);
+    genArray(n, ints.data(), 50);
+    std::vector<int> expectedInts(n), gotInts(n);
+    int expected = CPU::compact(n, expectedInts.data(), ints.data(), IsOdd());
+    int* dev_ints = upload(ints);
+    int* dev_intsOut;
+    cudaMalloc((void**)&dev_intsOut, sizeof(int) * n);
+    int count = Efficient::compact(n, dev_intsOut, dev_ints, IsOdd(), ws);
+    gotInts = download(dev_intsOut, count);
+    sprintf(desc, "compact<int> n = %d", n);
+    printDesc(desc);
+    check(count, expected, count, gotInts, expectedInts);
+    cudaFree(dev_ints);
+    cudaFree(dev_intsOut);
+
+    // PathSegment partition, and both zipped variants
+    std::vector<PathSegment> paths, expectedPaths(n);
+    std::vector<ShadeableIntersection> isects, expectedIsects(n);
+    genPaths(n, paths, isects);
+    PathSegment* dev_paths = upload(paths);
+    ShadeableIntersection* dev_isects = upload(isects);
+    PathSegment* dev_pathsOut;
+    ShadeableIntersection* dev_isectsOut;
+    cudaMalloc((void**)&dev_pathsOut, sizeof(PathSegment) * n);
+    cudaMalloc((void**)&dev_isectsOut, sizeof(ShadeableIntersection) * n);
+
+    expected = CPU::partition(n, expectedPaths.data(), paths.data(), PathAlive());
+    count = Efficient::partition(n, dev_pathsOut, dev_paths, PathAlive(), ws);
+    sprintf(desc, "partition<PathSegment> n = %d", n);
+    printDesc(desc);
+    check(count, expected, n, pixelIndices(download(dev_pathsOut, n)), pixelIndices(expectedPaths));
+
+    expected = CPU::compactZipped(n, expectedPaths.data(), expectedIsects.data(),
+        paths.data(), isects.data(), PathHit());
+    count = Efficient::compactZipped(n, dev_pathsOut, dev_isectsOut, dev_paths, dev_isects, PathHit(), ws);
+    sprintf(desc, "compactZipped n = %d", n);
+    printDesc(desc);
+    check(count, expected, count, pixelIndices(download(dev_pathsOut, count)), pixelIndices(expectedPaths));
+    check(count, expected, count, materialIds(download(dev_isectsOut, count)), materialIds(expectedIsects));
+
+    expected = CPU::partitionZipped(n, expectedPaths.data(), expectedIsects.data(),
+        paths.data(), isects.data(), PathHit());
+    count = Efficient::partitionZipped(n, dev_pathsOut, dev_isectsOut, dev_paths, dev_isects, PathHit(), ws);
+    sprintf(desc, "partitionZipped n = %d", n);
+    printDesc(desc);
+    check(count, expected, n, pixelIndices(download(dev_pathsOut, n)), pixelIndices(expectedPaths));
+    check(count, expected, n, materialIds(download(dev_isectsOut, n)), materialIds(expectedIsects));
+
+    cudaFree(dev_paths);
+    cudaFree(dev_isects);
+    cudaFree(dev_pathsOut);
+    cudaFree(dev_isectsOut);
+    checkCUDAError("checkSize");
+}
+
+/** Average milliseconds per call of `partition` over `iterations` calls. */
+template <typename F>
+static float timePartition(int iterations, F&& partition) {
+    cudaEvent_t start, end;
+    cudaEventCreate(&start);
+    cudaEventCreate(&end);
+    partition(); // warmup
+    cudaEventRecord(start);
+    for (int i = 0; i < iterations; i++) {
+        partition();
+    }
+    cudaEventRecord(end);
+    cudaEventSynchronize(end);
+    float ms;
+    cudaEventElapsedTime(&ms, start, end);
+    cudaEventDestroy(start);
+    cudaEventDestroy(end);
+    return ms / iterations;
+}
+
+int main(int argc, char** argv) {
+    int pathCount = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+    Efficient::ScanEngine<int> engine(1 << 21);
+    const int scanSizes[] = { 1, 5, SCAN_TILE_SIZE - 1, SCAN_TILE_SIZE, SCAN_TILE_SIZE + 1, 300007,
+        SCAN_TILE_SIZE * SCAN_TILE_SIZE, SCAN_TILE_SIZE * SCAN_TILE_SIZE + 1, (1 << 21) + 3 };
+    for (int n : scanSizes) {
+        checkScan(n, engine);
+    }
+
+    Efficient::Workspace ws;
+    const int sizes[] = { 1, 2, 3, 7, 255, 256, 257, 1000, 4095, 4097, 65537, 1000003, 800 * 800 };
+    for (int n : sizes) {
+        checkSize(n, ws);
+    }
+
+    // The old int compact(), which now runs the same device path
+    {
+        int n = 1000003;
+        std::vector<int> a(n), expected(n), got(n);
+        genArray(n, a.data(), 4);
+        int expectedCount = CPU::compactWithoutScan(n, expected.data(), a.data());
+        int count = Efficient::compact(n, got.data(), a.data());
+        printDesc("compact(int*) n = 1000003");
+        check(count, expectedCount, count, got, expected);
+    }
+
+    // Restore the input before every call, as the bounce loop sees fresh
+    // terminations each time; the copy is timed for both.
+    std::vector<PathSegment> paths;
+    std::vector<ShadeableIntersection> isects;
+    genPaths(pathCount, paths, isects);
+    PathSegment* dev_input = upload(paths);
+    PathSegment* dev_paths = upload(paths);
+    PathSegment* dev_pathsOut;
+    cudaMalloc((void**)&dev_pathsOut, sizeof(PathSegment) * pathCount);
+    ws.reserve(pathCount);
+
+    float copyMs = timePartition(iterations, [&]() {
+        cudaMemcpy(dev_paths, dev_input, sizeof(PathSegment) * pathCount, cudaMemcpyDeviceToDevice);
+    });
+    float thrustMs = timePartition(iterations, [&]() {
+        cudaMemcpy(dev_paths, dev_input, sizeof(PathSegment) * pathCount, cudaMemcpyDeviceToDevice);
+        thrust::partition(thrust::device, dev_paths, dev_paths + pathCount, PathAlive());
+    });
+    float efficientMs = timePartition(iterations, [&]() {
+        cudaMemcpy(dev_paths, dev_input, sizeof(PathSegment) * pathCount, cudaMemcpyDeviceToDevice);
+        Efficient::partition(pathCount, dev_pathsOut, dev_paths, PathAlive(), ws);
+    });
+    checkCUDAError("timing");
+
+    printf("\n%d PathSegments, %d iterations, input copy %.3f ms subtracted\n", pathCount, iterations, copyMs);
+    printf("%-24s %8.3f ms   %8.2f Mpaths/s\n", "thrust::partition",
+        thrustMs - copyMs, pathCount / (thrustMs - copyMs) * 1e-3);
+    printf("%-24s %8.3f ms   %8.2f Mpaths/s\n", "Efficient::partition",
+        efficientMs - copyMs, pathCount / (efficientMs - copyMs) * 1e-3);
+
+    cudaFree(dev_input);
+    cudaFree(dev_paths);
+    cudaFree(dev_pathsOut);
+
+    printf("\n%d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * Host benchmark for how fast each sampler converges on a scene.
+ *
+ * Renders a reference with the CPU backend, then renders the scene again
+ * with every sampler type and reports the RMS error of the image against
+ * the reference after 1, 2, 4, ... samples per pixel, per color channel
+ * over all pixels. A second column gives the RMS error after a 3x3
+ * binomial blur of the difference, which is roughly what the eye sees:
+ * blue-noise samples leave the error in high frequencies the blur takes
+ * out. Camera samples matter most with depth of field and little else in
+ * the scene, as in dof.txt.
+ *
+ * The reference uses the random sampler at iterations after the ones
+ * measured, so it shares no samples with any of the runs. Its own noise
+ * adds to every error; give it several times MAXSPP samples.
+ *
+ * Host-only; built by nvcc for the same reason as cpuPathtrace.cu.
+ *
+ * Usage: convergence_bench [SCENEFILE] [SIZE] [MAXSPP] [REFERENCESPP] [THREADS]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cpuPathtrace.h"
+#include "scene.h"
+#include "utilities.h"
+
+static const char* samplerNames[] = { "random", "sobol", "bluenoise" };
+#define SAMPLER_TYPE_COUNT 3
+
+struct ImageError {
+    double rmse;
+    double blurredRmse;
+};
+
+/** Error of the `spp`-sample sum `image` of a `size` x `size` render. */
+static ImageError imageError(const std::vector<glm::vec3>& image, int spp, const std::vector<glm::vec3>& reference,
+    int size) {
+    std::vector<glm::vec3> diff(image.size());
+    ImageError e = {};
+    for (size_t i = 0; i < image.size(); i++) {
+        diff[i] = image[i] / (float)spp - reference[i];
+        e.rmse += glm::dot(diff[i], diff[i]);
+    }
+    const float weights[3] = { 0.25f, 0.5f, 0.25f };
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            glm::vec3 blurred(0.0f);
+            for (int j = -1; j <= 1; j++) {
+                for (int i = -1; i <= 1; i++) {
+                    int sx = glm::clamp(x + i, 0, size - 1);
+                    int sy = glm::clamp(y + j, 0, size - 1);
+                    blurred += weights[i + 1] * weights[j + 1] * diff[sy * size + sx];
+                }
+            }
+            e.blurredRmse += glm::dot(blurred, blurred);
+        }
+    }
+    e.rmse = std::sqrt(e.rmse / (3.0 * image.size()));
+    e.blurredRmse = std::sqrt(e.blurredRmse / (3.0 * image.size()));
+    return e;
+}
+
+/**
+ * Renders iterations firstIter .. firstIter + spp - 1 and returns the mean
+ * image. With a reference, appends the error after every power of two of
+ * samples to `errors`.
+ */
+static std::vector<glm::vec3> render(Scene& scene, const PathTraceOptions& options, int threads, int firstIter,
+    int spp, const std::vector<glm::vec3>* reference, std::vector<ImageError>* errors, double& seconds) {
+    std::vector<glm::vec3>& image = scene.state.image;
+    image.assign(image.size(), glm::vec3(0.0f));
+    cpuPathtraceInit(&scene, threads, options);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 1; i <= spp; i++) {
+        cpuPathtrace(firstIter + i - 1);
+        if (reference && (i & (i - 1)) == 0) {
+            errors->push_back(imageError(image, i, *reference, scene.state.camera.resolution.x));
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    seconds = std::chrono::duration<double>(end - start).count();
+    cpuPathtraceFree();
+
+    std::vector<glm::vec3> mean(image.size());
+    for (size_t i = 0; i < image.size(); i++) {
+        mean[i] = image[i] / (float)spp;
+    }
+    return mean;
+}
+
+int main(int argc, char** argv) {
+    const char* sceneFile = argc > 1 ? argv[1] : "../scenes/dof.txt";
+    int size = argc > 2 ? atoi(argv[2]) : 128;
+    int maxSpp = argc > 3 ? atoi(argv[3]) : 64;
+    int referenceSpp = argc > 4 ? atoi(argv[4]) : 1024;
+    int threads = argc > 5 ? atoi(argv[5]) : 0;
+    if (size <= 0 || maxSpp <= 0 || referenceSpp <= 0) {
+        fprintf(stderr, "Usage: %s [SCENEFILE] [SIZE] [MAXSPP] [REFERENCESPP] [THREADS]\n", argv[0]);
+        return 2;
+    }
+
+    Scene* scene;
+    try {
+        scene = new Scene(sceneFile);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Could not load %s: %s\n", sceneFile, e.what());
+        return 1;
+    }
+
+    // Square image of `size` pixels, keeping the scene's vertical fov
+    Camera& cam = scene->state.camera;
+    cam.resolution = glm::ivec2(size, size);
+    float yscaled = tan(cam.fov.y * (PI / 180));
+    cam.fov.x = cam.fov.y;
+    cam.pixelLength = glm::vec2(2 * yscaled / size, 2 * yscaled / size);
+    scene->state.image.assign(size * size, glm::vec3(0.0f));
+
+    PathTraceOptions options = {};
+    options.antialiasing = true;
+    options.depthOfField = true;
+    options.shading = SHADING_QUEUES;
+    options.compaction = COMPACTION_THRUST;
+    options.sceneBVH = true;
+    options.nextEventEstimation = true;
+    options.sampler = SAMPLER_RANDOM;
+
+    printf("%s: %dx%d, depth %d, reference %d spp\n", sceneFile, size, size, scene->state.traceDepth, referenceSpp);
+    double seconds;
+    std::vector<glm::vec3> reference = render(*scene, options, threads, maxSpp + 1, referenceSpp, NULL, NULL, seconds);
+    printf("reference rendered in %.1f s\n\n", seconds);
+
+    std::vector<ImageError> errors[SAMPLER_TYPE_COUNT];
+    double samplerSeconds[SAMPLER_TYPE_COUNT];
+    for (int type = 0; type < SAMPLER_TYPE_COUNT; type++) {
+        options.sampler = type;
+        render(*scene, options, threads, 1, maxSpp, &reference, &errors[type], samplerSeconds[type]);
+    }
+
+    printf("%6s", "spp");
+    for (int type = 0; type < SAMPLER_TYPE_COUNT; type++) {
+        printf("  %-30s", samplerNames[type]);
+    }
+    printf("\n");
+    for (size_t i = 0; i < errors[0].size(); i++) {
+        printf("%6d", 1 << i);
+        for (int type = 0; type < SAMPLER_TYPE_COUNT; type++) {
+            const ImageError& e = errors[type][i];
+            const ImageError& random = errors[SAMPLER_RANDOM][i];
+            printf("  %.4f %4.0f%%  %.4f %4.0f%%  ", e.rmse, 100.0 * e.rmse / random.rmse,
+                e.blurredRmse, 100.0 * e.blurredRmse / random.blurredRmse);
+        }
+        printf("\n");
+    }
+    printf("%6s", "s");
+    for (int type = 0; type < SAMPLER_TYPE_COUNT; type++) {
+        printf("  %-30.2f", samplerSeconds[type]);
+    }
+    printf("\n\nPer type: RMSE and blurred RMSE against the reference, each also as a share of random's.\n");
+
+    delete scene;
+    return 0;
+}
@@ -0,0 +1,328 @@
+/**
+ * Bytes moved per bounce by the wavefront loop's path state: an array of
+ * PathSegment records partitioned every bounce (the layout pathtrace()
+ * used to have) against the PathState streams and the slot list it
+ * compacts now.
+ *
+ * Both layouts run the same synthetic bounces: an intersection stage that
+ * reads each live path's ray, a shading stage that loads and stores the
+ * whole path, compaction, and a final gather into an image. About a
+ * quarter of the paths end each bounce, picked by a hash of pixel and
+ * bounce so both layouts retire the same paths; the counts and images are
+ * compared at the end. Bytes are what each stage's kernels read and write
+ * per live path, so they are a lower bound on the traffic; thrust's
+ * partition also goes through a temporary buffer.
+ *
+ * Needs a GPU. Exits with 1 if the layouts disagree.
+ *
+ * Usage: path_state_bench [PATHS] [BOUNCES] [ITERATIONS]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thrust/execution_policy.h>
+#include <thrust/partition.h>
+
+#include "intersections.h"
+#include "pathState.h"
+#include "sceneStructs.h"
+#include "../stream_compaction/common.h"
+
+#define SURVIVAL_PERCENT 75
+
+enum Stage { STAGE_INTERSECT, STAGE_SHADE, STAGE_COMPACT, STAGE_COUNT };
+static const char* stageNames[] = { "intersect", "shade", "compact" };
+
+// Bytes read and written per live path by each stage's kernels
+static const int aosBytes[STAGE_COUNT] = {
+    sizeof(Ray) + sizeof(float),                                // ray in, t out
+    sizeof(float) + 2 * sizeof(PathSegment),                    // t and the record in, record out
+    2 * sizeof(PathSegment),                                    // record in, record out
+};
+static const int soaBytes[STAGE_COUNT] = {
+    sizeof(int) + 2 * sizeof(glm::vec3) + sizeof(float),        // slot and ray in, t out
+    2 * sizeof(int) + (int)(2 * pathStateBytesPerPath()),       // slot, t and the streams in, streams out
+    2 * sizeof(int) + sizeof(unsigned char),                    // slot and its bounce count in, slot out
+};
+
+/** Whether the path of `pixel` carries on after `bounce`; the same in both layouts. */
+__host__ __device__ inline bool survives(int pixel, int bounce) {
+    return utilhash(pixel * 31 + bounce) % 100 < SURVIVAL_PERCENT;
+}
+
+__host__ __device__ inline PathSegment initialPath(int pixel, int bounces) {
+    PathSegment p;
+    p.ray.origin = glm::vec3(pixel % 977, pixel % 499, pixel % 251) * 0.01f;
+    p.ray.direction = glm::normalize(glm::vec3(1.0f, (pixel % 7) - 3.0f, 2.0f));
+    p.color = glm::vec3(1.0f);
+    p.radiance = glm::vec3(0.0f);
+    p.bsdfPdf = 0.0f;
+    p.pixelIndex = pixel;
+    p.remainingBounces = bounces;
+    return p;
+}
+
+__host__ __device__ inline float intersectStandIn(const Ray& ray) {
+    return fabsf(glm::dot(ray.origin, ray.direction)) * 1e-3f + 1.0f;
+}
+
+/** Stands in for shading: attenuates, moves the ray on and ends some paths. */
+__host__ __device__ inline void shadeStandIn(PathSegment& p, float t, int bounce) {
+    p.radiance += p.color * 0.05f;
+    p.color *= 0.8f;
+    p.ray.origin += t * p.ray.direction;
+    p.bsdfPdf = t;
+    p.remainingBounces = survives(p.pixelIndex, bounce) ? p.remainingBounces - 1 : 0;
+}
+
+__global__ void aosGenerate(int n, int bounces, PathSegment* paths) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        paths[i] = initialPath(i, bounces);
+    }
+}
+
+__global__ void aosIntersect(int n, const PathSegment* paths, float* t) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        t[i] = intersectStandIn(paths[i].ray);
+    }
+}
+
+__global__ void aosShade(int n, int bounce, const float* t, PathSegment* paths) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        PathSegment p = paths[i];
+        shadeStandIn(p, t[i], bounce);
+        paths[i] = p;
+    }
+}
+
+struct AosAlive {
+    __host__ __device__ bool operator()(const PathSegment& p) const {
+        return p.remainingBounces > 0;
+    }
+};
+
+__global__ void aosGather(int n, const PathSegment* paths, glm::vec3* image) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        image[paths[i].pixelIndex] = paths[i].color + paths[i].radiance;
+    }
+}
+
+__global__ void soaGenerate(int n, int bounces, PathState paths, int* activePaths) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        storePath(paths, i, initialPath(i, bounces));
+        activePaths[i] = i;
+    }
+}
+
+__global__ void soaIntersect(int n, const int* activePaths, PathState paths, float* t) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        int slot = activePaths[i];
+        Ray ray;
+        ray.origin = paths.origin[slot];
+        ray.direction = paths.direction[slot];
+        t[slot] = intersectStandIn(ray);
+    }
+}
+
+__global__ void soaShade(int n, int bounce, const int* activePaths, const float* t, PathState paths) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        int slot = activePaths[i];
+        PathSegment p = loadPath(paths, slot);
+        shadeStandIn(p, t[slot], bounce);
+        storePath(paths, slot, p);
+    }
+}
+
+struct SoaAlive {
+    const unsigned char* remainingBounces;
+
+    __host__ __device__ bool operator()(int slot) const {
+        return remainingBounces[slot] > 0;
+    }
+};
+
+__global__ void soaGather(int n, PathState paths, glm::vec3* image) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i < n) {
+        image[paths.pixelIndex[i]] = fromHalfColor(paths.throughput[i]) + paths.radiance[i];
+    }
+}
+
+/** Accumulates the milliseconds between begin() and end() per stage. */
+struct StageTimer {
+    cudaEvent_t startEvent, endEvent;
+    float ms[STAGE_COUNT];
+
+    StageTimer() {
+        cudaEventCreate(&startEvent);
+        cudaEventCreate(&endEvent);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            ms[s] = 0.0f;
+        }
+    }
+    ~StageTimer() {
+        cudaEventDestroy(startEvent);
+        cudaEventDestroy(endEvent);
+    }
+    void begin() {
+        cudaEventRecord(startEvent);
+    }
+    void end(int stage) {
+        cudaEventRecord(endEvent);
+        cudaEventSynchronize(endEvent);
+        float elapsed;
+        cudaEventElapsedTime(&elapsed, startEvent, endEvent);
+        ms[stage] += elapsed;
+    }
+};
+
+struct LayoutRun {
+    float ms[STAGE_COUNT];
+    long long liveBounces;      // live paths summed over every bounce
+    int bounces;
+    std::vector<glm::vec3> image;
+};
+
+static LayoutRun runAos(int n, int bounces, int iterations) {
+    PathSegment* dev_paths;
+    float* dev_t;
+    glm::vec3* dev_image;
+    cudaMalloc(&dev_paths, n * sizeof(PathSegment));
+    cudaMalloc(&dev_t, n * sizeof(float));
+    cudaMalloc(&dev_image, n * sizeof(glm::vec3));
+    const int blockSize = 128;
+    StageTimer timer;
+    LayoutRun run = {};
+
+    for (int iter = 0; iter < iterations; iter++) {
+        aosGenerate << <(n + blockSize - 1) / blockSize, blockSize >> > (n, bounces, dev_paths);
+        int live = n;
+        for (int bounce = 0; live > 0; bounce++) {
+            int blocks = (live + blockSize - 1) / blockSize;
+            run.liveBounces += live;
+            run.bounces++;
+            timer.begin();
+            aosIntersect << <blocks, blockSize >> > (live, dev_paths, dev_t);
+            timer.end(STAGE_INTERSECT);
+            timer.begin();
+            aosShade << <blocks, blockSize >> > (live, bounce, dev_t, dev_paths);
+            timer.end(STAGE_SHADE);
+            timer.begin();
+            live = thrust::partition(thrust::device, dev_paths, dev_paths + live, AosAlive()) - dev_paths;
+            timer.end(STAGE_COMPACT);
+        }
+    }
+    aosGather << <(n + blockSize - 1) / blockSize, blockSize >> > (n, dev_paths, dev_image);
+    checkCUDAError("runAos");
+
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        run.ms[s] = timer.ms[s];
+    }
+    run.image.resize(n);
+    cudaMemcpy(run.image.data(), dev_image, n * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+    cudaFree(dev_paths);
+    cudaFree(dev_t);
+    cudaFree(dev_image);
+    return run;
+}
+
+static LayoutRun runSoa(int n, int bounces, int iterations) {
+    PathState paths;
+    allocPathState(paths, n);
+    int* dev_activePaths;
+    float* dev_t;
+    glm::vec3* dev_image;
+    cudaMalloc(&dev_activePaths, n * sizeof(int));
+    cudaMalloc(&dev_t, n * sizeof(float));
+    cudaMalloc(&dev_image, n * sizeof(glm::vec3));
+    const int blockSize = 128;
+    StageTimer timer;
+    LayoutRun run = {};
+    SoaAlive alive = { paths.remainingBounces };
+
+    for (int iter = 0; iter < iterations; iter++) {
+        soaGenerate << <(n + blockSize - 1) / blockSize, blockSize >> > (n, bounces, paths, dev_activePaths);
+        int live = n;
+        for (int bounce = 0; live > 0; bounce++) {
+            int blocks = (live + blockSize - 1) / blockSize;
+            run.liveBounces += live;
+            run.bounces++;
+            timer.begin();
+            soaIntersect << <blocks, blockSize >> > (live, dev_activePaths, paths, dev_t);
+            timer.end(STAGE_INTERSECT);
+            timer.begin();
+            soaShade << <blocks, blockSize >> > (live, bounce, dev_activePaths, dev_t, paths);
+            timer.end(STAGE_SHADE);
+            timer.begin();
+            live = thrust::partition(thrust::device, dev_activePaths, dev_activePaths + live, alive) - dev_activePaths;
+            timer.end(STAGE_COMPACT);
+        }
+    }
+    soaGather << <(n + blockSize - 1) / blockSize, blockSize >> > (n, paths, dev_image);
+    checkCUDAError("runSoa");
+
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        run.ms[s] = timer.ms[s];
+    }
+    run.image.resize(n);
+    cudaMemcpy(run.image.data(), dev_image, n * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+    freePathState(paths);
+    cudaFree(dev_activePaths);
+    cudaFree(dev_t);
+    cudaFree(dev_image);
+    return run;
+}
+
+static void report(const char* layout, const LayoutRun& run, const int* bytes) {
+    double totalBytes = 0.0;
+    float totalMs = 0.0f;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        double stageBytes = (double)bytes[s] * run.liveBounces;
+        totalBytes += stageBytes;
+        totalMs += run.ms[s];
+        printf("%-6s %-10s %4d B/path %10.1f MB/bounce %9.3f ms/bounce %8.2f GB/s\n", layout, stageNames[s],
+            bytes[s], stageBytes / run.bounces * 1e-6, run.ms[s] / run.bounces,
+            run.ms[s] > 0 ? stageBytes / run.ms[s] * 1e-6 : 0.0);
+    }
+    printf("%-6s %-10s %4s      %10.1f MB/bounce %9.3f ms/bounce\n", layout, "total", "",
+        totalBytes / run.bounces * 1e-6, totalMs / run.bounces);
+}
+
+int main(int argc, char** argv) {
+    int pathCount = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    int bounces = argc > 2 ? atoi(argv[2]) : 8;
+    int iterations = argc > 3 ? atoi(argv[3]) : 10;
+    if (pathCount <= 0 || bounces <= 0 || bounces > PATH_MAX_BOUNCES || iterations <= 0) {
+        fprintf(stderr, "Usage: %s [PATHS] [BOUNCES (1..%d)] [ITERATIONS]\n", argv[0], PATH_MAX_BOUNCES);
+        return 1;
+    }
+
+    // Warm up thrust's allocations before timing either layout
+    runSoa(pathCount, bounces, 1);
+    LayoutRun aos = runAos(pathCount, bounces, iterations);
+    LayoutRun soa = runSoa(pathCount, bounces, iterations);
+
+    printf("%d paths, up to %d bounces, %d iterations, %d%% survive each bounce\n",
+        pathCount, bounces, iterations, SURVIVAL_PERCENT);
+    printf("PathSegment %d B, PathState %d B per path\n\n", (int)sizeof(PathSegment), (int)pathStateBytesPerPath());
+    report("aos", aos, aosBytes);
+    report("soa", soa, soaBytes);
+
+    // Half-precision throughput: compare to a relative tolerance
+    int mismatches = aos.liveBounces != soa.liveBounces;
+    for (int i = 0; i < pathCount; i++) {
+        glm::vec3 d = glm::abs(aos.image[i] - soa.image[i]);
+        if (glm::max(d.x, glm::max(d.y, d.z)) > 1e-2f * glm::max(1.0f, aos.image[i].x)) {
+            mismatches++;
+        }
+    }
+    printf("\nlayouts %s (%d mismatches)\n", mismatches ? "DIFFER" : "agree", mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+/**
+ * Host checks and timings for the samplers in sampler.h.
+ *
+ * Checks, for both sampler types:
+ *  - reproducibility: a value depends only on (pixel, sample, dimension),
+ *    and a Sampler hands out the same values as sampleDimension;
+ *  - uniformity: a chi-square test of each camera dimension and a few
+ *    bounce dimensions over many pixels and samples.
+ * and for Sobol:
+ *  - every power-of-two prefix of a pixel's samples puts exactly one point
+ *    in each of that many equal intervals of every dimension, and dimension
+ *    pairs (0, 1) are (0, m, 2)-nets.
+ * and for the blue-noise tile:
+ *  - it holds every rank once, and neighbouring texels are further apart
+ *    in value than white noise's;
+ *  - the camera samples drawn from it keep the 1D stratification.
+ *
+ * Then reports the RMS error of estimating the area of a disk and the
+ * integral of a smooth 2D function per sample count, and the time per
+ * sample, next to the seeded thrust engine the renderer used before.
+ *
+ * Host-only. Exits with 1 if a check fails.
+ *
+ * Usage: sampler_bench [PIXELS]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thrust/random.h>
+
+#include "blueNoise.h"
+#include "intersections.h"
+#include "sampler.h"
+
+static const char* typeNames[] = { "random", "sobol", "bluenoise" };
+static int failures = 0;
+
+static void check(bool ok, const char* what, int type) {
+    if (!ok) {
+        printf("FAIL %-8s %s\n", typeNames[type], what);
+        failures++;
+    }
+}
+
+static void checkReproducible(int type, int pixels) {
+    bool same = true;
+    bool cursorMatches = true;
+    int collisions = 0;
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        Sampler s = bounceSampler(type, pixel, 7, 3);
+        unsigned int first = s.dimension;
+        for (int d = 0; d < 6; d++) {
+            float a = sampleDimension(type, pixel, 6, first + d);
+            same &= a == sampleDimension(type, pixel, 6, first + d);
+            cursorMatches &= sample1D(s) == a;
+        }
+        collisions += sampleDimension(type, pixel, 0, 0) == sampleDimension(type, pixel + 1, 0, 0);
+    }
+    check(same, "same keys give the same value", type);
+    check(cursorMatches, "Sampler matches sampleDimension", type);
+    check(collisions <= pixels / 1000, "neighbouring pixels differ", type);
+}
+
+/** Chi-square statistic of `samples` samples of one dimension over `pixels` pixels, 256 bins. */
+static double chiSquare(int type, int pixels, int samples, unsigned int dimension) {
+    const int bins = 256;
+    std::vector<int> counts(bins, 0);
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        for (int i = 0; i < samples; i++) {
+            float u = sampleDimension(type, pixel, i, dimension);
+            if (!(u >= 0.0f && u < 1.0f)) {
+                return INFINITY;
+            }
+            counts[(int)(u * bins)]++;
+        }
+    }
+    double expected = (double)pixels * samples / bins;
+    double chi2 = 0.0;
+    for (int b = 0; b < bins; b++) {
+        chi2 += (counts[b] - expected) * (counts[b] - expected) / expected;
+    }
+    return chi2;
+}
+
+static void checkUniform(int type, int pixels) {
+    // 255 degrees of freedom: p = 0.001 at about 330
+    const unsigned int dimensions[] = { 0, 1, 2, 3, 4, 5, 6, 7, 20, 61, 200 };
+    for (unsigned int d : dimensions) {
+        double chi2 = chiSquare(type, pixels, 64, d);
+        char what[64];
+        snprintf(what, sizeof(what), "uniform in dimension %u (chi2 %.1f)", d, chi2);
+        check(chi2 < 330.0, what, type);
+    }
+}
+
+static void checkStratified(int pixels) {
+    bool oneD = true;
+    bool net = true;
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        for (int m = 1; m <= 10; m++) {
+            int n = 1 << m;
+            for (unsigned int d = 0; d < 8; d++) {
+                std::vector<int> hits(n, 0);
+                for (int i = 0; i < n; i++) {
+                    hits[(int)(sobolSample(pixel, i, d) * n)]++;
+                }
+                for (int h : hits) {
+                    oneD &= h == 1;
+                }
+            }
+            // Every split of n into 2^a by 2^(m-a) cells gets one point per cell
+            for (int a = 0; a <= m; a++) {
+                std::vector<int> hits(n, 0);
+                for (int i = 0; i < n; i++) {
+                    int cx = (int)(sobolSample(pixel, i, 0) * (1 << a));
+                    int cy = (int)(sobolSample(pixel, i, 1) * (1 << (m - a)));
+                    hits[(cx << (m - a)) | cy]++;
+                }
+                for (int h : hits) {
+                    net &= h == 1;
+                }
+            }
+        }
+    }
+    check(oneD, "power-of-two prefixes stratified in 1D", SAMPLER_SOBOL);
+    check(net, "dimensions 0 and 1 form (0, m, 2)-nets", SAMPLER_SOBOL);
+}
+
+static void checkBlueNoise(int pixels) {
+    const std::vector<float>& tile = blueNoiseTexture();
+    const int n = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+    std::vector<int> ranks(n, 0);
+    double step = 0.0;
+    for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+        for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+            float v = tile[y * BLUE_NOISE_SIZE + x];
+            ranks[glm::clamp((int)(v * n), 0, n - 1)]++;
+            // Across the right edge too, since the tile repeats
+            step += std::fabs(v - tile[y * BLUE_NOISE_SIZE + (x + 1) % BLUE_NOISE_SIZE]);
+        }
+    }
+    bool permutation = true;
+    for (int r : ranks) {
+        permutation &= r == 1;
+    }
+    check(permutation, "blue-noise tile holds every rank once", SAMPLER_BLUE_NOISE);
+    // White noise differs by 1/3 on average from its neighbour
+    check(step / n > 0.37, "blue-noise neighbours far apart", SAMPLER_BLUE_NOISE);
+
+    bool stratified = true;
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        for (int m = 1; m <= 8; m++) {
+            int count = 1 << m;
+            std::vector<int> hits(4 * count, 0);
+            for (int i = 0; i < count; i++) {
+                glm::vec4 u = blueNoiseCameraSample(tile.data(), pixel % 97, pixel / 97, i);
+                for (int d = 0; d < 4; d++) {
+                    hits[d * count + (int)(u[d] * count)]++;
+                }
+            }
+            for (int h : hits) {
+                stratified &= h == 1;
+            }
+        }
+    }
+    check(stratified, "blue-noise camera samples stratified in 1D", SAMPLER_BLUE_NOISE);
+}
+
+static double smoothIntegrand(glm::vec2 u) {
+    return std::exp(-u.x * u.x) * std::sin(3.0 * u.y + 1.0);
+}
+
+/** RMS error over `pixels` pixels of the n-sample estimates of a disk's area and a smooth integral. */
+static void convergence(int type, int pixels, int n, double& diskRmse, double& smoothRmse) {
+    const double diskArea = PI * 0.25 * 0.25;
+    // Integral of exp(-x^2) on [0, 1] times that of sin(3y + 1) on [0, 1]
+    const double smoothIntegral = 0.746824132812427 * (std::cos(1.0) - std::cos(4.0)) / 3.0;
+    double diskSum = 0.0;
+    double smoothSum = 0.0;
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        double disk = 0.0;
+        double smooth = 0.0;
+        for (int i = 0; i < n; i++) {
+            Sampler s = cameraSampler(type, pixel, i + 1);
+            glm::vec2 u = sample2D(s);
+            disk += glm::length(u - glm::vec2(0.5f)) < 0.25f;
+            smooth += smoothIntegrand(u);
+        }
+        diskSum += (disk / n - diskArea) * (disk / n - diskArea);
+        smoothSum += (smooth / n - smoothIntegral) * (smooth / n - smoothIntegral);
+    }
+    diskRmse = std::sqrt(diskSum / pixels);
+    smoothRmse = std::sqrt(smoothSum / pixels);
+}
+
+template<typename F>
+static double nsPerSample(int count, F&& draw) {
+    draw(); // warmup
+    auto start = std::chrono::high_resolution_clock::now();
+    volatile float sink = draw();
+    (void)sink;
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - start).count() * 1e9 / count;
+}
+
+int main(int argc, char** argv) {
+    int pixels = argc > 1 ? atoi(argv[1]) : 4096;
+    if (pixels <= 0) {
+        fprintf(stderr, "Usage: %s [PIXELS]\n", argv[0]);
+        return 2;
+    }
+
+    for (int type = SAMPLER_RANDOM; type <= SAMPLER_SOBOL; type++) {
+        checkReproducible(type, pixels);
+        checkUniform(type, pixels);
+    }
+    checkStratified(pixels < 64 ? pixels : 64);
+    checkBlueNoise(pixels);
+    printf("checks: %s\n", failures == 0 ? "all passed" : "FAILED");
+
+    printf("\n%6s  %-24s %-24s\n", "spp", "disk RMSE (random/sobol)", "smooth RMSE (random/sobol)");
+    for (int n = 4; n <= 256; n *= 2) {
+        double disk[2];
+        double smooth[2];
+        for (int type = SAMPLER_RANDOM; type <= SAMPLER_SOBOL; type++) {
+            convergence(type, pixels, n, disk[type], smooth[type]);
+        }
+        printf("%6d  %10.5f / %-10.5f  %10.5f / %-10.5f\n", n, disk[0], disk[1], smooth[0], smooth[1]);
+    }
+
+    // One path vertex's worth: seed, then draw eight dimensions
+    const int count = 1 << 20;
+    printf("\nns per sample, drawing %d per setup:\n", 8);
+    printf("  thrust engine (old)  %6.2f\n", nsPerSample(count, [&]() {
+        float sum = 0.0f;
+        for (int i = 0; i < count / 8; i++) {
+            int h = utilhash((1 << 31) | (3 << 22) | 7) ^ utilhash(i);
+            thrust::default_random_engine rng(h);
+            thrust::uniform_real_distribution<float> u01(0, 1);
+            for (int d = 0; d < 8; d++) {
+                sum += u01(rng);
+            }
+        }
+        return sum;
+    }));
+    for (int type = SAMPLER_RANDOM; type <= SAMPLER_SOBOL; type++) {
+        printf("  %-20s %6.2f\n", typeNames[type], nsPerSample(count, [&]() {
+            float sum = 0.0f;
+            for (int i = 0; i < count / 8; i++) {
+                Sampler s = bounceSampler(type, i, 7, 3);
+                for (int d = 0; d < 8; d++) {
+                    sum += sample1D(s);
+                }
+            }
+            return sum;
+        }));
+    }
+
+    return failures == 0 ? 0 : 1;
+}
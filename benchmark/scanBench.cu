@@ -0,0 +1,272 @@
+/**
+ * Throughput sweep for every scan and stream compaction backend in
+ * stream_compaction: CPU, naive, work-efficient and thrust scans, and CPU
+ * (with and without scan) and work-efficient compaction.
+ *
+ * Sizes run from 2^MINLOG to 2^MAXLOG, each as a power of two and as that
+ * minus 3. Every backend is run WARMUP times, then timed REPEATS times; GPU
+ * backends report their own timer, which leaves out host transfers. The
+ * last output of each size is checked against CPU::scan (or the plain
+ * compaction loop). Throughput is elements per second and effective
+ * bandwidth counts each element read and written once.
+ *
+ * Without a CUDA device, only the CPU backends run.
+ *
+ * Usage: scan_bench [--min-log N] [--max-log N] [--repeats N] [--warmup N]
+ *                   [--cpu-only] [--csv FILE] [--json FILE]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "testing_helpers.hpp"
+#include "../stream_compaction/cpu.h"
+#include "../stream_compaction/efficient.h"
+#include "../stream_compaction/naive.h"
+#include "../stream_compaction/thrust.h"
+
+using namespace StreamCompaction;
+
+namespace {
+    struct Backend {
+        const char* op;         // "scan" or "compact"
+        const char* name;
+        bool gpu;
+        /** Runs once on the first n inputs and returns milliseconds; *count gets the compacted size. */
+        std::function<float(int n, int* odata, const int* idata, int* count)> run;
+    };
+
+    struct Result {
+        std::string op;
+        std::string backend;
+        int n;
+        bool pow2;
+        int repeats;
+        double meanMs, medianMs, minMs, maxMs, stddevMs;
+        double elemsPerSecond;
+        double gbPerSecond;
+        bool verified;
+    };
+
+    template <typename F>
+    float cpuMilliseconds(F&& f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    std::vector<Backend> makeBackends(bool gpu) {
+        std::vector<Backend> backends;
+        backends.push_back({ "scan", "cpu", false, [](int n, int* o, const int* i, int* c) {
+            *c = n;
+            return cpuMilliseconds([&]() { CPU::scan(n, o, i); });
+        } });
+        backends.push_back({ "compact", "cpu", false, [](int n, int* o, const int* i, int* c) {
+            *c = CPU::compactWithoutScan(n, o, i);
+            return CPU::timer().getCpuElapsedTimeForPreviousOperation();
+        } });
+        backends.push_back({ "compact", "cpu-scan", false, [](int n, int* o, const int* i, int* c) {
+            *c = CPU::compactWithScan(n, o, i);
+            return CPU::timer().getCpuElapsedTimeForPreviousOperation();
+        } });
+        if (!gpu) {
+            return backends;
+        }
+        backends.push_back({ "scan", "naive", true, [](int n, int* o, const int* i, int* c) {
+            *c = n;
+            Naive::scan(n, o, i);
+            return Naive::timer().getGpuElapsedTimeForPreviousOperation();
+        } });
+        backends.push_back({ "scan", "efficient", true, [](int n, int* o, const int* i, int* c) {
+            *c = n;
+            Efficient::scan(n, o, i);
+            return Efficient::timer().getGpuElapsedTimeForPreviousOperation();
+        } });
+        backends.push_back({ "scan", "thrust", true, [](int n, int* o, const int* i, int* c) {
+            *c = n;
+            Thrust::scan(n, o, i);
+            return Thrust::timer().getGpuElapsedTimeForPreviousOperation();
+        } });
+        backends.push_back({ "compact", "efficient", true, [](int n, int* o, const int* i, int* c) {
+            *c = Efficient::compact(n, o, i);
+            return Efficient::timer().getGpuElapsedTimeForPreviousOperation();
+        } });
+        return backends;
+    }
+
+    bool hasCudaDevice() {
+        int count = 0;
+        return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+    }
+
+    Result measure(const Backend& b, int n, bool pow2, int warmup, int repeats,
+            const int* input, int* output, const int* expected, int expectedCount) {
+        int count = 0;
+        for (int i = 0; i < warmup; i++) {
+            b.run(n, output, input, &count);
+        }
+        std::vector<double> times(repeats);
+        for (int i = 0; i < repeats; i++) {
+            times[i] = b.run(n, output, input, &count);
+        }
+
+        Result r;
+        r.op = b.op;
+        r.backend = b.name;
+        r.n = n;
+        r.pow2 = pow2;
+        r.repeats = repeats;
+        std::sort(times.begin(), times.end());
+        r.minMs = times.front();
+        r.maxMs = times.back();
+        r.medianMs = repeats % 2 ? times[repeats / 2] : 0.5 * (times[repeats / 2 - 1] + times[repeats / 2]);
+        double sum = 0, sumSq = 0;
+        for (double t : times) {
+            sum += t;
+            sumSq += t * t;
+        }
+        r.meanMs = sum / repeats;
+        r.stddevMs = std::sqrt(std::max(0.0, sumSq / repeats - r.meanMs * r.meanMs));
+
+        // Scans read and write every element; compaction writes only the kept ones
+        double bytes = sizeof(int) * ((double)n + (strcmp(b.op, "scan") == 0 ? n : count));
+        r.elemsPerSecond = r.meanMs > 0 ? n / (r.meanMs * 1e-3) : 0;
+        r.gbPerSecond = r.meanMs > 0 ? bytes / (r.meanMs * 1e-3) * 1e-9 : 0;
+        r.verified = count == expectedCount && !cmpArrays(count, output, const_cast<int*>(expected));
+        return r;
+    }
+
+    void writeCsv(const char* path, const std::vector<Result>& results) {
+        FILE* f = fopen(path, "w");
+        if (!f) {
+            fprintf(stderr, "Could not write %s\n", path);
+            return;
+        }
+        fprintf(f, "op,backend,n,pow2,repeats,mean_ms,median_ms,min_ms,max_ms,stddev_ms,elems_per_s,gb_per_s,verified\n");
+        for (const Result& r : results) {
+            fprintf(f, "%s,%s,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.0f,%.3f,%d\n",
+                r.op.c_str(), r.backend.c_str(), r.n, r.pow2, r.repeats, r.meanMs, r.medianMs,
+                r.minMs, r.maxMs, r.stddevMs, r.elemsPerSecond, r.gbPerSecond, r.verified);
+        }
+        fclose(f);
+    }
+
+    void writeJson(const char* path, const std::vector<Result>& results) {
+        FILE* f = fopen(path, "w");
+        if (!f) {
+            fprintf(stderr, "Could not write %s\n", path);
+            return;
+        }
+        fprintf(f, "[\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            fprintf(f, "  {\"op\": \"%s\", \"backend\": \"%s\", \"n\": %d, \"pow2\": %s, \"repeats\": %d, "
+                "\"mean_ms\": %.6f, \"median_ms\": %.6f, \"min_ms\": %.6f, \"max_ms\": %.6f, \"stddev_ms\": %.6f, "
+                "\"elems_per_s\": %.0f, \"gb_per_s\": %.3f, \"verified\": %s}%s\n",
+                r.op.c_str(), r.backend.c_str(), r.n, r.pow2 ? "true" : "false", r.repeats,
+                r.meanMs, r.medianMs, r.minMs, r.maxMs, r.stddevMs, r.elemsPerSecond, r.gbPerSecond,
+                r.verified ? "true" : "false", i + 1 < results.size() ? "," : "");
+        }
+        fprintf(f, "]\n");
+        fclose(f);
+    }
+}
+
+int main(int argc, char** argv) {
+    int minLog = 10;
+    int maxLog = 28;
+    int repeats = 10;
+    int warmup = 2;
+    bool cpuOnly = false;
+    const char* csvPath = NULL;
+    const char* jsonPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--min-log" && hasValue) {
+            minLog = atoi(argv[++i]);
+        } else if (arg == "--max-log" && hasValue) {
+            maxLog = atoi(argv[++i]);
+        } else if (arg == "--repeats" && hasValue) {
+            repeats = atoi(argv[++i]);
+        } else if (arg == "--warmup" && hasValue) {
+            warmup = atoi(argv[++i]);
+        } else if (arg == "--cpu-only") {
+            cpuOnly = true;
+        } else if (arg == "--csv" && hasValue) {
+            csvPath = argv[++i];
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--min-log N] [--max-log N] [--repeats N] [--warmup N] "
+                "[--cpu-only] [--csv FILE] [--json FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (minLog < 2 || maxLog > 29 || minLog > maxLog || repeats < 1 || warmup < 0) {
+        fprintf(stderr, "Need 2 <= min-log <= max-log <= 29, repeats >= 1 and warmup >= 0\n");
+        return 2;
+    }
+
+    bool gpu = !cpuOnly && hasCudaDevice();
+    if (!cpuOnly && !gpu) {
+        printf("No CUDA device found; running the CPU backends only\n");
+    }
+    std::vector<Backend> backends = makeBackends(gpu);
+
+    // One input for every size: an exclusive scan of a prefix is the prefix
+    // of the scan, so the reference is computed once. Values in [0, 4) leave
+    // zeros to compact and keep sums of 2^29 elements inside an int.
+    const int maxN = 1 << maxLog;
+    std::vector<int> input(maxN), expectedScan(maxN), expectedCompact(maxN), output(maxN);
+    genArray(maxN, input.data(), 4);
+    CPU::scan(maxN, expectedScan.data(), input.data());
+
+    std::vector<Result> results;
+    printf("%-8s %-10s %11s %10s %10s %10s %13s %9s  %s\n",
+        "op", "backend", "n", "mean ms", "min ms", "stddev ms", "Melems/s", "GB/s", "check");
+    for (int log = minLog; log <= maxLog; log++) {
+        for (int npot = 0; npot < 2; npot++) {
+            const int n = (1 << log) - (npot ? 3 : 0);
+            int compactedCount = 0;
+            for (int i = 0; i < n; i++) {
+                if (input[i] != 0) {
+                    expectedCompact[compactedCount++] = input[i];
+                }
+            }
+            for (const Backend& b : backends) {
+                bool scan = strcmp(b.op, "scan") == 0;
+                Result r = measure(b, n, !npot, warmup, repeats, input.data(), output.data(),
+                    scan ? expectedScan.data() : expectedCompact.data(), scan ? n : compactedCount);
+                printf("%-8s %-10s %11d %10.3f %10.3f %10.3f %13.2f %9.2f  %s\n",
+                    r.op.c_str(), r.backend.c_str(), r.n, r.meanMs, r.minMs, r.stddevMs,
+                    r.elemsPerSecond * 1e-6, r.gbPerSecond, r.verified ? "passed" : "FAIL");
+                fflush(stdout);
+                results.push_back(r);
+            }
+        }
+    }
+
+    if (csvPath) {
+        writeCsv(csvPath, results);
+    }
+    if (jsonPath) {
+        writeJson(jsonPath, results);
+    }
+
+    int failures = 0;
+    for (const Result& r : results) {
+        failures += !r.verified;
+    }
+    if (failures) {
+        printf("%d run(s) did not match CPU::scan / the reference compaction\n", failures);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * Host check and timing of the top-level scene BVH.
+ *
+ * Traces rays through sceneBVHIntersectionTest and through the plain loop
+ * over every geom in sceneLinearIntersectionTest, and fails on any ray
+ * where the two disagree in t, geomId or primId. The only exception is an
+ * exact tie between two coincident geoms (same type, mesh and transform),
+ * which either loop may report. Half the rays leave the camera towards
+ * random points in the scene bounds; the other half start at random points
+ * inside the bounds in random directions, so geoms are hit from every side
+ * and from within. Then reports the BVH's speedup.
+ *
+ * Host-only. Exits with 1 if a ray disagrees.
+ *
+ * Usage: scene_bvh_bench [SCENEFILE] [RAYS]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "intersections.h"
+#include "scene.h"
+
+int main(int argc, char** argv) {
+    const char* sceneFile = argc > 1 ? argv[1] : "../scenes/objLoading.txt";
+    int rayCount = argc > 2 ? atoi(argv[2]) : 20000;
+    if (rayCount <= 0) {
+        fprintf(stderr, "Usage: %s [SCENEFILE] [RAYS]\n", argv[0]);
+        return 2;
+    }
+
+    Scene* scene;
+    try {
+        scene = new Scene(sceneFile);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Could not load %s: %s\n", sceneFile, e.what());
+        return 1;
+    }
+    Geom* geoms = scene->geoms.data();
+    int geomCount = scene->geoms.size();
+    const Mesh* meshes = scene->meshes.data();
+
+    BoundingBox bounds = scene->sceneBVH[0].bounds;
+    std::mt19937 rng(565);
+    std::uniform_real_distribution<float> u01(0.f, 1.f);
+    auto pointInBounds = [&]() {
+        return glm::mix(bounds.min, bounds.max, glm::vec3(u01(rng), u01(rng), u01(rng)));
+    };
+    std::vector<Ray> rays(rayCount);
+    for (int i = 0; i < rayCount; i++) {
+        if (i % 2 == 0) {
+            rays[i].origin = scene->state.camera.position;
+            rays[i].direction = glm::normalize(pointInBounds() - rays[i].origin);
+        }
+        else {
+            float z = 2.f * u01(rng) - 1.f;
+            float phi = TWO_PI * u01(rng);
+            float r = sqrt(glm::max(0.f, 1.f - z * z));
+            rays[i].origin = pointInBounds();
+            rays[i].direction = glm::vec3(r * cos(phi), r * sin(phi), z);
+        }
+    }
+
+    std::vector<ShadeableIntersection> linear(rayCount);
+    std::vector<ShadeableIntersection> bvh(rayCount);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rayCount; i++) {
+        linear[i] = ShadeableIntersection();
+        linear[i].geomId = sceneLinearIntersectionTest(geoms, geomCount, meshes, rays[i], linear[i]);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rayCount; i++) {
+        bvh[i] = ShadeableIntersection();
+        bvh[i].geomId = sceneBVHIntersectionTest(geoms, meshes, scene->sceneBVH.data(),
+            scene->sceneGeomIndices.data(), rays[i], bvh[i]);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    int mismatches = 0;
+    int coincident = 0;
+    int hits = 0;
+    for (int i = 0; i < rayCount; i++) {
+        const ShadeableIntersection& a = linear[i];
+        const ShadeableIntersection& b = bvh[i];
+        bool hit = a.geomId >= 0;
+        hits += hit;
+        bool agree = a.geomId == b.geomId && (!hit || (a.t == b.t && a.primId == b.primId));
+        if (!agree && hit && b.geomId >= 0 && a.t == b.t && a.primId == b.primId
+                && geoms[a.geomId].type == geoms[b.geomId].type && geoms[a.geomId].meshid == geoms[b.geomId].meshid
+                && geoms[a.geomId].transform == geoms[b.geomId].transform) {
+            coincident++;
+            continue;
+        }
+        if (!agree && ++mismatches <= 5) {
+            printf("  ray %d: linear t=%g geom %d prim %d, BVH t=%g geom %d prim %d\n",
+                i, a.t, a.geomId, a.primId, b.t, b.geomId, b.primId);
+        }
+    }
+
+    double linearSeconds = std::chrono::duration<double>(mid - start).count();
+    double bvhSeconds = std::chrono::duration<double>(end - mid).count();
+    printf("%s: %d geoms, %d BVH nodes, %d rays (%d hits, %d on coincident geoms)\n",
+        sceneFile, geomCount, (int)scene->sceneBVH.size(), rayCount, hits, coincident);
+    printf("linear %.2f ms, BVH %.2f ms, %.1fx faster\n",
+        linearSeconds * 1e3, bvhSeconds * 1e3, bvhSeconds > 0 ? linearSeconds / bvhSeconds : 0.0);
+    printf("check: %s (%d rays disagree)\n", mismatches == 0 ? "passed" : "FAILED", mismatches);
+
+    delete scene;
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/**
+ * Host benchmark for the shading stage of the wavefront loop.
+ *
+ * Traces whole-image wavefronts like pathtrace() does on the GPU and times
+ * only the shading stage of every bounce, ordered three ways:
+ *  - unsorted: shade paths in place;
+ *  - sort:     reorder PathSegments and intersections by material id first;
+ *  - queue:    counting-sort path indices into per-material-class queues
+ *              and run the specialized routine over each.
+ * Samples are keyed by pixel and bounce, so all three must produce the same
+ * image; the checksum column confirms it. Next-event estimation is on when
+ * the scene has sampled lights; its shadow rays are traced outside the
+ * timer. For the GPU kernels, run cis565_path_tracer_batch with
+ * --shading unsorted|sort|queue.
+ *
+ * Host-only; built by nvcc for the same reason as cpuPathtrace.cu. Exits
+ * with 1 if an ordering changes the checksum.
+ *
+ * Usage: shading_bench [SCENEFILE] [SIZE] [ITERATIONS]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cpuPathtrace.h"
+#include "pathtraceCore.h"
+#include "scene.h"
+
+struct PathAlive {
+    bool operator()(const PathSegment& path) const {
+        return path.remainingBounces > 0;
+    }
+};
+
+struct ShadingRun {
+    double shadeSeconds;
+    double totalSeconds;
+    long long pathsShaded;
+    int bounces;
+    double checksum;
+};
+
+static ShadingRun run(Scene& scene, int shading, int iterations) {
+    const Camera& cam = scene.state.camera;
+    const int pixelcount = cam.resolution.x * cam.resolution.y;
+    const int roulette = rouletteBounces(scene.state.traceDepth, scene.state.rouletteDepth);
+    std::vector<PathSegment> paths(pixelcount);
+    std::vector<ShadeableIntersection> intersections(pixelcount);
+    std::vector<ShadowRay> shadowRays(pixelcount);
+    LightList lights;
+    lights.lights = scene.lights.data();
+    lights.lightCount = scene.lights.size();
+    lights.geoms = scene.geoms.data();
+    std::vector<glm::vec3> image(pixelcount);
+    CpuShadingScratch scratch;
+
+    ShadingRun result = {};
+    auto runStart = std::chrono::high_resolution_clock::now();
+    for (int iter = 1; iter <= iterations; iter++) {
+        for (int y = 0; y < cam.resolution.y; y++) {
+            for (int x = 0; x < cam.resolution.x; x++) {
+                generatePathSegment(cam, iter, x, y, scene.state.traceDepth, true, true, 0, SAMPLER_SOBOL, NULL,
+                    paths[x + y * cam.resolution.x]);
+            }
+        }
+
+        int active = pixelcount;
+        while (active > 0) {
+            for (int i = 0; i < active; i++) {
+                intersectPathSegment(paths[i], scene.geoms.data(), scene.geoms.size(), scene.meshes.data(),
+                    scene.sceneBVH.data(), scene.sceneGeomIndices.data(), true, intersections[i]);
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            cpuShadePaths(shading, iter, SAMPLER_SOBOL, roulette, paths.data(), intersections.data(), active,
+                scene.materials.data(), scene.geoms.data(), scene.meshes.data(), lights, shadowRays.data(), scratch);
+            auto end = std::chrono::high_resolution_clock::now();
+            result.shadeSeconds += std::chrono::duration<double>(end - start).count();
+            result.pathsShaded += active;
+            result.bounces++;
+
+            for (int i = 0; i < active; i++) {
+                traceShadowRay(shadowRays[i], paths[i], scene.geoms.data(), scene.geoms.size(), scene.meshes.data(),
+                    scene.sceneBVH.data(), scene.sceneGeomIndices.data(), true);
+            }
+
+            active = std::partition(paths.begin(), paths.begin() + active, PathAlive()) - paths.begin();
+        }
+
+        for (int i = 0; i < pixelcount; i++) {
+            image[paths[i].pixelIndex] += paths[i].color + paths[i].radiance;
+        }
+    }
+    auto runEnd = std::chrono::high_resolution_clock::now();
+    result.totalSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+
+    for (int i = 0; i < pixelcount; i++) {
+        result.checksum += image[i].x + image[i].y * 2.0 + image[i].z * 3.0;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    const char* sceneFile = argc > 1 ? argv[1] : "../scenes/materialTypes.txt";
+    int size = argc > 2 ? atoi(argv[2]) : 256;
+    int iterations = argc > 3 ? atoi(argv[3]) : 4;
+
+    Scene* scene;
+    try {
+        scene = new Scene(sceneFile);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Could not load %s: %s\n", sceneFile, e.what());
+        return 1;
+    }
+
+    // Square image of `size` pixels, keeping the scene's vertical fov
+    Camera& cam = scene->state.camera;
+    cam.resolution = glm::ivec2(size, size);
+    float yscaled = tan(cam.fov.y * (PI / 180));
+    cam.fov.x = cam.fov.y;
+    cam.pixelLength = glm::vec2(2 * yscaled / size, 2 * yscaled / size);
+
+    int classCounts[MATERIAL_CLASS_COUNT] = {};
+    for (size_t i = 0; i < scene->materials.size(); i++) {
+        classCounts[materialClassOf(scene->materials[i])]++;
+    }
+    printf("%s: %dx%d, %d iterations, depth %d, %d materials (%d emissive, %d diffuse, %d reflective, "
+        "%d refractive, %d procedural)\n",
+        sceneFile, size, size, iterations, scene->state.traceDepth, (int)scene->materials.size(),
+        classCounts[MATERIAL_EMISSIVE], classCounts[MATERIAL_DIFFUSE], classCounts[MATERIAL_REFLECTIVE],
+        classCounts[MATERIAL_REFRACTIVE], classCounts[MATERIAL_PROCEDURAL]);
+    printf("Reordering traffic per shaded path: sort moves %d bytes of structs (plus the key sort), "
+        "queue writes %d bytes of index\n",
+        (int)(2 * (sizeof(PathSegment) + sizeof(ShadeableIntersection))), (int)sizeof(int));
+
+    const char* names[] = { "unsorted", "sort", "queue" };
+    ShadingRun base = {};
+    bool differs = false;
+    for (int shading = SHADING_UNSORTED; shading <= SHADING_QUEUES; shading++) {
+        run(*scene, shading, 1); // warmup
+        ShadingRun r = run(*scene, shading, iterations);
+        if (shading == SHADING_UNSORTED) {
+            base = r;
+        }
+        differs |= r.checksum != base.checksum;
+        printf("%-10s shade %9.2f ms  %7.1f ns/path  %7.2f Mpaths/s  %5.2fx   total %9.2f ms   "
+            "%lld paths, %d bounces   checksum %.6e%s\n",
+            names[shading], r.shadeSeconds * 1e3, r.shadeSeconds * 1e9 / r.pathsShaded,
+            r.pathsShaded / r.shadeSeconds * 1e-6, base.shadeSeconds / r.shadeSeconds,
+            r.totalSeconds * 1e3, r.pathsShaded, r.bounces, r.checksum,
+            r.checksum == base.checksum ? "" : " (differs from unsorted)");
+    }
+
+    delete scene;
+    return differs ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * Host microbenchmark for ray/triangle throughput on an OBJ mesh.
+ *
+ * Compares the per-triangle work of the original world-space loop (three
+ * vertex transforms per triangle per ray, one-sided glm test) with the
+ * object-space Moller-Trumbore test on Triangle and on precomputed
+ * TriangleBlocks. Every ray is tested against every triangle for its closest
+ * hit, so these numbers measure the raw test and not the BVH.
+ *
+ * Then checks objBVHIntersectionTest against the brute-force
+ * objIntersectionTest on the same rays: both must report the same t to a
+ * relative 1e-5 (the two loops may contract to FMAs differently), and the
+ * same triangle unless two triangles are hit at that t (a shared edge).
+ * Reports the BVH's speedup over brute force.
+ *
+ * Host-only. Exits with 1 if the BVH disagrees with brute force.
+ *
+ * Usage: triangle_bench [OBJFILE] [RAYS]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bvh.h"
+#include "intersections.h"
+#include "meshEncoding.h"
+#include "objLoader.h"
+
+template<typename F>
+static void report(const char* desc, int rayCount, int triCount, F&& traceAll) {
+    traceAll(); // warmup
+    auto start = std::chrono::high_resolution_clock::now();
+    int hits = traceAll();
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double tests = (double)rayCount * triCount;
+    printf("%-40s %10.2f Mtri/s   %8.2f ms   (%d hits)\n",
+        desc, tests / seconds * 1e-6, seconds * 1e3, hits);
+}
+
+int main(int argc, char** argv) {
+    const char* objFile = argc > 1 ? argv[1] : "../obj/bunny.obj";
+    int rayCount = argc > 2 ? atoi(argv[2]) : 2000;
+
+    Mesh mesh;
+    ObjLoadStats stats;
+    if (loadObjMesh(objFile, &mesh, &stats) != 0) {
+        return 1;
+    }
+    int triCount = mesh.triCount;
+
+    // Unindexed copy in the original 96-byte layout
+    std::vector<Triangle> triangles(triCount);
+    for (int i = 0; i < triCount; i++) {
+        for (int v = 0; v < 3; v++) {
+            const MeshVertex& mv = mesh.vertices[mesh.indices[i][v]];
+            triangles[i].pos[v] = mv.pos;
+            triangles[i].nor[v] = decodeOctNormal(mv.nor);
+            triangles[i].uv[v] = decodeHalfUV(mv.uv);
+        }
+    }
+
+    // A single leaf over the whole mesh packs every triangle into blocks
+    std::vector<BVHNode> leaf(1);
+    leaf[0].leftFirst = 0;
+    leaf[0].primCount = triCount;
+    std::vector<TriangleBlock> blocks;
+    buildTriangleBlocks(mesh.vertices, mesh.indices, leaf, blocks);
+    int blockCount = blocks.size();
+
+    printf("%s: %d triangles, %d rays\n", objFile, triCount, rayCount);
+    printf("    Triangle      %5.1f bytes/tri\n", (double)sizeof(Triangle));
+    printf("    indexed mesh  %5.1f bytes/tri (%d vertices welded to %d)\n",
+        (double)(mesh.vertexCount * sizeof(MeshVertex) + triCount * sizeof(glm::uvec3)) / triCount,
+        stats.objVertices, mesh.vertexCount);
+    printf("    TriangleBlock %5.1f bytes/tri (%d-wide)\n",
+        (double)(sizeof(TriangleBlock) / TRI_BLOCK_WIDTH), TRI_BLOCK_WIDTH);
+
+    // Same placement as the papa bunny in scenes/objLoading.txt
+    Geom obj;
+    obj.transform = utilityCore::buildTransformationMatrix(
+        glm::vec3(3, 0, 1), glm::vec3(0, 0, 0), glm::vec3(30, 30, 30));
+    obj.inverseTransform = glm::inverse(obj.transform);
+
+    BoundingBox box = mesh.boundingBox;
+
+    // Rays from a ring around the mesh aimed at random points in its bounds
+    std::vector<Ray> rays(rayCount);
+    srand(565);
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec3 u(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+        glm::vec3 target = glm::vec3(obj.transform * glm::vec4(glm::mix(box.min, box.max, u), 1.0f));
+        float angle = TWO_PI * i / rayCount;
+        rays[i].origin = target + glm::vec3(cos(angle), 0.3f, sin(angle)) * 20.f;
+        rays[i].direction = glm::normalize(target - rays[i].origin);
+    }
+
+    report("world space, per-ray vertex transforms", rayCount, triCount, [&]() {
+        int hits = 0;
+        glm::vec3 barycentric;
+        for (const Ray& r : rays) {
+            float tClosest = FLT_MAX;
+            for (const Triangle& tri : triangles) {
+                glm::vec3 v1 = glm::vec3(obj.transform * glm::vec4(tri.pos[0], 1.0f));
+                glm::vec3 v2 = glm::vec3(obj.transform * glm::vec4(tri.pos[1], 1.0f));
+                glm::vec3 v3 = glm::vec3(obj.transform * glm::vec4(tri.pos[2], 1.0f));
+                if (glm::intersectRayTriangle(r.origin, r.direction, v1, v2, v3, barycentric)
+                        && barycentric.z < tClosest) {
+                    tClosest = barycentric.z;
+                }
+            }
+            hits += tClosest < FLT_MAX;
+        }
+        return hits;
+    });
+
+    report("object space, Triangle", rayCount, triCount, [&]() {
+        int hits = 0;
+        for (const Ray& r : rays) {
+            Ray q;
+            q.origin = multiplyMV(obj.inverseTransform, glm::vec4(r.origin, 1.0f));
+            q.direction = multiplyMV(obj.inverseTransform, glm::vec4(r.direction, 0.0f));
+            float tClosest = FLT_MAX;
+            for (int i = 0; i < triCount; i++) {
+                float t = triangleIntersectionTest(triangles[i], q);
+                if (t > 0.f && t < tClosest) {
+                    tClosest = t;
+                }
+            }
+            hits += tClosest < FLT_MAX;
+        }
+        return hits;
+    });
+
+    report("object space, precomputed TriangleBlock", rayCount, triCount, [&]() {
+        int hits = 0;
+        for (const Ray& r : rays) {
+            Ray q;
+            q.origin = multiplyMV(obj.inverseTransform, glm::vec4(r.origin, 1.0f));
+            q.direction = multiplyMV(obj.inverseTransform, glm::vec4(r.direction, 0.0f));
+            float tClosest = FLT_MAX;
+            for (int b = 0; b < blockCount; b++) {
+                triangleBlockIntersectionTest(blocks[b], q, tClosest);
+            }
+            hits += tClosest < FLT_MAX;
+        }
+        return hits;
+    });
+
+    // The BVH reorders the index triples; brute force reads them in the
+    // new order too, so triangle indices are comparable
+    std::vector<BVHNode> nodes;
+    buildMeshBVH(mesh.vertices, mesh.indices, triCount, nodes);
+    std::vector<TriangleBlock> bvhBlocks;
+    buildTriangleBlocks(mesh.vertices, mesh.indices, nodes, bvhBlocks);
+    obj.boundingBox = mesh.boundingBox;
+
+    std::vector<float> bruteT(rayCount);
+    std::vector<int> bruteTri(rayCount);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec2 bary;
+        bruteTri[i] = -1;
+        bruteT[i] = objIntersectionTest(obj, mesh.vertices, mesh.indices, triCount, rays[i], bruteTri[i], bary);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::vector<float> bvhT(rayCount);
+    std::vector<int> bvhTri(rayCount);
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec2 bary;
+        bvhTri[i] = -1;
+        bvhT[i] = objBVHIntersectionTest(obj, bvhBlocks.data(), nodes.data(), rays[i], bvhTri[i], bary);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    // A different triangle at the same t is a hit on an edge the two share
+    auto sameT = [](float a, float b) { return fabsf(a - b) <= 1e-5f * fmaxf(1.f, fabsf(a)); };
+    int mismatches = 0;
+    int edgeHits = 0;
+    int hits = 0;
+    for (int i = 0; i < rayCount; i++) {
+        bool hit = bruteT[i] > 0.f;
+        hits += hit;
+        bool agree = hit == (bvhT[i] > 0.f) && (!hit || sameT(bruteT[i], bvhT[i]));
+        if (agree && hit && bruteTri[i] != bvhTri[i]) {
+            edgeHits++;
+        }
+        if (!agree && ++mismatches <= 5) {
+            printf("  ray %d: brute force t=%g tri %d, BVH t=%g tri %d\n", i, bruteT[i], bruteTri[i], bvhT[i], bvhTri[i]);
+        }
+    }
+    double bruteSeconds = std::chrono::duration<double>(mid - start).count();
+    double bvhSeconds = std::chrono::duration<double>(end - mid).count();
+    printf("\nBVH (%d nodes) vs brute force: %d of %d rays disagree (%d hits, %d on shared edges);"
+        " %.2f ms vs %.2f ms, %.1fx faster\n",
+        (int)nodes.size(), mismatches, rayCount, hits, edgeHits, bvhSeconds * 1e3, bruteSeconds * 1e3,
+        bvhSeconds > 0 ? bruteSeconds / bvhSeconds : 0.0);
+    printf("check: %s\n", mismatches == 0 ? "passed" : "FAILED");
+
+    return mismatches == 0 ? 0 : 1;
+}
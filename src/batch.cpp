@@ -0,0 +1,569 @@
+#include <cuda_runtime.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpuPathtrace.h"
+#include "image.h"
+#include "pathtrace.h"
+#include "renderStop.h"
+#include "scene.h"
+#include "utilities.h"
+
+// Exit codes. CUDA errors inside the renderer exit with EXIT_FAILURE (1)
+// through checkCUDAErrorFn.
+#define BATCH_OK 0
+#define BATCH_CUDA_ERROR 1
+#define BATCH_USAGE_ERROR 2
+#define BATCH_SCENE_ERROR 3
+#define BATCH_OUTPUT_ERROR 4
+
+//-------------------------------
+//-------------BATCH-------------
+//-------------------------------
+
+/**
+ * Headless renderer: loads a scene, renders samples without a window (on
+ * the GPU, or on host threads with --backend cpu) until a stopping
+ * criterion is met (ITERATIONS, TARGETERROR or TIMEBUDGET) and writes the
+ * image. Command line overrides take precedence over the scene file, and
+ * one `key=value` summary line is printed to stdout so scripts can collect
+ * results.
+ */
+
+namespace {
+	struct BatchArgs {
+		std::string sceneFile;
+		int width;
+		int height;
+		int spp;
+		int depth;
+		int roulette;      // -2 = scene's ROULETTE, -1 = off
+		float targetError; // 0 = scene's TARGETERROR
+		float timeBudget;  // 0 = scene's TIMEBUDGET
+		int checkEvery;    // 0 = scene's CHECKEVERY
+		std::string output;
+		PathTraceOptions options;
+		bool cpu;
+		int threads;       // CPU backend; 0 = every hardware thread
+		bool scaling;
+		bool tileScaling;
+		std::string stats;  // per-bounce telemetry file, GPU backend only
+	};
+
+	struct RenderResult {
+		double seconds;
+		long long rays;
+		long long samples;
+		long long steals;
+		int cachePatterns;
+		PathPoolInfo pool;  // GPU backend
+		RenderStopStatus stop;
+	};
+
+	/** One render of a --scaling or --tile-scaling series. */
+	struct BatchRun {
+		int threads;       // CPU backend
+		int pathBudgetMB;  // GPU backend; 0 = one path per pixel
+	};
+
+	void printUsage(const char* program) {
+		printf("Usage: %s SCENEFILE.txt [options]\n"
+			"  --width N, --height N   override the scene resolution\n"
+			"  --res WxH               override both at once\n"
+			"  --spp N                 samples per pixel (scene ITERATIONS)\n"
+			"  --depth N               maximum path depth (scene DEPTH)\n"
+			"  --roulette N|off        Russian roulette after N bounces (scene ROULETTE)\n"
+			"  --target-error X        stop once the relative RMS error is X (scene TARGETERROR)\n"
+			"  --time-budget S         stop after S seconds of rendering (scene TIMEBUDGET)\n"
+			"  --check-every N         test those two every N samples (scene CHECKEVERY)\n"
+			"  --output PATH           output image; .hdr writes Radiance HDR, anything else PNG\n"
+			"  --enable FEATURE        turn a feature on\n"
+			"  --disable FEATURE       turn a feature off\n"
+			"  --shading MODE          unsorted, sort (by material id) or queue (per material class)\n"
+			"  --compaction MODE       thrust (thrust::partition) or efficient (stream_compaction library)\n"
+			"  --sampler TYPE          random (hashed white noise), sobol (Owen-scrambled Sobol) or\n"
+			"                          bluenoise (sobol, camera samples spread by a blue-noise tile)\n"
+			"  --backend gpu|cpu       render with CUDA (default) or on host threads\n"
+			"  --threads N             CPU backend thread count (default: all hardware threads)\n"
+			"  --scaling               CPU backend: render with 1, 2, 4, ... up to N threads\n"
+			"  --path-budget MB        GPU backend: device memory for paths in flight; the image is\n"
+			"                          traced in tiles that fit (default: one path per pixel)\n"
+			"  --tile-order ORDER      scanline, serpentine or morton (Z-order) tile order\n"
+			"  --tile-scaling          GPU backend: render with path budgets of 1, 4, 16, ... MB up to\n"
+			"                          --path-budget or the whole image\n"
+			"  --stats PATH            GPU backend: write per-bounce statistics of the last run;\n"
+			"                          .json writes JSON, anything else CSV. Timing each stage\n"
+			"                          slows the render down.\n"
+			"  --adaptive-threshold X  relative error at which adaptive sampling stops a pixel\n"
+			"  --cache-patterns N      camera sample patterns whose first hits are cached\n"
+			"  --cache-budget MB       device memory the first-hit cache may use\n"
+			"FEATURE is one of antialiasing, cache, dof, bvh, nee (next-event estimation),\n"
+			"adaptive (GPU: stop tracing converged pixels). The CPU backend ignores cache,\n"
+			"compaction, adaptive, --path-budget and --tile-order.\n"
+			"Exit codes: 0 ok, 1 CUDA error, 2 bad arguments, 3 scene load failed, 4 image write failed.\n",
+			program);
+	}
+
+	bool parsePositive(const char* text, int& value) {
+		char* end = NULL;
+		long v = strtol(text, &end, 10);
+		if (end == text || *end != '\0' || v <= 0 || v > (1 << 30)) {
+			return false;
+		}
+		value = (int)v;
+		return true;
+	}
+
+	bool parsePositiveFloat(const char* text, float& value) {
+		char* end = NULL;
+		double v = strtod(text, &end);
+		if (end == text || *end != '\0' || !(v > 0.0)) {
+			return false;
+		}
+		value = (float)v;
+		return true;
+	}
+
+	bool setFeature(PathTraceOptions& options, const std::string& name, bool on) {
+		if (name == "antialiasing" || name == "aa") {
+			options.antialiasing = on;
+		} else if (name == "cache") {
+			options.cacheIntersections = on;
+		} else if (name == "dof") {
+			options.depthOfField = on;
+		} else if (name == "bvh") {
+			options.sceneBVH = on;
+		} else if (name == "nee") {
+			options.nextEventEstimation = on;
+		} else if (name == "adaptive") {
+			options.adaptiveSampling = on;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	const char* shadingNames[] = { "unsorted", "sort", "queue" };
+	const char* compactionNames[] = { "thrust", "efficient" };
+	const char* tileOrderNames[] = { "scanline", "serpentine", "morton" };
+	const char* samplerNames[] = { "random", "sobol", "bluenoise" };
+
+	/** Sets `value` to the index of `name` in `names`. */
+	bool parseChoice(const char* name, const char* const* names, int count, int& value) {
+		for (int i = 0; i < count; i++) {
+			if (strcmp(name, names[i]) == 0) {
+				value = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/** @return  false on malformed arguments; a message has been printed. */
+	bool parseArgs(int argc, char** argv, BatchArgs& args) {
+		args.width = 0;
+		args.height = 0;
+		args.spp = 0;
+		args.depth = 0;
+		args.roulette = -2;
+		args.targetError = 0;
+		args.timeBudget = 0;
+		args.checkEvery = 0;
+		args.options = defaultPathTraceOptions();
+		args.options.pauseOnError = false;
+		args.cpu = false;
+		args.threads = 0;
+		args.scaling = false;
+		args.tileScaling = false;
+		args.stats.clear();
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			bool ok = true;
+			if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+				if (!args.sceneFile.empty()) {
+					fprintf(stderr, "Unexpected argument %s\n", arg.c_str());
+					return false;
+				}
+				args.sceneFile = arg;
+				continue;
+			}
+			if (arg == "--scaling") {
+				args.scaling = true;
+				continue;
+			}
+			if (arg == "--tile-scaling") {
+				args.tileScaling = true;
+				continue;
+			}
+			if (!hasValue) {
+				fprintf(stderr, "Missing value for %s\n", arg.c_str());
+				return false;
+			}
+			const char* value = argv[++i];
+			if (arg == "--width") {
+				ok = parsePositive(value, args.width);
+			} else if (arg == "--height") {
+				ok = parsePositive(value, args.height);
+			} else if (arg == "--res") {
+				std::string res = value;
+				size_t x = res.find('x');
+				ok = x != std::string::npos
+					&& parsePositive(res.substr(0, x).c_str(), args.width)
+					&& parsePositive(res.substr(x + 1).c_str(), args.height);
+			} else if (arg == "--spp") {
+				ok = parsePositive(value, args.spp);
+			} else if (arg == "--depth") {
+				ok = parsePositive(value, args.depth);
+			} else if (arg == "--roulette") {
+				args.roulette = -1;
+				ok = strcmp(value, "off") == 0 || parsePositive(value, args.roulette);
+			} else if (arg == "--target-error") {
+				ok = parsePositiveFloat(value, args.targetError);
+			} else if (arg == "--time-budget") {
+				ok = parsePositiveFloat(value, args.timeBudget);
+			} else if (arg == "--check-every") {
+				ok = parsePositive(value, args.checkEvery);
+			} else if (arg == "--output") {
+				args.output = value;
+				ok = !args.output.empty();
+			} else if (arg == "--enable" || arg == "--disable") {
+				ok = setFeature(args.options, value, arg == "--enable");
+			} else if (arg == "--shading") {
+				ok = parseChoice(value, shadingNames, 3, args.options.shading);
+			} else if (arg == "--adaptive-threshold") {
+				ok = parsePositiveFloat(value, args.options.adaptiveThreshold);
+			} else if (arg == "--cache-patterns") {
+				ok = parsePositive(value, args.options.cachePatterns);
+			} else if (arg == "--cache-budget") {
+				ok = parsePositive(value, args.options.cacheBudgetMB);
+			} else if (arg == "--compaction") {
+				ok = parseChoice(value, compactionNames, 2, args.options.compaction);
+			} else if (arg == "--path-budget") {
+				ok = parsePositive(value, args.options.pathBudgetMB);
+			} else if (arg == "--tile-order") {
+				ok = parseChoice(value, tileOrderNames, 3, args.options.tileOrder);
+			} else if (arg == "--sampler") {
+				ok = parseChoice(value, samplerNames, 3, args.options.sampler);
+			} else if (arg == "--backend") {
+				args.cpu = strcmp(value, "cpu") == 0;
+				ok = args.cpu || strcmp(value, "gpu") == 0;
+			} else if (arg == "--threads") {
+				ok = parsePositive(value, args.threads);
+			} else if (arg == "--stats") {
+				args.stats = value;
+				ok = !args.stats.empty();
+			} else {
+				fprintf(stderr, "Unknown option %s\n", arg.c_str());
+				return false;
+			}
+			if (!ok) {
+				fprintf(stderr, "Bad value for %s: %s\n", arg.c_str(), value);
+				return false;
+			}
+		}
+		if (args.sceneFile.empty()) {
+			fprintf(stderr, "No scene file given\n");
+			return false;
+		}
+		if (args.scaling && !args.cpu) {
+			fprintf(stderr, "--scaling needs --backend cpu\n");
+			return false;
+		}
+		if (args.tileScaling && args.cpu) {
+			fprintf(stderr, "--tile-scaling needs --backend gpu\n");
+			return false;
+		}
+		if (!args.stats.empty() && args.cpu) {
+			fprintf(stderr, "--stats needs --backend gpu\n");
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Changes the image size the way loadCamera derives it: fovy is kept and
+	 * fovx, pixelLength follow from the new aspect ratio.
+	 */
+	void resizeCamera(RenderState& state, int width, int height) {
+		Camera& cam = state.camera;
+		cam.resolution = glm::ivec2(width, height);
+		float yscaled = tan(cam.fov.y * (PI / 180));
+		float xscaled = (yscaled * cam.resolution.x) / cam.resolution.y;
+		cam.fov.x = (atan(xscaled) * 180) / PI;
+		cam.pixelLength = glm::vec2(2 * xscaled / (float)cam.resolution.x,
+			2 * yscaled / (float)cam.resolution.y);
+		state.image.assign(width * height, glm::vec3());
+	}
+
+	/**
+	 * Rebuilds the camera frame exactly as the interactive viewer does on its
+	 * first frame (orbit angles around lookAt), so batch and interactive
+	 * renders of the same scene match.
+	 */
+	void setupOrbitCamera(Camera& cam) {
+		glm::vec3 view = cam.view;
+		glm::vec3 viewXZ = glm::vec3(view.x, 0.0f, view.z);
+		glm::vec3 viewZY = glm::vec3(0.0f, view.y, view.z);
+		float phi = glm::acos(glm::dot(glm::normalize(viewXZ), glm::vec3(0, 0, -1)));
+		float theta = glm::acos(glm::dot(glm::normalize(viewZY), glm::vec3(0, 1, 0)));
+		float zoom = glm::length(cam.position - cam.lookAt);
+
+		glm::vec3 position;
+		position.x = zoom * sin(phi) * sin(theta);
+		position.y = zoom * cos(theta);
+		position.z = zoom * cos(phi) * sin(theta);
+
+		cam.view = -glm::normalize(position);
+		glm::vec3 u = glm::vec3(0, 1, 0);
+		cam.right = glm::cross(cam.view, u);
+		cam.up = glm::cross(cam.right, cam.view);
+		cam.position = position + cam.lookAt;
+	}
+
+	std::string timeString() {
+		time_t now;
+		time(&now);
+		char buf[sizeof "0000-00-00_00-00-00z"];
+		strftime(buf, sizeof buf, "%Y-%m-%d_%H-%M-%Sz", gmtime(&now));
+		return std::string(buf);
+	}
+
+	bool endsWith(const std::string& s, const std::string& suffix) {
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	/**
+	 * Same normalization and flip as saveImage in main.cpp. `path` ends in
+	 * .png or .hdr, which picks the format.
+	 */
+	bool saveBatchImage(const RenderState& state, int samples, const std::string& path) {
+		int width = state.camera.resolution.x;
+		int height = state.camera.resolution.y;
+		image img(width, height);
+		for (int x = 0; x < width; x++) {
+			for (int y = 0; y < height; y++) {
+				int index = x + (y * width);
+				img.setPixel(width - 1 - x, y, state.image[index] / (float)samples);
+			}
+		}
+		if (endsWith(path, ".hdr")) {
+			return img.saveHDR(path.substr(0, path.size() - 4));
+		}
+		return img.savePNG(path.substr(0, path.size() - 4));
+	}
+
+	/** @param telemetry  Receives per-bounce statistics if not NULL. */
+	RenderResult renderGPU(Scene* scene, const PathTraceOptions& options, GuiDataContainer* telemetry) {
+		pathtraceSetOptions(options);
+		pathtraceInit(scene);
+		InitDataContainer(telemetry);
+		if (telemetry != NULL) {
+			telemetry->RecordTelemetry = true;
+		}
+
+		RenderResult result = {};
+		result.stop = initialStopStatus();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iter = 1;; iter++) {
+			result.rays += pathtrace(NULL, 0, iter);
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			if (checkStopCriteria(scene->state, iter, seconds, pathtraceErrorEstimate, result.stop)) {
+				break;
+			}
+		}
+		cudaDeviceSynchronize();
+		auto end = std::chrono::high_resolution_clock::now();
+		result.seconds = std::chrono::duration<double>(end - start).count();
+		result.samples = pathtraceSampleCount();
+		result.cachePatterns = pathtraceCachePatterns();
+		result.pool = pathtracePathPool();
+
+		pathtraceFree(scene);
+		return result;
+	}
+
+	RenderResult renderCPU(Scene* scene, int threads, const PathTraceOptions& options) {
+		cpuPathtraceInit(scene, threads, options);
+
+		RenderResult result = {};
+		result.stop = initialStopStatus();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iter = 1;; iter++) {
+			result.rays += cpuPathtrace(iter);
+			double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			if (checkStopCriteria(scene->state, iter, seconds, cpuPathtraceErrorEstimate, result.stop)) {
+				break;
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		result.seconds = std::chrono::duration<double>(end - start).count();
+		result.steals = cpuPathtraceStats().steals;
+		result.samples = (long long)result.stop.iterations * scene->state.image.size();
+
+		cpuPathtraceFree();
+		return result;
+	}
+}
+
+int main(int argc, char** argv) {
+	BatchArgs args;
+	if (!parseArgs(argc, argv, args)) {
+		printUsage(argv[0]);
+		return BATCH_USAGE_ERROR;
+	}
+
+	int deviceCount = 0;
+	if (!args.cpu && (cudaGetDeviceCount(&deviceCount) != cudaSuccess || deviceCount == 0)) {
+		fprintf(stderr, "No CUDA device available\n");
+		return BATCH_CUDA_ERROR;
+	}
+
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	Scene* scene = NULL;
+	try {
+		scene = new Scene(args.sceneFile);
+	} catch (const std::exception& e) {
+		fprintf(stderr, "Could not load %s: %s\n", args.sceneFile.c_str(), e.what());
+		return BATCH_SCENE_ERROR;
+	}
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+
+	RenderState& state = scene->state;
+	if (args.width > 0 || args.height > 0) {
+		resizeCamera(state,
+			args.width > 0 ? args.width : state.camera.resolution.x,
+			args.height > 0 ? args.height : state.camera.resolution.y);
+	}
+	if (args.spp > 0) {
+		state.iterations = args.spp;
+	}
+	if (args.depth > 0) {
+		state.traceDepth = args.depth;
+	}
+	if (args.roulette != -2) {
+		state.rouletteDepth = args.roulette;
+	}
+	if (args.targetError > 0) {
+		state.targetError = args.targetError;
+	}
+	if (args.timeBudget > 0) {
+		state.timeBudget = args.timeBudget;
+	}
+	if (args.checkEvery > 0) {
+		state.stopCheckInterval = args.checkEvery;
+	}
+	setupOrbitCamera(state.camera);
+
+	// Without --output the name carries the sample count and stop reason,
+	// which are only known once the last run has finished
+	std::string output = args.output;
+	if (!output.empty() && !endsWith(output, ".png") && !endsWith(output, ".hdr")) {
+		output += ".png";
+	}
+
+	double loadSeconds = std::chrono::duration<double>(loadEnd - loadStart).count();
+
+	// Runs: just the requested one, or thread counts (CPU) or path budgets
+	// (GPU) in powers up to it. Budgets stop short of what the whole image
+	// needs, beyond which the pool is no longer the limit.
+	std::vector<BatchRun> runs;
+	if (args.cpu) {
+		int maxThreads = args.threads > 0 ? args.threads : std::max(1u, std::thread::hardware_concurrency());
+		for (int n = 1; args.scaling && n < maxThreads; n *= 2) {
+			runs.push_back({ n, 0 });
+		}
+		runs.push_back({ maxThreads, 0 });
+	} else {
+		double imageMB = (double)pathtraceBytesPerPath(args.options, !scene->lights.empty())
+			* state.camera.resolution.x * state.camera.resolution.y / (1024.0 * 1024.0);
+		int maxBudget = args.options.pathBudgetMB;
+		for (int mb = 1; args.tileScaling && mb < imageMB && (maxBudget == 0 || mb < maxBudget); mb *= 4) {
+			runs.push_back({ 0, mb });
+		}
+		runs.push_back({ 0, maxBudget });
+	}
+
+	GuiDataContainer telemetry;
+	bool saved = false;
+	double baseSeconds = 0;
+	for (size_t run = 0; run < runs.size(); run++) {
+		std::fill(state.image.begin(), state.image.end(), glm::vec3());
+		telemetry.Telemetry.clear();  // like the image, only the last run's is written
+		PathTraceOptions options = args.options;
+		options.pathBudgetMB = runs[run].pathBudgetMB;
+		RenderResult result = args.cpu
+			? renderCPU(scene, runs[run].threads, options)
+			: renderGPU(scene, options, args.stats.empty() ? NULL : &telemetry);
+		if (run == 0) {
+			baseSeconds = result.seconds;
+		}
+
+		// Only the last (widest) run is written out
+		bool last = run + 1 == runs.size();
+		if (last) {
+			if (args.output.empty()) {
+				std::ostringstream ss;
+				ss << state.imageName << "." << timeString() << "." << result.stop.iterations << "samp."
+					<< stopReasonName(result.stop.reason) << ".png";
+				output = ss.str();
+			}
+			saved = saveBatchImage(state, result.stop.iterations, output);
+			if (!args.stats.empty()) {
+				bool statsSaved = endsWith(args.stats, ".json")
+					? saveTelemetryJSON(args.stats, telemetry.Telemetry)
+					: saveTelemetryCSV(args.stats, telemetry.Telemetry);
+				if (!statsSaved) {
+					fprintf(stderr, "Could not write %s\n", args.stats.c_str());
+				}
+				saved = saved && statsSaved;
+			}
+		}
+
+		printf("RESULT scene=%s backend=%s threads=%d width=%d height=%d spp=%d depth=%d roulette=%d"
+			" aa=%d cache=%d dof=%d shading=%s compaction=%s sampler=%s bvh=%d nee=%d adaptive=%g"
+			" load_s=%.6f time_s=%.6f samples=%lld rays=%lld rays_per_s=%.0f %s",
+			args.sceneFile.c_str(), args.cpu ? "cpu" : "gpu", runs[run].threads,
+			state.camera.resolution.x, state.camera.resolution.y,
+			result.stop.iterations, state.traceDepth, state.rouletteDepth,
+			args.options.antialiasing, result.cachePatterns, args.options.depthOfField,
+			shadingNames[args.options.shading], compactionNames[args.options.compaction],
+			samplerNames[args.options.sampler], args.options.sceneBVH,
+			args.options.nextEventEstimation,
+			!args.cpu && args.options.adaptiveSampling ? args.options.adaptiveThreshold : 0.0,
+			loadSeconds, result.seconds, result.samples,
+			result.rays, result.seconds > 0 ? result.rays / result.seconds : 0.0,
+			stopSummary(result.stop).c_str());
+		if (args.cpu) {
+			double speedup = result.seconds > 0 ? baseSeconds / result.seconds : 0.0;
+			printf(" steals=%lld speedup=%.3f efficiency=%.3f",
+				result.steals, speedup, speedup * runs[0].threads / runs[run].threads);
+		} else {
+			const PathPoolInfo& pool = result.pool;
+			printf(" pool_paths=%d tile=%dx%d tiles=%d tile_order=%s path_mb=%.1f peak_mb=%.1f",
+				pool.capacity, pool.tileSize.x, pool.tileSize.y, pool.tiles, tileOrderNames[args.options.tileOrder],
+				pool.poolBytes / (1024.0 * 1024.0), pool.peakDeviceBytes / (1024.0 * 1024.0));
+		}
+		printf(" output=%s status=%s\n", last ? output.c_str() : "-",
+			!last ? "ok" : saved ? "ok" : "write_failed");
+		fflush(stdout);
+	}
+
+	if (!args.cpu) {
+		cudaDeviceReset();
+	}
+	delete scene;
+	return saved ? BATCH_OK : BATCH_OUTPUT_ERROR;
+}
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "blueNoise.h"
+
+#define BLUE_NOISE_SIGMA 1.5f           // of the Gaussian that measures clustering, in texels
+#define BLUE_NOISE_INITIAL_DENSITY 10   // one texel in this many starts in the prototype pattern
+
+namespace {
+    /**
+     * Sum over a set of texels of a Gaussian of the wrapped distance to
+     * each, kept up to date as texels enter and leave the set.
+     */
+    struct EnergyField {
+        int size;
+        std::vector<float> kernel;  // weight at wrapped offset (dx, dy), row major
+        std::vector<float> energy;
+
+        explicit EnergyField(int size) : size(size), kernel(size * size), energy(size * size, 0.0f) {
+            for (int dy = 0; dy < size; dy++) {
+                for (int dx = 0; dx < size; dx++) {
+                    float x = (float)std::min(dx, size - dx);
+                    float y = (float)std::min(dy, size - dy);
+                    kernel[dy * size + dx] = std::exp(-(x * x + y * y) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+                }
+            }
+        }
+
+        void add(int texel, float sign) {
+            int px = texel % size;
+            int py = texel / size;
+            for (int y = 0; y < size; y++) {
+                const float* row = kernel.data() + ((y - py + size) % size) * size;
+                float* out = energy.data() + y * size;
+                for (int x = 0; x < size; x++) {
+                    out[x] += sign * row[(x - px + size) % size];
+                }
+            }
+        }
+    };
+
+    /** The texel in the set with the highest energy. */
+    int tightestCluster(const EnergyField& field, const std::vector<char>& set) {
+        int best = -1;
+        for (int i = 0; i < (int)set.size(); i++) {
+            if (set[i] && (best < 0 || field.energy[i] > field.energy[best])) {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    /** The texel outside the set with the lowest energy. */
+    int largestVoid(const EnergyField& field, const std::vector<char>& set) {
+        int best = -1;
+        for (int i = 0; i < (int)set.size(); i++) {
+            if (!set[i] && (best < 0 || field.energy[i] < field.energy[best])) {
+                best = i;
+            }
+        }
+        return best;
+    }
+}
+
+std::vector<float> generateBlueNoise(int size, unsigned int seed) {
+    const int n = size * size;
+    std::mt19937 rng(seed);
+
+    // Prototype pattern: random texels, then move the tightest cluster to
+    // the largest void until that stops changing anything
+    std::vector<char> prototype(n, 0);
+    EnergyField prototypeField(size);
+    int ones = std::max(1, n / BLUE_NOISE_INITIAL_DENSITY);
+    for (int placed = 0; placed < ones;) {
+        int texel = rng() % n;
+        if (!prototype[texel]) {
+            prototype[texel] = 1;
+            prototypeField.add(texel, 1.0f);
+            placed++;
+        }
+    }
+    for (;;) {
+        int cluster = tightestCluster(prototypeField, prototype);
+        prototype[cluster] = 0;
+        prototypeField.add(cluster, -1.0f);
+        int hole = largestVoid(prototypeField, prototype);
+        prototype[hole] = 1;
+        prototypeField.add(hole, 1.0f);
+        if (hole == cluster) {
+            break;
+        }
+    }
+
+    std::vector<int> rank(n);
+
+    // Ranks below the prototype's: take out the tightest cluster each time
+    std::vector<char> pattern = prototype;
+    EnergyField field = prototypeField;
+    for (int r = ones - 1; r >= 0; r--) {
+        int cluster = tightestCluster(field, pattern);
+        pattern[cluster] = 0;
+        field.add(cluster, -1.0f);
+        rank[cluster] = r;
+    }
+
+    // Ranks above: fill the largest void each time. Past half full this is
+    // also the tightest cluster of the empty texels, since their energy is
+    // the kernel's total minus the filled texels' energy.
+    pattern = prototype;
+    field = prototypeField;
+    for (int r = ones; r < n; r++) {
+        int hole = largestVoid(field, pattern);
+        pattern[hole] = 1;
+        field.add(hole, 1.0f);
+        rank[hole] = r;
+    }
+
+    std::vector<float> texture(n);
+    for (int i = 0; i < n; i++) {
+        texture[i] = (rank[i] + 0.5f) / n;
+    }
+    return texture;
+}
+
+const std::vector<float>& blueNoiseTexture() {
+    static const std::vector<float> texture = generateBlueNoise(BLUE_NOISE_SIZE, 0x5eed);
+    return texture;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include "sampler.h"
+
+/**
+ * Tileable blue-noise texture of size x size values in [0, 1), row major,
+ * made with Ulichney's void-and-cluster method on a torus. Every value
+ * (rank + 0.5) / (size * size) appears once, and any two texels with close
+ * values are far apart, including across the tile's edges.
+ *
+ * Deterministic for a given size and seed.
+ */
+std::vector<float> generateBlueNoise(int size, unsigned int seed);
+
+/**
+ * The BLUE_NOISE_SIZE texture the renderers share for SAMPLER_BLUE_NOISE,
+ * generated on first use.
+ */
+const std::vector<float>& blueNoiseTexture();
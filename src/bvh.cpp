@@ -0,0 +1,311 @@
+#include <cfloat>
+#include <utility>
+
+#include "bvh.h"
+
+namespace {
+    struct SAHBin {
+        BoundingBox bounds;
+        int count;
+    };
+
+    BoundingBox emptyBox() {
+        BoundingBox box;
+        box.min = glm::vec3(FLT_MAX);
+        box.max = glm::vec3(-FLT_MAX);
+        return box;
+    }
+
+    void growBox(BoundingBox& box, const glm::vec3& p) {
+        box.min = glm::min(box.min, p);
+        box.max = glm::max(box.max, p);
+    }
+
+    void growBox(BoundingBox& box, const BoundingBox& other) {
+        box.min = glm::min(box.min, other.min);
+        box.max = glm::max(box.max, other.max);
+    }
+
+    float surfaceArea(const BoundingBox& box) {
+        glm::vec3 e = box.max - box.min;
+        if (e.x < 0.f || e.y < 0.f || e.z < 0.f) {
+            return 0.f;
+        }
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    /**
+     * Primitives being built over. Bounds and centroids are indexed by
+     * primitive id; `indices` is the working order that gets partitioned.
+     */
+    struct BuildInput {
+        const std::vector<BoundingBox>& bounds;
+        std::vector<glm::vec3> centroids;
+        std::vector<int>& indices;
+
+        BuildInput(const std::vector<BoundingBox>& b, std::vector<int>& idx)
+            : bounds(b), centroids(b.size()), indices(idx) {
+            for (int i = 0; i < (int)b.size(); i++) {
+                centroids[i] = (b[i].min + b[i].max) * 0.5f;
+            }
+        }
+    };
+
+    void updateNodeBounds(BVHNode& node, const BuildInput& in) {
+        node.bounds = emptyBox();
+        for (int i = node.leftFirst; i < node.leftFirst + node.primCount; i++) {
+            growBox(node.bounds, in.bounds[in.indices[i]]);
+        }
+    }
+
+    /**
+     * Finds the cheapest binned SAH split of a node.
+     * @return  SAH cost of the split, FLT_MAX if no split is possible.
+     */
+    float findBestSplit(const BVHNode& node, const BuildInput& in, int& bestAxis, float& bestPos) {
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++) {
+            float cmin = FLT_MAX;
+            float cmax = -FLT_MAX;
+            for (int i = node.leftFirst; i < node.leftFirst + node.primCount; i++) {
+                float c = in.centroids[in.indices[i]][axis];
+                cmin = glm::min(cmin, c);
+                cmax = glm::max(cmax, c);
+            }
+            if (cmin == cmax) {
+                continue;
+            }
+
+            SAHBin bins[BVH_SAH_BINS];
+            for (int b = 0; b < BVH_SAH_BINS; b++) {
+                bins[b].bounds = emptyBox();
+                bins[b].count = 0;
+            }
+            float scale = BVH_SAH_BINS / (cmax - cmin);
+            for (int i = node.leftFirst; i < node.leftFirst + node.primCount; i++) {
+                int prim = in.indices[i];
+                int b = glm::min(BVH_SAH_BINS - 1, (int)((in.centroids[prim][axis] - cmin) * scale));
+                bins[b].count++;
+                growBox(bins[b].bounds, in.bounds[prim]);
+            }
+
+            // Sweep from both ends to get the area and count on either side
+            // of each of the BVH_SAH_BINS - 1 candidate planes
+            float leftArea[BVH_SAH_BINS - 1], rightArea[BVH_SAH_BINS - 1];
+            int leftCount[BVH_SAH_BINS - 1], rightCount[BVH_SAH_BINS - 1];
+            BoundingBox leftBox = emptyBox();
+            BoundingBox rightBox = emptyBox();
+            int leftSum = 0;
+            int rightSum = 0;
+            for (int b = 0; b < BVH_SAH_BINS - 1; b++) {
+                leftSum += bins[b].count;
+                growBox(leftBox, bins[b].bounds);
+                leftCount[b] = leftSum;
+                leftArea[b] = surfaceArea(leftBox);
+
+                rightSum += bins[BVH_SAH_BINS - 1 - b].count;
+                growBox(rightBox, bins[BVH_SAH_BINS - 1 - b].bounds);
+                rightCount[BVH_SAH_BINS - 2 - b] = rightSum;
+                rightArea[BVH_SAH_BINS - 2 - b] = surfaceArea(rightBox);
+            }
+
+            for (int b = 0; b < BVH_SAH_BINS - 1; b++) {
+                if (leftCount[b] == 0 || rightCount[b] == 0) {
+                    continue;
+                }
+                float cost = leftCount[b] * leftArea[b] + rightCount[b] * rightArea[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPos = cmin + (b + 1) / scale;
+                }
+            }
+        }
+        return bestCost;
+    }
+
+    int subdivide(std::vector<BVHNode>& nodes, int nodeIdx, BuildInput& in, int depth) {
+        BVHNode& node = nodes[nodeIdx];
+        if (node.primCount <= 1 || depth >= BVH_STACK_SIZE - 1) {
+            return depth;
+        }
+
+        int axis = 0;
+        float splitPos = 0.f;
+        float splitCost = findBestSplit(node, in, axis, splitPos);
+        if (splitCost >= FLT_MAX) {
+            return depth;
+        }
+
+        // Costs are relative to one primitive test, scaled by node area
+        float nodeArea = surfaceArea(node.bounds);
+        float leafCost = node.primCount * nodeArea;
+        splitCost += BVH_TRAVERSAL_COST * nodeArea;
+        if (splitCost >= leafCost && node.primCount <= BVH_MAX_LEAF_PRIMS) {
+            return depth;
+        }
+
+        // Partition primitives about the split plane
+        int i = node.leftFirst;
+        int j = node.leftFirst + node.primCount - 1;
+        while (i <= j) {
+            if (in.centroids[in.indices[i]][axis] < splitPos) {
+                i++;
+            }
+            else {
+                std::swap(in.indices[i], in.indices[j]);
+                j--;
+            }
+        }
+
+        int leftCount = i - node.leftFirst;
+        if (leftCount == 0 || leftCount == node.primCount) {
+            return depth;
+        }
+
+        int leftIdx = nodes.size();
+        BVHNode left;
+        left.leftFirst = node.leftFirst;
+        left.primCount = leftCount;
+        BVHNode right;
+        right.leftFirst = i;
+        right.primCount = node.primCount - leftCount;
+
+        // nodes has been reserved for the worst case, so `node` stays valid
+        node.leftFirst = leftIdx;
+        node.primCount = 0;
+        nodes.push_back(left);
+        nodes.push_back(right);
+        updateNodeBounds(nodes[leftIdx], in);
+        updateNodeBounds(nodes[leftIdx + 1], in);
+
+        int leftDepth = subdivide(nodes, leftIdx, in, depth + 1);
+        int rightDepth = subdivide(nodes, leftIdx + 1, in, depth + 1);
+        return glm::max(leftDepth, rightDepth);
+    }
+
+    BoundingBox transformBox(const glm::mat4& m, const BoundingBox& box) {
+        BoundingBox out = emptyBox();
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 corner((c & 1) ? box.max.x : box.min.x,
+                             (c & 2) ? box.max.y : box.min.y,
+                             (c & 4) ? box.max.z : box.min.z);
+            growBox(out, glm::vec3(m * glm::vec4(corner, 1.0f)));
+        }
+        return out;
+    }
+
+    /**
+     * Object-space bounds of the implicit SDFs in intersections.h, padded
+     * past the ray-marching hit threshold.
+     */
+    BoundingBox implicitBounds(ImplicitObj obj) {
+        BoundingBox box;
+        switch (obj) {
+        case IMP_SPHERE:    box.min = glm::vec3(-1.0f, -1.0f, -1.0f);  box.max = glm::vec3(1.0f, 1.0f, 1.0f);  break;
+        case IMP_BOOKCOVER: box.min = glm::vec3(-1.0f, -0.45f, -1.3f); box.max = glm::vec3(1.0f, 0.45f, 1.3f); break;
+        case IMP_BOOKPAGES: box.min = glm::vec3(-0.9f, -0.28f, -1.2f); box.max = glm::vec3(0.9f, 0.28f, 1.2f); break;
+        case IMP_MUG:       box.min = glm::vec3(-1.2f, -1.2f, -1.2f);  box.max = glm::vec3(2.3f, 1.2f, 1.2f);  break;
+        case IMP_COFFEE:    box.min = glm::vec3(-1.0f, 0.69f, -1.0f);  box.max = glm::vec3(1.0f, 0.71f, 1.0f); break;
+        case IMP_LIGHT:     box.min = glm::vec3(-1.2f, -0.3f, -1.2f);  box.max = glm::vec3(2.7f, 4.3f, 1.2f);  break;
+        }
+        box.min -= glm::vec3(0.1f);
+        box.max += glm::vec3(0.1f);
+        return box;
+    }
+}
+
+int buildBVH(const std::vector<BoundingBox>& primBounds, std::vector<int>& primIndices,
+        std::vector<BVHNode>& nodes) {
+    nodes.clear();
+    primIndices.resize(primBounds.size());
+    for (int i = 0; i < (int)primBounds.size(); i++) {
+        primIndices[i] = i;
+    }
+    if (primBounds.empty()) {
+        return 0;
+    }
+    nodes.reserve(2 * primBounds.size() - 1);
+
+    BuildInput in(primBounds, primIndices);
+    BVHNode root;
+    root.leftFirst = 0;
+    root.primCount = primBounds.size();
+    nodes.push_back(root);
+    updateNodeBounds(nodes[0], in);
+
+    return subdivide(nodes, 0, in, 1);
+}
+
+int buildMeshBVH(const MeshVertex* vertices, glm::uvec3* indices, int triCount, std::vector<BVHNode>& nodes) {
+    std::vector<BoundingBox> triBounds(triCount);
+    for (int i = 0; i < triCount; i++) {
+        triBounds[i] = emptyBox();
+        growBox(triBounds[i], vertices[indices[i].x].pos);
+        growBox(triBounds[i], vertices[indices[i].y].pos);
+        growBox(triBounds[i], vertices[indices[i].z].pos);
+    }
+
+    std::vector<int> order;
+    int depth = buildBVH(triBounds, order, nodes);
+
+    // Reorder triangles so every leaf covers a contiguous range
+    std::vector<glm::uvec3> sorted(triCount);
+    for (int i = 0; i < triCount; i++) {
+        sorted[i] = indices[order[i]];
+    }
+    std::copy(sorted.begin(), sorted.end(), indices);
+    return depth;
+}
+
+void buildTriangleBlocks(const MeshVertex* vertices, const glm::uvec3* indices,
+        std::vector<BVHNode>& nodes, std::vector<TriangleBlock>& blocks) {
+    blocks.clear();
+    for (int n = 0; n < (int)nodes.size(); n++) {
+        BVHNode& node = nodes[n];
+        if (node.primCount == 0) {
+            continue;
+        }
+        int firstBlock = blocks.size();
+        for (int i = 0; i < node.primCount; i++) {
+            if (i % TRI_BLOCK_WIDTH == 0) {
+                TriangleBlock block = TriangleBlock();
+                for (int lane = 0; lane < TRI_BLOCK_WIDTH; lane++) {
+                    block.triIndex[lane] = -1;
+                }
+                blocks.push_back(block);
+            }
+            const glm::uvec3& tri = indices[node.leftFirst + i];
+            TriangleBlock& block = blocks.back();
+            int lane = i % TRI_BLOCK_WIDTH;
+            glm::vec3 v0 = vertices[tri.x].pos;
+            glm::vec3 e1 = vertices[tri.y].pos - v0;
+            glm::vec3 e2 = vertices[tri.z].pos - v0;
+            for (int c = 0; c < 3; c++) {
+                block.v0[c][lane] = v0[c];
+                block.e1[c][lane] = e1[c];
+                block.e2[c][lane] = e2[c];
+            }
+            block.triIndex[lane] = node.leftFirst + i;
+        }
+        node.leftFirst = firstBlock;
+    }
+}
+
+BoundingBox geomWorldBounds(const Geom& geom) {
+    BoundingBox local;
+    switch (geom.type) {
+    case CUBE:
+    case SPHERE:
+        local.min = glm::vec3(-0.5f);
+        local.max = glm::vec3(0.5f);
+        break;
+    case OBJ:
+        local = geom.boundingBox;
+        break;
+    case IMPLICIT:
+        local = implicitBounds(geom.implicitobj);
+        break;
+    }
+    return transformBox(geom.transform, local);
+}
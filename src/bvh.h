@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include "sceneStructs.h"
+
+#define BVH_SAH_BINS 12
+#define BVH_MAX_LEAF_PRIMS 4
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_STACK_SIZE 64
+
+/**
+ * Builds a BVH over arbitrary primitives from their bounds using a binned
+ * surface area heuristic. On return, `primIndices` holds primitive ids in
+ * leaf order, so a leaf covers primIndices[leftFirst, leftFirst + primCount).
+ *
+ * @return  Depth of the deepest leaf (root = 1).
+ */
+int buildBVH(const std::vector<BoundingBox>& primBounds, std::vector<int>& primIndices,
+    std::vector<BVHNode>& nodes);
+
+/**
+ * Builds a BVH over an indexed triangle mesh using a binned surface area
+ * heuristic. Index triples are reordered in place so that every leaf
+ * references a contiguous range of the array. Nodes are appended to `nodes`,
+ * root first.
+ *
+ * @return  Depth of the deepest leaf (root = 1).
+ */
+int buildMeshBVH(const MeshVertex* vertices, glm::uvec3* indices, int triCount, std::vector<BVHNode>& nodes);
+
+/**
+ * Packs the triangles of every leaf of a mesh BVH into TriangleBlocks of
+ * precomputed vertex/edge data, starting a new block at each leaf. Leaf
+ * nodes are rewritten so leftFirst is the first block of the leaf;
+ * primCount stays the triangle count.
+ */
+void buildTriangleBlocks(const MeshVertex* vertices, const glm::uvec3* indices,
+    std::vector<BVHNode>& nodes, std::vector<TriangleBlock>& blocks);
+
+/**
+ * World-space bounds of a geom: its unit shape, mesh bounds or implicit
+ * surface bounds pushed through geom.transform.
+ */
+BoundingBox geomWorldBounds(const Geom& geom);
@@ -0,0 +1,309 @@
+// Host-only: built by nvcc so the shared __host__ __device__ stages see the
+// same math overloads as in pathtrace.cu, but nothing here touches the GPU.
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blueNoise.h"
+#include "cpuPathtrace.h"
+#include "pathtraceCore.h"
+#include "threadPool.h"
+
+namespace {
+    /**
+     * Everything one worker owns. Each worker is its own allocation with a
+     * cache line of padding at either end, so workers never share a line
+     * through the deque lock or the counters. (C++11 new ignores alignas
+     * above the default alignment, so the padding does the job instead.)
+     */
+    struct CpuWorker {
+        char leadingPad[64];
+        std::mutex mutex;
+        std::deque<int> tiles;
+        std::vector<PathSegment> paths;
+        std::vector<ShadeableIntersection> intersections;
+        std::vector<ShadowRay> shadowRays;
+        std::vector<glm::vec3> tileImage;
+        CpuShadingScratch scratch;
+        long long rays;
+        long long steals;
+        char trailingPad[64];
+    };
+
+    struct PathAlive {
+        bool operator()(const PathSegment& path) const {
+            return path.remainingBounces > 0;
+        }
+    };
+
+    Scene* hst_scene = NULL;
+    PathTraceOptions options;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<std::unique_ptr<CpuWorker> > workers;
+    std::vector<PixelStats> pixelStats;     // written only by the worker that owns the pixel's tile
+    const float* blueNoise = NULL;          // SAMPLER_BLUE_NOISE only
+    int tilesX = 0;
+    int tilesY = 0;
+    long long totalSteals = 0;
+
+    /** Pops from the front of the worker's own deque, else steals from the back of another's. */
+    bool nextTile(int w, int& tile) {
+        {
+            CpuWorker& self = *workers[w];
+            std::lock_guard<std::mutex> lock(self.mutex);
+            if (!self.tiles.empty()) {
+                tile = self.tiles.front();
+                self.tiles.pop_front();
+                return true;
+            }
+        }
+        for (int i = 1; i < workers.size(); i++) {
+            CpuWorker& victim = *workers[(w + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tiles.empty()) {
+                tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                workers[w]->steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Traces every path of one tile to termination and adds the tile to the image. */
+    void renderTile(CpuWorker& worker, int tile, int iter) {
+        const Camera& cam = hst_scene->state.camera;
+        const int traceDepth = hst_scene->state.traceDepth;
+        const int roulette = rouletteBounces(traceDepth, hst_scene->state.rouletteDepth);
+        const int x0 = (tile % tilesX) * CPU_TILE_SIZE;
+        const int y0 = (tile / tilesX) * CPU_TILE_SIZE;
+        const int w = std::min(CPU_TILE_SIZE, cam.resolution.x - x0);
+        const int h = std::min(CPU_TILE_SIZE, cam.resolution.y - y0);
+        const int num_paths = w * h;
+
+        PathSegment* paths = worker.paths.data();
+        ShadeableIntersection* intersections = worker.intersections.data();
+        Geom* geoms = hst_scene->geoms.data();
+        const int geoms_size = hst_scene->geoms.size();
+        const Mesh* meshes = hst_scene->meshes.data();
+        BVHNode* sceneBVH = hst_scene->sceneBVH.data();
+        int* sceneGeomIndices = hst_scene->sceneGeomIndices.data();
+        const Material* materials = hst_scene->materials.data();
+        LightList lights;
+        lights.lights = hst_scene->lights.data();
+        lights.lightCount = options.nextEventEstimation ? hst_scene->lights.size() : 0;
+        lights.geoms = geoms;
+        ShadowRay* shadowRays = lights.lightCount > 0 ? worker.shadowRays.data() : NULL;
+
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                generatePathSegment(cam, iter, x0 + x, y0 + y, traceDepth,
+                    options.antialiasing, options.depthOfField, 0, options.sampler, blueNoise, paths[y * w + x]);
+            }
+        }
+
+        int active = num_paths;
+        while (active > 0) {
+            for (int i = 0; i < active; i++) {
+                intersectPathSegment(paths[i], geoms, geoms_size, meshes,
+                    sceneBVH, sceneGeomIndices, options.sceneBVH, intersections[i]);
+            }
+            worker.rays += active;
+            cpuShadePaths(options.shading, iter, options.sampler, roulette, paths, intersections, active, materials,
+                geoms, meshes, lights, shadowRays, worker.scratch);
+            for (int i = 0; shadowRays && i < active; i++) {
+                traceShadowRay(shadowRays[i], paths[i], geoms, geoms_size, meshes,
+                    sceneBVH, sceneGeomIndices, options.sceneBVH);
+            }
+            active = std::partition(paths, paths + active, PathAlive()) - paths;
+        }
+
+        // Gather in the worker's own buffer, then add whole rows to the image
+        for (int i = 0; i < num_paths; i++) {
+            int x = paths[i].pixelIndex % cam.resolution.x - x0;
+            int y = paths[i].pixelIndex / cam.resolution.x - y0;
+            worker.tileImage[y * w + x] = paths[i].color + paths[i].radiance;
+        }
+        glm::vec3* image = hst_scene->state.image.data();
+        for (int y = 0; y < h; y++) {
+            glm::vec3* row = image + (y0 + y) * cam.resolution.x + x0;
+            const glm::vec3* src = worker.tileImage.data() + y * w;
+            PixelStats* stats = pixelStats.data() + (y0 + y) * cam.resolution.x + x0;
+            for (int x = 0; x < w; x++) {
+                row[x] += src[x];
+                addPixelSample(stats[x], src[x]);
+            }
+        }
+    }
+}
+
+namespace {
+    struct CompareMaterialId {
+        const ShadeableIntersection* intersections;
+        bool operator()(int a, int b) const {
+            return intersections[a].materialId < intersections[b].materialId;
+        }
+    };
+
+    template <int MATERIAL_CLASS>
+    void shadeQueue(int iter, int samplerType, int rouletteBounces, const int* queue, int count, PathSegment* paths,
+        ShadeableIntersection* intersections, const Material* materials,
+        const Geom* geoms, const Mesh* meshes, const LightList& lights, ShadowRay* shadowRays) {
+        for (int i = 0; i < count; i++) {
+            int idx = queue[i];
+            shadePathSegmentAs<MATERIAL_CLASS>(iter, samplerType, rouletteBounces,
+                intersections[idx], paths[idx], materials, geoms, meshes, lights, shadowRays ? shadowRays + idx : NULL);
+        }
+    }
+}
+
+void cpuShadePaths(int shading, int iter, int samplerType, int rouletteBounces, PathSegment* paths, ShadeableIntersection* intersections,
+    int count, const Material* materials, const Geom* geoms, const Mesh* meshes, const LightList& lights, ShadowRay* shadowRays,
+    CpuShadingScratch& scratch) {
+    if (scratch.queue.size() < count) {
+        scratch.queue.resize(count);
+    }
+    int* queue = scratch.queue.data();
+
+    if (shading == SHADING_QUEUES) {
+        // Counting sort: histogram, exclusive scan, then scatter in path order
+        int offsets[MATERIAL_CLASS_COUNT + 1] = {};
+        for (int i = 0; i < count; i++) {
+            offsets[shadingBin(intersections[i], materials) + 1]++;
+        }
+        for (int c = 0; c < MATERIAL_CLASS_COUNT; c++) {
+            offsets[c + 1] += offsets[c];
+        }
+        int cursors[MATERIAL_CLASS_COUNT];
+        std::copy(offsets, offsets + MATERIAL_CLASS_COUNT, cursors);
+        for (int i = 0; i < count; i++) {
+            queue[cursors[shadingBin(intersections[i], materials)]++] = i;
+        }
+
+#define SHADE_QUEUE(c) \
+        shadeQueue<c>(iter, samplerType, rouletteBounces, queue + offsets[c], offsets[c + 1] - offsets[c], paths, intersections, materials, geoms, meshes, lights, shadowRays);
+        SHADE_QUEUE(MATERIAL_MISS)
+        SHADE_QUEUE(MATERIAL_EMISSIVE)
+        SHADE_QUEUE(MATERIAL_DIFFUSE)
+        SHADE_QUEUE(MATERIAL_REFLECTIVE)
+        SHADE_QUEUE(MATERIAL_REFRACTIVE)
+        SHADE_QUEUE(MATERIAL_PROCEDURAL)
+#undef SHADE_QUEUE
+        return;
+    }
+
+    if (shading == SHADING_SORTED) {
+        // Move the structs themselves, like thrust::sort_by_key does on the GPU
+        if (scratch.paths.size() < count) {
+            scratch.paths.resize(count);
+            scratch.intersections.resize(count);
+        }
+        for (int i = 0; i < count; i++) {
+            queue[i] = i;
+        }
+        CompareMaterialId compare = { intersections };
+        std::sort(queue, queue + count, compare);
+        for (int i = 0; i < count; i++) {
+            scratch.paths[i] = paths[queue[i]];
+            scratch.intersections[i] = intersections[queue[i]];
+        }
+        std::copy(scratch.paths.begin(), scratch.paths.begin() + count, paths);
+        std::copy(scratch.intersections.begin(), scratch.intersections.begin() + count, intersections);
+    }
+
+    for (int i = 0; i < count; i++) {
+        shadePathSegment(iter, samplerType, rouletteBounces,
+            intersections[i], paths[i], materials, geoms, meshes, lights, shadowRays ? shadowRays + i : NULL);
+    }
+}
+
+void cpuPathtraceInit(Scene* scene, int threadCount, const PathTraceOptions& newOptions) {
+    cpuPathtraceFree();
+    hst_scene = scene;
+    options = newOptions;
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const Camera& cam = scene->state.camera;
+    tilesX = (cam.resolution.x + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    tilesY = (cam.resolution.y + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    totalSteals = 0;
+    pixelStats.assign(cam.resolution.x * cam.resolution.y, PixelStats());
+    if (options.sampler == SAMPLER_BLUE_NOISE) {
+        blueNoise = blueNoiseTexture().data();
+    }
+
+    // The calling thread is one of the workers
+    pool.reset(new ThreadPool(threadCount - 1));
+    for (int i = 0; i < threadCount; i++) {
+        std::unique_ptr<CpuWorker> worker(new CpuWorker());
+        worker->paths.resize(CPU_TILE_SIZE * CPU_TILE_SIZE);
+        worker->intersections.resize(CPU_TILE_SIZE * CPU_TILE_SIZE);
+        worker->shadowRays.resize(CPU_TILE_SIZE * CPU_TILE_SIZE);
+        worker->tileImage.resize(CPU_TILE_SIZE * CPU_TILE_SIZE);
+        worker->rays = 0;
+        worker->steals = 0;
+        workers.push_back(std::move(worker));
+    }
+}
+
+void cpuPathtraceFree() {
+    pool.reset();
+    workers.clear();
+    pixelStats.clear();
+    blueNoise = NULL;
+    hst_scene = NULL;
+}
+
+int cpuPathtrace(int iter) {
+    const int tileCount = tilesX * tilesY;
+    const int threadCount = workers.size();
+
+    // Contiguous runs of tiles per worker, so neighbouring tiles (and their
+    // geometry) tend to stay on one thread unless stolen
+    for (int w = 0; w < threadCount; w++) {
+        CpuWorker& worker = *workers[w];
+        worker.tiles.clear();
+        for (int t = (long long)tileCount * w / threadCount; t < (long long)tileCount * (w + 1) / threadCount; t++) {
+            worker.tiles.push_back(t);
+        }
+        worker.rays = 0;
+        worker.steals = 0;
+    }
+
+    pool->parallelFor(threadCount, [&](int w) {
+        int tile;
+        while (nextTile(w, tile)) {
+            renderTile(*workers[w], tile, iter);
+        }
+    });
+
+    long long rays = 0;
+    for (int w = 0; w < threadCount; w++) {
+        rays += workers[w]->rays;
+        totalSteals += workers[w]->steals;
+    }
+    return (int)rays;
+}
+
+CpuRenderStats cpuPathtraceStats() {
+    CpuRenderStats stats;
+    stats.threads = workers.size();
+    stats.tiles = tilesX * tilesY;
+    stats.steals = totalSteals;
+    return stats;
+}
+
+float cpuPathtraceErrorEstimate() {
+    double sum = 0.0;
+    for (const PixelStats& stats : pixelStats) {
+        sum += squaredPixelError(stats);
+    }
+    return (float)sqrt(sum / pixelStats.size());
+}
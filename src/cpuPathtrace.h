@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "scene.h"
+#include "pathtrace.h"
+
+#define CPU_TILE_SIZE 16
+
+struct LightList;
+
+struct CpuRenderStats {
+    int threads;
+    int tiles;          // per iteration
+    long long steals;   // tiles run by a thread other than their owner, summed over iterations
+};
+
+/** Scratch buffers for cpuShadePaths, grown on demand. */
+struct CpuShadingScratch {
+    std::vector<int> queue;
+    std::vector<PathSegment> paths;
+    std::vector<ShadeableIntersection> intersections;
+};
+
+/**
+ * Host version of the shading stage for `count` paths, ordered by `shading`
+ * (a ShadingMode) as on the GPU:
+ *  - unsorted: shade in place;
+ *  - sorted: reorder paths and intersections by material id, then shade;
+ *  - queues: counting sort of path indices by material class, then shade
+ *    each class's queue with the routine specialized for it.
+ * Samples are keyed by pixel and bounce, so all three give the same result.
+ * `samplerType`, `rouletteBounces`, `geoms`, `meshes`, `lights` and
+ * `shadowRays` (one per path, or NULL) are as for shadePathSegment; the
+ * caller traces the shadow rays afterwards.
+ */
+void cpuShadePaths(int shading, int iter, int samplerType, int rouletteBounces, PathSegment* paths, ShadeableIntersection* intersections,
+    int count, const Material* materials, const Geom* geoms, const Mesh* meshes, const LightList& lights, ShadowRay* shadowRays,
+    CpuShadingScratch& scratch);
+
+/**
+ * Host backend for the same per-path stages as pathtrace(). Image tiles are
+ * dealt out to per-thread deques; a thread renders its own tiles front to
+ * back and steals from the back of another thread's deque once it runs out.
+ * Each thread traces a tile as a small wavefront in its own buffers and only
+ * touches the shared image when it adds the finished tile, one row at a time.
+ *
+ * The random engine is seeded per pixel and bounce, so images match the GPU
+ * backend in expectation, not bit for bit.
+ *
+ * @param threadCount  Worker threads including the caller; 0 uses every
+ *                     hardware thread.
+ */
+void cpuPathtraceInit(Scene* scene, int threadCount, const PathTraceOptions& options);
+void cpuPathtraceFree();
+
+/**
+ * Traces one sample per pixel and accumulates it into scene->state.image.
+ *
+ * @return  Number of rays traced (path segments summed over all bounces).
+ */
+int cpuPathtrace(int iteration);
+
+CpuRenderStats cpuPathtraceStats();
+
+/** Host counterpart of pathtraceErrorEstimate. */
+float cpuPathtraceErrorEstimate();
@@ -19,7 +19,7 @@ void image::setPixel(int x, int y, const glm::vec3 &pixel) {
     pixels[(y * xSize) + x] = pixel;
 }
 
-void image::savePNG(const std::string &baseFilename) {
+bool image::savePNG(const std::string &baseFilename) {
     unsigned char *bytes = new unsigned char[3 * xSize * ySize];
     for (int y = 0; y < ySize; y++) {
         for (int x = 0; x < xSize; x++) { 
@@ -32,14 +32,24 @@ void image::savePNG(const std::string &baseFilename) {
     }
 
     std::string filename = baseFilename + ".png";
-    stbi_write_png(filename.c_str(), xSize, ySize, 3, bytes, xSize * 3);
-    std::cout << "Saved " << filename << "." << std::endl;
+    bool ok = stbi_write_png(filename.c_str(), xSize, ySize, 3, bytes, xSize * 3) != 0;
+    if (ok) {
+        std::cout << "Saved " << filename << "." << std::endl;
+    } else {
+        std::cerr << "Could not write " << filename << "." << std::endl;
+    }
 
     delete[] bytes;
+    return ok;
 }
 
-void image::saveHDR(const std::string &baseFilename) {
+bool image::saveHDR(const std::string &baseFilename) {
     std::string filename = baseFilename + ".hdr";
-    stbi_write_hdr(filename.c_str(), xSize, ySize, 3, (const float *) pixels);
-    std::cout << "Saved " + filename + "." << std::endl;
+    bool ok = stbi_write_hdr(filename.c_str(), xSize, ySize, 3, (const float *) pixels) != 0;
+    if (ok) {
+        std::cout << "Saved " + filename + "." << std::endl;
+    } else {
+        std::cerr << "Could not write " + filename + "." << std::endl;
+    }
+    return ok;
 }
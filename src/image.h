@@ -14,6 +14,6 @@ public:
     image(int x, int y);
     ~image();
     void setPixel(int x, int y, const glm::vec3 &pixel);
-    void savePNG(const std::string &baseFilename);
-    void saveHDR(const std::string &baseFilename);
+    bool savePNG(const std::string &baseFilename);
+    bool saveHDR(const std::string &baseFilename);
 };
@@ -2,20 +2,19 @@
 
 #include "intersections.h"
 #include "noise.h"
+#include "sampler.h"
 
 // CHECKITOUT
 /**
- * Computes a cosine-weighted random direction in a hemisphere.
- * Used for diffuse lighting.
+ * Computes a cosine-weighted random direction in a hemisphere from `u` in
+ * [0, 1)^2. Used for diffuse lighting.
  */
-__host__ __device__
+__host__ __device__ inline
 glm::vec3 calculateRandomDirectionInHemisphere(
-        glm::vec3 normal, thrust::default_random_engine &rng) {
-    thrust::uniform_real_distribution<float> u01(0, 1);
-
-    float up = sqrt(u01(rng)); // cos(theta)
+        glm::vec3 normal, glm::vec2 u) {
+    float up = sqrt(u.x); // cos(theta)
     float over = sqrt(1 - up * up); // sin(theta)
-    float around = u01(rng) * TWO_PI;
+    float around = u.y * TWO_PI;
 
     // Find a direction that is not the normal based off of whether or not the
     // normal's components are all equal to sqrt(1/3) or whether or not at
@@ -42,7 +41,7 @@ glm::vec3 calculateRandomDirectionInHemisphere(
         + sin(around) * over * perpendicularDirection2;
 }
 
-__host__ __device__
+__host__ __device__ inline
 bool Refract(const glm::vec3 &wi, const glm::vec3& n, float eta,
     glm::vec3 &wt) {
     // Compute cos theta using Snell's law
@@ -56,13 +55,42 @@ bool Refract(const glm::vec3 &wi, const glm::vec3& n, float eta,
     return true;
 }
 
-__device__ float schlickApproximation(double cosine, double ref_idx) {
+__host__ __device__ inline float schlickApproximation(double cosine, double ref_idx) {
     // Use Schlick's approximation for reflectance.
     auto r0 = (1 - ref_idx) / (1 + ref_idx);
     r0 = r0 * r0;
     return r0 + (1 - r0) * pow((1 - cosine), 5);
 }
 
+/**
+ * Shading classes used to group paths before shading. Each class is a
+ * subset of materials for which some of the branches of scatterRay are
+ * known not to be taken. Misses and lights get classes of their own.
+ */
+enum MaterialClass {
+    MATERIAL_MISS,
+    MATERIAL_EMISSIVE,
+    MATERIAL_DIFFUSE,       // no reflection, refraction or procedural texture
+    MATERIAL_REFLECTIVE,    // reflection mixed with diffuse, no refraction
+    MATERIAL_REFRACTIVE,    // any reflection/refraction mix, no procedural texture
+    MATERIAL_PROCEDURAL,    // anything with a procedural texture
+    MATERIAL_CLASS_COUNT,
+    MATERIAL_GENERIC = MATERIAL_CLASS_COUNT
+};
+
+__host__ __device__ inline int materialClassOf(const Material& m) {
+    if (m.emittance > 0.0f) {
+        return MATERIAL_EMISSIVE;
+    }
+    if (m.proceduralTex != 0) {
+        return MATERIAL_PROCEDURAL;
+    }
+    if (m.hasRefractive > 0.0f) {
+        return MATERIAL_REFRACTIVE;
+    }
+    return m.hasReflective > 0.0f ? MATERIAL_REFLECTIVE : MATERIAL_DIFFUSE;
+}
+
 /**
  * Scatter a ray with some probabilities according to the material properties.
  * For example, a diffuse surface scatters in a cosine-weighted hemisphere.
@@ -88,13 +116,14 @@ __device__ float schlickApproximation(double cosine, double ref_idx) {
  *
  * You may need to change the parameter list for your purposes!
  */
-__device__
-void scatterRay(    // similar to sample_f, calculate the new wi and f
+template <int MATERIAL_CLASS>
+__host__ __device__ inline
+void scatterRayAs(    // similar to sample_f, calculate the new wi and f
     PathSegment& pathSegment,
     glm::vec3 intersect,
     glm::vec3 normal,
     const Material& m,
-    thrust::default_random_engine& rng) {
+    Sampler& sampler) {
     // TODO: implement this.
     // A basic implementation of pure-diffuse shading will just call the
     // calculateRandomDirectionInHemisphere defined above.
@@ -107,20 +136,26 @@ void scatterRay(    // similar to sample_f, calculate the new wi and f
     glm::vec3 color;
     float airIOR = 1.0f;
     float eta = m.indexOfRefraction / airIOR;
-    thrust::uniform_real_distribution<float> u01(0, 1);
-    float random = u01(rng);
+    float random = sample1D(sampler);
 
-    if (m.proceduralTex == 1) {
+    // The class only removes branches its materials cannot take, so every
+    // class draws the same sample dimensions and gives the same result as
+    // MATERIAL_GENERIC (bar a draw of exactly 0 picking a 0% reflection)
+    const bool procedural = MATERIAL_CLASS == MATERIAL_PROCEDURAL || MATERIAL_CLASS == MATERIAL_GENERIC;
+    const bool reflective = MATERIAL_CLASS != MATERIAL_DIFFUSE;
+    const bool refractive = MATERIAL_CLASS != MATERIAL_DIFFUSE && MATERIAL_CLASS != MATERIAL_REFLECTIVE;
+
+    if (procedural && m.proceduralTex == 1) {
         color = getProceduralColor1(pathSegment, intersect, normal, m.color);
     }
-    else if (m.proceduralTex == 2) {
+    else if (procedural && m.proceduralTex == 2) {
         color = getProceduralColor2(pathSegment, intersect, normal, m.color);
     }
     else {
         color = glm::vec3(1.f, 1.f, 1.f);
     }
 
-    if (random <= m.hasReflective) {
+    if (reflective && random <= m.hasReflective) {
         wi_scatteredRayDir = glm::reflect(glm::normalize(wo), normal);
         if (m.specular.exponent > 0 && random > 0.7)
         {
@@ -131,7 +166,7 @@ void scatterRay(    // similar to sample_f, calculate the new wi and f
             color *= m.specular.color * m.color;
         }
     }
-    else if (random <= m.hasReflective + m.hasRefractive) {
+    else if (refractive && random <= m.hasReflective + m.hasRefractive) {
 
         float cosTheta = glm::dot(-glm::normalize(wo), glm::normalize(normal));
         if (cosTheta > 1.0f)
@@ -145,7 +180,7 @@ void scatterRay(    // similar to sample_f, calculate the new wi and f
         float sinThetaI = sqrt(1 - pow(cosTheta, 2));
         float sinThetaT = eta * sinThetaI;
 
-        if (sinThetaT > 1.0f || schlickApproximation(cosTheta, eta) > u01(rng)) {
+        if (sinThetaT > 1.0f || schlickApproximation(cosTheta, eta) > sample1D(sampler)) {
             wi_scatteredRayDir = glm::normalize(glm::reflect(glm::normalize(wo), glm::normalize(normal)));
             color *= m.color;
         }
@@ -158,7 +193,7 @@ void scatterRay(    // similar to sample_f, calculate the new wi and f
         }
     }
     else {
-        wi_scatteredRayDir = calculateRandomDirectionInHemisphere(normal, rng);  // for pure diffused material
+        wi_scatteredRayDir = calculateRandomDirectionInHemisphere(normal, sample2D(sampler));  // for pure diffused material
         color *= m.color;
     }
 
@@ -166,4 +201,14 @@ void scatterRay(    // similar to sample_f, calculate the new wi and f
     pathSegment.ray.origin = intersect + 0.001f * glm::normalize(wi_scatteredRayDir);
     pathSegment.color *= color;
     pathSegment.remainingBounces--;
-}
\ No newline at end of file
+}
+
+__host__ __device__ inline
+void scatterRay(
+    PathSegment& pathSegment,
+    glm::vec3 intersect,
+    glm::vec3 normal,
+    const Material& m,
+    Sampler& sampler) {
+    scatterRayAs<MATERIAL_GENERIC>(pathSegment, intersect, normal, m, sampler);
+}
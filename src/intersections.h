@@ -1,12 +1,16 @@
 #pragma once
 
+#include <cfloat>
 #include <glm/glm.hpp>
 #include <glm/gtx/intersect.hpp>
 
 #include "sceneStructs.h"
 #include "utilities.h"
+#include "bvh.h"
+#include "meshEncoding.h"
 
 #define BOUNDINGBOX 1
+#define MESH_BVH 1
 
 /**
  * Handy-dandy hash function that provides seeds for random number generation.
@@ -26,14 +30,14 @@ __host__ __device__ inline unsigned int utilhash(unsigned int a) {
  * Compute a point at parameter value `t` on ray `r`.
  * Falls slightly short so that it doesn't intersect the object it's hitting.
  */
-__host__ __device__ glm::vec3 getPointOnRay(Ray r, float t) {
+__host__ __device__ inline glm::vec3 getPointOnRay(Ray r, float t) {
     return r.origin + (t - .0001f) * glm::normalize(r.direction);
 }
 
 /**
  * Multiplies a mat4 and a vec4 and returns a vec3 clipped from the vec4.
  */
-__host__ __device__ glm::vec3 multiplyMV(glm::mat4 m, glm::vec4 v) {
+__host__ __device__ inline glm::vec3 multiplyMV(glm::mat4 m, glm::vec4 v) {
     return glm::vec3(m * v);
 }
 
@@ -41,22 +45,21 @@ __host__ __device__ glm::vec3 multiplyMV(glm::mat4 m, glm::vec4 v) {
 /**
  * Test intersection between a ray and a transformed cube. Untransformed,
  * the cube ranges from -0.5 to 0.5 in each axis and is centered at the origin.
+ * The ray is moved into object space without normalizing its direction, so
+ * object-space `t` equals world-space `t`.
  *
- * @param intersectionPoint  Output parameter for point of intersection.
- * @param normal             Output parameter for surface normal.
- * @param outside            Output param for whether the ray came from outside.
- * @return                   Ray parameter `t` value. -1 if no intersection.
+ * @param axis  Output parameter for the axis (0-2) of the face hit.
+ * @return      Ray parameter `t` value. -1 if no intersection.
  */
-__host__ __device__ float boxIntersectionTest(Geom box, Ray r,
-        glm::vec3 &intersectionPoint, glm::vec3 &normal, bool &outside) {
+__host__ __device__ inline float boxIntersectionTest(Geom box, Ray r, int &axis) {
     Ray q;
-    q.origin    =                multiplyMV(box.inverseTransform, glm::vec4(r.origin   , 1.0f));
-    q.direction = glm::normalize(multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    q.origin    = multiplyMV(box.inverseTransform, glm::vec4(r.origin   , 1.0f));
+    q.direction = multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f));
 
     float tmin = -1e38f;
     float tmax = 1e38f;
-    glm::vec3 tmin_n;
-    glm::vec3 tmax_n;
+    int tmin_axis = 0;
+    int tmax_axis = 0;
     for (int xyz = 0; xyz < 3; ++xyz) {
         float qdxyz = q.direction[xyz];
         /*if (glm::abs(qdxyz) > 0.00001f)*/ {
@@ -64,29 +67,24 @@ __host__ __device__ float boxIntersectionTest(Geom box, Ray r,
             float t2 = (+0.5f - q.origin[xyz]) / qdxyz;
             float ta = glm::min(t1, t2);
             float tb = glm::max(t1, t2);
-            glm::vec3 n;
-            n[xyz] = t2 < t1 ? +1 : -1;
             if (ta > 0 && ta > tmin) {
                 tmin = ta;
-                tmin_n = n;
+                tmin_axis = xyz;
             }
             if (tb < tmax) {
                 tmax = tb;
-                tmax_n = n;
+                tmax_axis = xyz;
             }
         }
     }
 
     if (tmax >= tmin && tmax > 0) {
-        outside = true;
         if (tmin <= 0) {
             tmin = tmax;
-            tmin_n = tmax_n;
-            outside = false;
+            tmin_axis = tmax_axis;
         }
-        intersectionPoint = multiplyMV(box.transform, glm::vec4(getPointOnRay(q, tmin), 1.0f));
-        normal = glm::normalize(multiplyMV(box.invTranspose, glm::vec4(tmin_n, 0.0f)));
-        return glm::length(r.origin - intersectionPoint);
+        axis = tmin_axis;
+        return tmin;
     }
     return -1;
 }
@@ -94,55 +92,35 @@ __host__ __device__ float boxIntersectionTest(Geom box, Ray r,
 // CHECKITOUT
 /**
  * Test intersection between a ray and a transformed sphere. Untransformed,
- * the sphere always has radius 0.5 and is centered at the origin.
+ * the sphere always has radius 0.5 and is centered at the origin. As for
+ * the cube, the object-space direction is left unnormalized.
  *
- * @param intersectionPoint  Output parameter for point of intersection.
- * @param normal             Output parameter for surface normal.
- * @param outside            Output param for whether the ray came from outside.
- * @return                   Ray parameter `t` value. -1 if no intersection.
+ * @return  Ray parameter `t` value. -1 if no intersection.
  */
-__host__ __device__ float sphereIntersectionTest(Geom sphere, Ray r,
-        glm::vec3 &intersectionPoint, glm::vec3 &normal, bool &outside) {
+__host__ __device__ inline float sphereIntersectionTest(Geom sphere, Ray r) {
     float radius = .5;
 
     glm::vec3 ro = multiplyMV(sphere.inverseTransform, glm::vec4(r.origin, 1.0f));
-    glm::vec3 rd = glm::normalize(multiplyMV(sphere.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    glm::vec3 rd = multiplyMV(sphere.inverseTransform, glm::vec4(r.direction, 0.0f));
 
-    Ray rt;
-    rt.origin = ro;
-    rt.direction = rd;
-
-    float vDotDirection = glm::dot(rt.origin, rt.direction);
-    float radicand = vDotDirection * vDotDirection - (glm::dot(rt.origin, rt.origin) - powf(radius, 2));
+    float a = glm::dot(rd, rd);
+    float vDotDirection = glm::dot(ro, rd);
+    float radicand = vDotDirection * vDotDirection - a * (glm::dot(ro, ro) - radius * radius);
     if (radicand < 0) {
         return -1;
     }
 
     float squareRoot = sqrt(radicand);
     float firstTerm = -vDotDirection;
-    float t1 = firstTerm + squareRoot;
-    float t2 = firstTerm - squareRoot;
+    float t1 = (firstTerm + squareRoot) / a;
+    float t2 = (firstTerm - squareRoot) / a;
 
-    float t = 0;
     if (t1 < 0 && t2 < 0) {
         return -1;
     } else if (t1 > 0 && t2 > 0) {
-        t = min(t1, t2);
-        outside = true;
-    } else {
-        t = max(t1, t2);
-        outside = false;
+        return min(t1, t2);
     }
-
-    glm::vec3 objspaceIntersection = getPointOnRay(rt, t);
-
-    intersectionPoint = multiplyMV(sphere.transform, glm::vec4(objspaceIntersection, 1.f));
-    normal = glm::normalize(multiplyMV(sphere.invTranspose, glm::vec4(objspaceIntersection, 0.f)));
-    if (!outside) {
-        normal = -normal;
-    }
-
-    return glm::length(r.origin - intersectionPoint);
+    return max(t1, t2);
 }
 
 /*
@@ -151,128 +129,272 @@ __host__ __device__ float sphereIntersectionTest(Geom sphere, Ray r,
  ******************************************************
  */
 
-__host__ __device__ float boundingBoxIntersectionTest(Geom box, Ray r,
-    glm::vec3& intersectionPoint, glm::vec3& normal, bool& outside) {
+/**
+ * Slab test of a ray against an OBJ geom's object-space bounding box.
+ *
+ * @return  Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float boundingBoxIntersectionTest(Geom box, Ray r) {
     Ray q;
     q.origin = multiplyMV(box.inverseTransform, glm::vec4(r.origin, 1.0f));
-    q.direction = glm::normalize(multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f)));
+    q.direction = multiplyMV(box.inverseTransform, glm::vec4(r.direction, 0.0f));
 
     float tmin = -1e38f;
     float tmax = 1e38f;
-    glm::vec3 tmin_n;
-    glm::vec3 tmax_n;
     for (int xyz = 0; xyz < 3; ++xyz) {
         float qdxyz = q.direction[xyz];
-        /*if (glm::abs(qdxyz) > 0.00001f)*/ {
-            float t1 = (box.boundingBox.min[xyz] - q.origin[xyz]) / qdxyz;
-            float t2 = (box.boundingBox.max[xyz] - q.origin[xyz]) / qdxyz;
-            float ta = glm::min(t1, t2);
-            float tb = glm::max(t1, t2);
-            glm::vec3 n;
-            n[xyz] = t2 < t1 ? +1 : -1;
-            if (ta > 0 && ta > tmin) {
-                tmin = ta;
-                tmin_n = n;
-            }
-            if (tb < tmax) {
-                tmax = tb;
-                tmax_n = n;
-            }
-        }
+        float t1 = (box.boundingBox.min[xyz] - q.origin[xyz]) / qdxyz;
+        float t2 = (box.boundingBox.max[xyz] - q.origin[xyz]) / qdxyz;
+        tmin = glm::max(tmin, glm::min(t1, t2));
+        tmax = glm::min(tmax, glm::max(t1, t2));
     }
 
     if (tmax >= tmin && tmax > 0) {
-        outside = true;
-        if (tmin <= 0) {
-            tmin = tmax;
-            tmin_n = tmax_n;
-            outside = false;
-        }
-        intersectionPoint = multiplyMV(box.transform, glm::vec4(getPointOnRay(q, tmin), 1.0f));
-        normal = glm::normalize(multiplyMV(box.invTranspose, glm::vec4(tmin_n, 0.0f)));
-        return glm::length(r.origin - intersectionPoint);
+        return tmin > 0 ? tmin : tmax;
     }
     return -1.f;
 }
 
-__host__ __device__ float objIntersectionTest(Geom obj, Triangle *dev_tri, Ray r,
-    glm::vec3& intersectionPoint, glm::vec3& normal, bool& outside) {
-    
-    bool isectFound = false;
+/*
+ ******************************************************
+ * BVH TRAVERSAL FOR OBJ
+ ******************************************************
+ */
 
-#if BOUNDINGBOX
-    if (boundingBoxIntersectionTest(obj, r, intersectionPoint, normal, outside) == -1.f) {
-        return -1;
-    }
-#endif
+/**
+ * Slab test between a ray and a BVH node's bounds.
+ *
+ * @param invDir  Component-wise reciprocal of the ray direction.
+ * @param tMax    Closest hit found so far; boxes beyond it are culled.
+ * @return        Entry distance, or FLT_MAX if the box is missed.
+ */
+__host__ __device__ inline float bvhNodeIntersectionTest(const BoundingBox& bounds,
+    const glm::vec3& origin, const glm::vec3& invDir, float tMax) {
+    glm::vec3 t1 = (bounds.min - origin) * invDir;
+    glm::vec3 t2 = (bounds.max - origin) * invDir;
+    glm::vec3 tLo = glm::min(t1, t2);
+    glm::vec3 tHi = glm::max(t1, t2);
+    float tEnter = glm::max(glm::max(tLo.x, tLo.y), glm::max(tLo.z, 0.f));
+    float tExit = glm::min(glm::min(tHi.x, tHi.y), glm::min(tHi.z, tMax));
+    return tEnter <= tExit ? tEnter : FLT_MAX;
+}
+
+/**
+ * Moller-Trumbore ray/triangle test against a triangle given as a vertex
+ * and the two edges leaving it.
+ *
+ * @return  Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float mollerTrumboreTest(const glm::vec3& v0, const glm::vec3& e1,
+    const glm::vec3& e2, const Ray& r) {
+    glm::vec3 p = glm::cross(r.direction, e2);
+    float det = glm::dot(e1, p);
+    glm::vec3 s = r.origin - v0;
+    glm::vec3 q = glm::cross(s, e1);
+
+    // Do the barycentric and distance tests scaled by |det| and combine them
+    // without short-circuiting, so the only branch is the final accept and
+    // the only division is for an accepted hit
+    float sign = det < 0.f ? -1.f : 1.f;
+    float u = glm::dot(s, p) * sign;
+    float v = glm::dot(r.direction, q) * sign;
+    float t = glm::dot(e2, q) * sign;
+    det *= sign;
+    bool hit = (det > 1e-12f) & (u >= 0.f) & (v >= 0.f) & (u + v <= det) & (t > EPSILON * det);
+    return hit ? t / det : -1;
+}
 
-    int triCount = obj.triCount;
-    glm::vec3 minVal = glm::vec3(INT_MAX, INT_MAX, INT_MAX);
-    glm::vec3 barycentric;
-    glm::vec3 n1, n2, n3;
+/**
+ * Ray/triangle test in the triangle's own space, deriving the edges on the fly.
+ *
+ * @return  Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float triangleIntersectionTest(const Triangle& tri, const Ray& r) {
+    return mollerTrumboreTest(tri.pos[0], tri.pos[1] - tri.pos[0], tri.pos[2] - tri.pos[0], r);
+}
 
-    Triangle* dev_triItr = dev_tri;
+/**
+ * Tests a ray against every lane of a TriangleBlock. The lanes are computed
+ * side by side with no early exits so the loop vectorizes on the host and
+ * unrolls on the device.
+ *
+ * @param tClosest  Closest hit so far; lowered if a lane hits nearer.
+ * @return          Lane of the nearer hit, -1 if no lane beat tClosest.
+ */
+__host__ __device__ inline int triangleBlockIntersectionTest(const TriangleBlock& b, const Ray& r, float& tClosest) {
+    float tLane[TRI_BLOCK_WIDTH];
+    for (int lane = 0; lane < TRI_BLOCK_WIDTH; lane++) {
+        float e1x = b.e1[0][lane], e1y = b.e1[1][lane], e1z = b.e1[2][lane];
+        float e2x = b.e2[0][lane], e2y = b.e2[1][lane], e2z = b.e2[2][lane];
+        float sx = r.origin.x - b.v0[0][lane];
+        float sy = r.origin.y - b.v0[1][lane];
+        float sz = r.origin.z - b.v0[2][lane];
+
+        float px = r.direction.y * e2z - r.direction.z * e2y;
+        float py = r.direction.z * e2x - r.direction.x * e2z;
+        float pz = r.direction.x * e2y - r.direction.y * e2x;
+        float qx = sy * e1z - sz * e1y;
+        float qy = sz * e1x - sx * e1z;
+        float qz = sx * e1y - sy * e1x;
+
+        float det = e1x * px + e1y * py + e1z * pz;
+        float sign = det < 0.f ? -1.f : 1.f;
+        det *= sign;
+        float u = (sx * px + sy * py + sz * pz) * sign;
+        float v = (r.direction.x * qx + r.direction.y * qy + r.direction.z * qz) * sign;
+        float t = (e2x * qx + e2y * qy + e2z * qz) * sign;
+        bool hit = (det > 1e-12f) & (u >= 0.f) & (v >= 0.f) & (u + v <= det) & (t > EPSILON * det);
+        tLane[lane] = hit ? t / det : FLT_MAX;
+    }
 
-    for (int i = 0; i < triCount; i++, dev_triItr++) {
+    int hitLane = -1;
+    for (int lane = 0; lane < TRI_BLOCK_WIDTH; lane++) {
+        if (tLane[lane] < tClosest) {
+            tClosest = tLane[lane];
+            hitLane = lane;
+        }
+    }
+    return hitLane;
+}
 
-        //printf("\n****GPU****\n");
-        ////printf("\n %f, %f, %f", dev_triItr->pos[0].x, dev_triItr->pos[0].y, dev_triItr->pos[0].z);
-        //printf("\n %f, %f, %f", dev_triItr->nor[0].x, dev_triItr->nor[0].y, dev_triItr->nor[0].z);
+/**
+ * Barycentrics of vertices 1 and 2 where `r` crosses the plane of a
+ * triangle given as for mollerTrumboreTest. Run once for the closest hit.
+ */
+__host__ __device__ inline glm::vec2 mollerTrumboreBarycentrics(const glm::vec3& v0, const glm::vec3& e1,
+    const glm::vec3& e2, const Ray& r) {
+    glm::vec3 p = glm::cross(r.direction, e2);
+    glm::vec3 s = r.origin - v0;
+    glm::vec3 q = glm::cross(s, e1);
+    float invDet = 1.f / glm::dot(e1, p);
+    return glm::vec2(glm::dot(s, p), glm::dot(r.direction, q)) * invDet;
+}
 
-        glm::vec3 v1_pos = glm::vec3(obj.transform * glm::vec4(dev_triItr->pos[0].x, dev_triItr->pos[0].y, dev_triItr->pos[0].z, 1.0));
-        glm::vec3 v2_pos = glm::vec3(obj.transform * glm::vec4(dev_triItr->pos[1].x, dev_triItr->pos[1].y, dev_triItr->pos[1].z, 1.0));
-        glm::vec3 v3_pos = glm::vec3(obj.transform * glm::vec4(dev_triItr->pos[2].x, dev_triItr->pos[2].y, dev_triItr->pos[2].z, 1.0));
+/** mollerTrumboreBarycentrics for one lane of a TriangleBlock. */
+__host__ __device__ inline glm::vec2 triangleBlockBarycentrics(const TriangleBlock& b, int lane, const Ray& r) {
+    glm::vec3 v0(b.v0[0][lane], b.v0[1][lane], b.v0[2][lane]);
+    glm::vec3 e1(b.e1[0][lane], b.e1[1][lane], b.e1[2][lane]);
+    glm::vec3 e2(b.e2[0][lane], b.e2[1][lane], b.e2[2][lane]);
+    return mollerTrumboreBarycentrics(v0, e1, e2, r);
+}
 
-        isectFound = glm::intersectRayTriangle(r.origin, r.direction,
-            v1_pos, v2_pos, v3_pos, barycentric);
+/**
+ * Closest hit against every triangle of a mesh, with the same object-space,
+ * two-sided test as the BVH path, so the two give the same hits. Kept as
+ * the brute-force reference for MESH_BVH 0 and the host checks.
+ *
+ * @param triIndex  Output parameter for the index of the triangle hit.
+ * @param bary      Output parameter for the barycentrics of its vertices 1 and 2.
+ * @return          Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float objIntersectionTest(Geom obj, MeshVertex *dev_vertices, glm::uvec3 *dev_indices, int triCount, Ray r,
+    int& triIndex, glm::vec2& bary) {
 
-        if (isectFound) {
+#if BOUNDINGBOX
+    if (boundingBoxIntersectionTest(obj, r) == -1.f) {
+        return -1;
+    }
+#endif
 
-            /*printf("\n****GPU****\n");
-            printf("\n %f, %f, %f", dev_triItr->nor[0].x, dev_triItr->nor[0].y, dev_triItr->nor[0].z);*/
+    // Unnormalized object-space direction, so object-space t is world-space t
+    Ray q;
+    q.origin = multiplyMV(obj.inverseTransform, glm::vec4(r.origin, 1.0f));
+    q.direction = multiplyMV(obj.inverseTransform, glm::vec4(r.direction, 0.0f));
+
+    float tClosest = FLT_MAX;
+    int hitTri = -1;
+    for (int i = 0; i < triCount; i++) {
+        glm::vec3 v0 = dev_vertices[dev_indices[i].x].pos;
+        float t = mollerTrumboreTest(v0, dev_vertices[dev_indices[i].y].pos - v0,
+            dev_vertices[dev_indices[i].z].pos - v0, q);
+        if (t > 0.f && t < tClosest) {
+            tClosest = t;
+            hitTri = i;
+        }
+    }
+    if (hitTri == -1) {
+        return -1;
+    }
 
-            if (barycentric[2] >= 0 && barycentric[2] < minVal[2])
-            {
-                minVal = barycentric;
-            }
+    glm::vec3 v0 = dev_vertices[dev_indices[hitTri].x].pos;
+    triIndex = hitTri;
+    bary = mollerTrumboreBarycentrics(v0, dev_vertices[dev_indices[hitTri].y].pos - v0,
+        dev_vertices[dev_indices[hitTri].z].pos - v0, q);
+    return tClosest;
+}
 
-            glm::vec3 v1 = dev_triItr->pos[0];
-            glm::vec3 v2 = dev_triItr->pos[1];
-            glm::vec3 v3 = dev_triItr->pos[2];
+/**
+ * Closest-hit traversal of a mesh BVH built by buildMeshBVH, with leaves
+ * pointing into TriangleBlocks from buildTriangleBlocks.
+ * The ray is moved into object space once; its direction is left
+ * unnormalized so object-space `t` equals world-space `t`, and the closest
+ * hit so far is used to cull nodes behind it.
+ *
+ * @param triIndex  Output parameter for the index of the triangle hit.
+ * @param bary      Output parameter for the barycentrics of its vertices 1 and 2.
+ * @return          Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float objBVHIntersectionTest(Geom obj, TriangleBlock* triBlocks, BVHNode* nodes, Ray r,
+    int& triIndex, glm::vec2& bary) {
+    if (nodes == NULL) {
+        return -1;
+    }
 
-            n1 = glm::normalize(glm::cross(v2 - v1, v3 - v1));
-            n2 = glm::normalize(glm::cross(v1 - v3, v2 - v3));
-            n3 = glm::normalize(glm::cross(v3 - v2, v1 - v2));
+    Ray q;
+    q.origin = multiplyMV(obj.inverseTransform, glm::vec4(r.origin, 1.0f));
+    q.direction = multiplyMV(obj.inverseTransform, glm::vec4(r.direction, 0.0f));
+    glm::vec3 invDir = 1.f / q.direction;
 
-            //printf("NOR1: %f, %f, %f\n", n1.x, n1.y, n1.z);
-            //printf("NOR2: %f, %f, %f\n", n2.x, n2.y, n2.z);
-            //printf("NOR3: %f, %f, %f\n", n3.x, n3.y, n3.z);
+    float tClosest = FLT_MAX;
+    int hitBlock = -1;
+    int hitLane = -1;
 
-            break;
-        }
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    if (bvhNodeIntersectionTest(nodes[0].bounds, q.origin, invDir, tClosest) == FLT_MAX) {
+        return -1;
     }
+    stack[stackPtr++] = 0;
+
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+
+        if (node.primCount > 0) {
+            int blockEnd = node.leftFirst + (node.primCount + TRI_BLOCK_WIDTH - 1) / TRI_BLOCK_WIDTH;
+            for (int b = node.leftFirst; b < blockEnd; b++) {
+                int lane = triangleBlockIntersectionTest(triBlocks[b], q, tClosest);
+                if (lane >= 0) {
+                    hitBlock = b;
+                    hitLane = lane;
+                }
+            }
+            continue;
+        }
 
-    if (isectFound)
-    {
-        float u = minVal[0];
-        float v = minVal[1];
-        float t = minVal[2];
-        intersectionPoint = getPointOnRay(r, t);
-        normal = glm::normalize(glm::vec3(u * n1 + v * n2 + (1 - u - v) * n3));
-        /*intersectionPoint = isectPoint;
-        normal = isectNor;*/
-        //printf("INOR: %f, %f, %f\n", normal.x, normal.y, normal.z);
-        return glm::length(r.origin - intersectionPoint);
+        // Visit the nearer child first so tClosest shrinks as early as possible
+        int near = node.leftFirst;
+        int far = node.leftFirst + 1;
+        float tNear = bvhNodeIntersectionTest(nodes[near].bounds, q.origin, invDir, tClosest);
+        float tFar = bvhNodeIntersectionTest(nodes[far].bounds, q.origin, invDir, tClosest);
+        if (tFar < tNear) {
+            int tmpIdx = near; near = far; far = tmpIdx;
+            float tmpT = tNear; tNear = tFar; tFar = tmpT;
+        }
+        if (tFar != FLT_MAX) {
+            stack[stackPtr++] = far;
+        }
+        if (tNear != FLT_MAX) {
+            stack[stackPtr++] = near;
+        }
     }
-    return -1;
 
-    /*printf("\n***********");
-    for (int i = 0; i < obj.triCount; i++)
-    {
-        printf("\n%f, %f, %f", dev_tri->pos[0].x, dev_tri->pos[0].y, dev_tri->pos[0].z);
-        dev_tri++;
+    if (hitBlock == -1) {
+        return -1;
     }
-    printf("\n###########\n");*/
+
+    triIndex = triBlocks[hitBlock].triIndex[hitLane];
+    bary = triangleBlockBarycentrics(triBlocks[hitBlock], hitLane, q);
+    return tClosest;
 }
 
 /*
@@ -291,44 +413,44 @@ __host__ __device__ float objIntersectionTest(Geom obj, Triangle *dev_tri, Ray r
   ******************************************************
   */
 
-__host__ __device__ float roundedCylinderSDF(glm::vec3 queryPos, float ra, float rb, float h)
+__host__ __device__ inline float roundedCylinderSDF(glm::vec3 queryPos, float ra, float rb, float h)
 {
     glm::vec2 d = glm::vec2(glm::length(glm::vec2(queryPos.x, queryPos.z)) - 2.0 * ra + rb, abs(queryPos.y) - h);
     return min(max(d.x, d.y), 0.f) + glm::length(max(d, 0.f)) - rb;
 }
 
-__host__ __device__ float sphereSDF(glm::vec3 p) {
+__host__ __device__ inline float sphereSDF(glm::vec3 p) {
     glm::vec3 sphereCenter = glm::vec3(0, 0, 0);    // center.xyz,radius
     float sphereRadius = 1.f;
     //normal = glm::normalize(p - sphereCenter);
     return glm::length(p - sphereCenter) - sphereRadius; // dist from sphere = dist from center - radius
 }
 
-__host__ __device__ float torusSDF(glm::vec3 p, glm::vec2 t)
+__host__ __device__ inline float torusSDF(glm::vec3 p, glm::vec2 t)
 {
     glm::vec2 q = glm::vec2(glm::length(glm::vec2(p.x, p.z)) - t.x, p.y);
     return glm::length(q) - t.y;
 }
 
-__host__ __device__ float cappedCylinderSDF(glm::vec3 queryPos, float r, float h)
+__host__ __device__ inline float cappedCylinderSDF(glm::vec3 queryPos, float r, float h)
 {
     glm::vec2 d = abs(glm::vec2(glm::length(glm::vec2(queryPos.x, queryPos.z)), queryPos.y)) - glm::vec2(r, h);
     return min(max(d.x, d.y), 0.f) + glm::length(max(d, 0.f));
 }
 
-__host__ __device__ float boxSDF(glm::vec3 p, glm::vec3 b)
+__host__ __device__ inline float boxSDF(glm::vec3 p, glm::vec3 b)
 {
     glm::vec3 q = abs(p) - b;
     return glm::length(max(q, 0.f)) + min(max(q.x, max(q.y, q.z)), 0.f);
 }
 
-__host__ __device__ float roundBoxSDF(glm::vec3 p, glm::vec3 b, float r)
+__host__ __device__ inline float roundBoxSDF(glm::vec3 p, glm::vec3 b, float r)
 {
     glm::vec3 q = abs(p) - b;
     return glm::length(max(q, 0.f)) + min(max(q.x, max(q.y, q.z)), 0.f) - r;
 }
 
-__host__ __device__ float cappedConeSDF(glm::vec3 p, glm::vec3 a, glm::vec3 b, float ra, float rb)
+__host__ __device__ inline float cappedConeSDF(glm::vec3 p, glm::vec3 a, glm::vec3 b, float ra, float rb)
 {
     float rba = rb - ra;
     float baba = dot(b - a, b - a);
@@ -352,7 +474,7 @@ __host__ __device__ float cappedConeSDF(glm::vec3 p, glm::vec3 a, glm::vec3 b, f
  ******************************************************
  */
 
-__host__ __device__ glm::mat2 rot(float a) {
+__host__ __device__ inline glm::mat2 rot(float a) {
     float s = sin(a);
     float c = cos(a);
     return glm::mat2(c, -s, s, c);
@@ -364,7 +486,7 @@ __host__ __device__ glm::mat2 rot(float a) {
  ******************************************************
  */
 
-__host__ __device__ float mugSDF(glm::vec3 p) {
+__host__ __device__ inline float mugSDF(glm::vec3 p) {
     // coffee mug
     float dMugOuter = roundedCylinderSDF(p, 0.6f, 0.2f, 1.f);
     float dMugInner = roundedCylinderSDF(p - glm::vec3(0.f, 0.1f, 0.f), 0.5f, 0.2f, 1.f);
@@ -384,12 +506,12 @@ __host__ __device__ float mugSDF(glm::vec3 p) {
     return dMug;
 }
 
-__host__ __device__ float coffeeSDF(glm::vec3 p) {
+__host__ __device__ inline float coffeeSDF(glm::vec3 p) {
     float dCoffee = cappedCylinderSDF(p - glm::vec3(0.f, 0.7f, 0.f), 1.f, 0.01f);
     return dCoffee; // dist from sphere = dist from center - radius
 }
 
-__host__ __device__ float bookCoverSDF(glm::vec3 p) {
+__host__ __device__ inline float bookCoverSDF(glm::vec3 p) {
     glm::vec3 pCBook = p;// +glm::vec3(2.5f, 0.80, 0.0);
 
     float dCBookCover = roundBoxSDF(pCBook, glm::vec3(0.8f, 0.25f, 1.1f), 0.2);
@@ -398,13 +520,13 @@ __host__ __device__ float bookCoverSDF(glm::vec3 p) {
     return dCBook;
 }
 
-__host__ __device__ float bookPagesSDF(glm::vec3 p) {
+__host__ __device__ inline float bookPagesSDF(glm::vec3 p) {
     glm::vec3 pCBook = p;// +glm::vec3(2.5f, 0.80, 0.0);
     float dCBookPages = boxSDF(pCBook, glm::vec3(0.9f, 0.28f, 1.2f));
     return dCBookPages;
 }
 
-__host__ __device__ float lightSDF(glm::vec3 p) {
+__host__ __device__ inline float lightSDF(glm::vec3 p) {
 
     p -= glm::vec3(0.f, 0.f, 0.f);
 
@@ -440,7 +562,7 @@ __host__ __device__ float lightSDF(glm::vec3 p) {
     return min(min(min(dLightHead, dULightStand), dLLightStand), dLightBase);
 }
 
-__host__ __device__ float sceneSDF(glm::vec3 p, Geom impGeom) {
+__host__ __device__ inline float sceneSDF(glm::vec3 p, Geom impGeom) {
 
      glm::vec4 transP4 = impGeom.inverseTransform* glm::vec4(p.x, p.y, p.z, 1.0);
      glm::vec3 transP3 = glm::vec3(transP4.x, transP4.y, transP4.z);
@@ -468,7 +590,7 @@ __host__ __device__ float sceneSDF(glm::vec3 p, Geom impGeom) {
  ******************************************************
  */
 
-__host__ __device__ glm::vec3 estimateNormal(glm::vec3 p, Geom geom) {
+__host__ __device__ inline glm::vec3 estimateNormal(glm::vec3 p, Geom geom) {
     float x = sceneSDF(glm::vec3(p.x + EPSILON, p.y, p.z), geom) - sceneSDF(glm::vec3(p.x - EPSILON, p.y, p.z), geom);
     float y = sceneSDF(glm::vec3(p.x, p.y + EPSILON, p.z), geom) - sceneSDF(glm::vec3(p.x, p.y - EPSILON, p.z), geom);
     float z = sceneSDF(glm::vec3(p.x, p.y, p.z + EPSILON), geom) - sceneSDF(glm::vec3(p.x, p.y, p.z - EPSILON), geom);
@@ -482,33 +604,244 @@ __host__ __device__ glm::vec3 estimateNormal(glm::vec3 p, Geom geom) {
   ******************************************************
   */
 
-__host__ __device__ float implicitIntersectionTest(Geom impGeom, Ray r,
-    glm::vec3& intersectionPoint, glm::vec3& normal, bool& outside) {
-
-    float t;
-    //printf("## 1 ##");
+/**
+ * Sphere-traces the geom's SDF along the ray. The normal is left to
+ * resolveHitAttributes, which estimates it at the hit point.
+ *
+ * @return  Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float implicitIntersectionTest(Geom impGeom, Ray r) {
     glm::vec3 queryPoint = r.origin;
     for (int i = 0; i < MAX_STEPS; ++i)
     {
-        //printf("## 2 ##");
         float distanceToSurface = sceneSDF(queryPoint, impGeom);
-
         if (distanceToSurface < EPSILON)
         {
-            //printf("## 3 ##");
-            //intersection.position = queryPoint;
-            normal = estimateNormal(queryPoint, impGeom);
-            t = glm::length(queryPoint - r.origin);
-            intersectionPoint = getPointOnRay(r, t);
-            return t;
+            return glm::length(queryPoint - r.origin);
         }
-        //printf("## 4 ##");
         queryPoint = queryPoint + r.direction * distanceToSurface;
     }
-    //printf("## 5 ##");
-    t = -1.0;
-    intersectionPoint = getPointOnRay(r, t);
-    //normal = intersectionPoint - ;
-    //printf("## 6 ##");
-    return t;
-}
\ No newline at end of file
+    return -1.0f;
+}
+
+/*
+ ******************************************************
+ * SCENE LEVEL INTERSECTION
+ ******************************************************
+ */
+
+/**
+ * Runs the intersection test matching the geom's type. OBJ geoms look up
+ * their shared mesh in `meshes`; mesh data is read from the device copies on
+ * the GPU and from the host copies otherwise, so the same call works from
+ * kernels and from host code.
+ *
+ * @param primId  Output parameter for the primitive hit: the triangle of a
+ *                mesh, the face axis of a cube, 0 for other geoms.
+ * @param bary    Output parameter for the barycentrics of a triangle hit.
+ * @return        Ray parameter `t` value. -1 if no intersection.
+ */
+__host__ __device__ inline float geomIntersectionTest(const Geom& geom, const Mesh* meshes, Ray r,
+    int& primId, glm::vec2& bary) {
+    // Spheres and implicit surfaces have no primitive; don't let them pass
+    // on the previous geom's
+    primId = 0;
+    bary = glm::vec2(0.f);
+    if (geom.type == CUBE)
+    {
+        return boxIntersectionTest(geom, r, primId);
+    }
+    else if (geom.type == SPHERE)
+    {
+        return sphereIntersectionTest(geom, r);
+    }
+    else if (geom.type == OBJ)
+    {
+        const Mesh& mesh = meshes[geom.meshid];
+#if MESH_BVH
+#ifdef __CUDA_ARCH__
+        return objBVHIntersectionTest(geom, mesh.dev_triBlocks, mesh.dev_bvhNodes, r, primId, bary);
+#else
+        return objBVHIntersectionTest(geom, mesh.triBlocks, mesh.bvhNodes, r, primId, bary);
+#endif
+#else
+#ifdef __CUDA_ARCH__
+        return objIntersectionTest(geom, mesh.dev_vertices, mesh.dev_indices, mesh.triCount, r, primId, bary);
+#else
+        return objIntersectionTest(geom, mesh.vertices, mesh.indices, mesh.triCount, r, primId, bary);
+#endif
+#endif
+    }
+    else if (geom.type == IMPLICIT)
+    {
+        return implicitIntersectionTest(geom, r);
+    }
+    return -1;
+}
+
+/**
+ * Closest hit against every geom, testing them one after another. Only
+ * `hit`'s t, geomId, primId and bary are written, and only on a hit.
+ *
+ * @return  Index of the hit geom, -1 if nothing was hit.
+ */
+__host__ __device__ inline int sceneLinearIntersectionTest(Geom* geoms, int geomCount, const Mesh* meshes, Ray r,
+    ShadeableIntersection& hit) {
+    int primId = 0;
+    glm::vec2 bary(0.f);
+    int hit_geom_index = -1;
+    float t_min = FLT_MAX;
+
+    for (int i = 0; i < geomCount; i++)
+    {
+        float t = geomIntersectionTest(geoms[i], meshes, r, primId, bary);
+        if (t > 0.0f && t_min > t)
+        {
+            t_min = t;
+            hit_geom_index = i;
+            hit.primId = primId;
+            hit.bary = bary;
+        }
+    }
+    if (hit_geom_index != -1) {
+        hit.t = t_min;
+        hit.geomId = hit_geom_index;
+    }
+    return hit_geom_index;
+}
+
+/**
+ * Closest hit through the top-level BVH over world-space geom bounds. Rays
+ * that miss the root (scene) bounds return without running any geom test.
+ * Writes `hit` as sceneLinearIntersectionTest does.
+ *
+ * @param geomIndices  Geom ids in leaf order, as produced by buildBVH.
+ * @return             Index of the hit geom, -1 if nothing was hit.
+ */
+__host__ __device__ inline int sceneBVHIntersectionTest(Geom* geoms, const Mesh* meshes,
+    BVHNode* nodes, int* geomIndices, Ray r, ShadeableIntersection& hit) {
+    glm::vec3 invDir = 1.f / r.direction;
+    int primId = 0;
+    glm::vec2 bary(0.f);
+    int hit_geom_index = -1;
+    float t_min = FLT_MAX;
+
+    // Scene bounds early-out
+    if (bvhNodeIntersectionTest(nodes[0].bounds, r.origin, invDir, t_min) == FLT_MAX) {
+        return -1;
+    }
+
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+
+        if (node.primCount > 0) {
+            for (int i = node.leftFirst; i < node.leftFirst + node.primCount; i++) {
+                int geomIdx = geomIndices[i];
+                float t = geomIntersectionTest(geoms[geomIdx], meshes, r, primId, bary);
+                if (t > 0.0f && t_min > t)
+                {
+                    t_min = t;
+                    hit_geom_index = geomIdx;
+                    hit.primId = primId;
+                    hit.bary = bary;
+                }
+            }
+            continue;
+        }
+
+        int near = node.leftFirst;
+        int far = node.leftFirst + 1;
+        float tNear = bvhNodeIntersectionTest(nodes[near].bounds, r.origin, invDir, t_min);
+        float tFar = bvhNodeIntersectionTest(nodes[far].bounds, r.origin, invDir, t_min);
+        if (tFar < tNear) {
+            int tmpIdx = near; near = far; far = tmpIdx;
+            float tmpT = tNear; tNear = tFar; tFar = tmpT;
+        }
+        if (tFar != FLT_MAX) {
+            stack[stackPtr++] = far;
+        }
+        if (tNear != FLT_MAX) {
+            stack[stackPtr++] = near;
+        }
+    }
+    if (hit_geom_index != -1) {
+        hit.t = t_min;
+        hit.geomId = hit_geom_index;
+    }
+    return hit_geom_index;
+}
+
+/*
+ ******************************************************
+ * HIT ATTRIBUTES
+ ******************************************************
+ */
+
+/**
+ * Surface attributes at a recorded hit, worked out from its geom,
+ * primitive and barycentrics. The scene tests above only find the closest
+ * hit; this runs once per path, in the shading stage.
+ *
+ * Cube normals face the ray and sphere normals are flipped toward it, as
+ * the intersection tests used to return them. Meshes use their
+ * interpolated vertex normals, turned to the side of the face normal, or
+ * the face normal if the file had none; uv is the interpolated texture
+ * coordinate, or the barycentrics if the mesh has no UVs.
+ *
+ * @param r  The ray that found the hit.
+ */
+__host__ __device__ inline HitAttributes resolveHitAttributes(const ShadeableIntersection& hit, const Ray& r,
+    const Geom* geoms, const Mesh* meshes) {
+    const Geom& geom = geoms[hit.geomId];
+    HitAttributes attr;
+    attr.point = getPointOnRay(r, hit.t);
+    attr.uv = hit.bary;
+
+    glm::vec3 objNormal;
+    if (geom.type == CUBE) {
+        glm::vec3 q = multiplyMV(geom.inverseTransform, glm::vec4(r.direction, 0.0f));
+        objNormal = glm::vec3(0.0f);
+        objNormal[hit.primId] = q[hit.primId] < 0.0f ? 1.0f : -1.0f;
+    }
+    else if (geom.type == SPHERE) {
+        objNormal = multiplyMV(geom.inverseTransform, glm::vec4(r.origin, 1.0f))
+            + hit.t * multiplyMV(geom.inverseTransform, glm::vec4(r.direction, 0.0f));
+    }
+    else if (geom.type == OBJ) {
+        const Mesh& mesh = meshes[geom.meshid];
+#ifdef __CUDA_ARCH__
+        const MeshVertex* vertices = mesh.dev_vertices;
+        glm::uvec3 tri = mesh.dev_indices[hit.primId];
+#else
+        const MeshVertex* vertices = mesh.vertices;
+        glm::uvec3 tri = mesh.indices[hit.primId];
+#endif
+        const MeshVertex& a = vertices[tri.x];
+        const MeshVertex& b = vertices[tri.y];
+        const MeshVertex& c = vertices[tri.z];
+        float w0 = 1.0f - hit.bary.x - hit.bary.y;
+        objNormal = glm::cross(b.pos - a.pos, c.pos - a.pos);
+        if (mesh.hasNormals) {
+            glm::vec3 n = w0 * decodeOctNormal(a.nor) + hit.bary.x * decodeOctNormal(b.nor)
+                + hit.bary.y * decodeOctNormal(c.nor);
+            objNormal = glm::dot(n, objNormal) < 0.0f ? -n : n;
+        }
+        if (mesh.hasUVs) {
+            attr.uv = w0 * decodeHalfUV(a.uv) + hit.bary.x * decodeHalfUV(b.uv) + hit.bary.y * decodeHalfUV(c.uv);
+        }
+    }
+    else {
+        attr.normal = estimateNormal(r.origin + hit.t * glm::normalize(r.direction), geom);
+        return attr;
+    }
+
+    attr.normal = glm::normalize(multiplyMV(geom.invTranspose, glm::vec4(objNormal, 0.0f)));
+    if (geom.type == SPHERE && glm::dot(r.direction, attr.normal) > 0.0f) {
+        attr.normal = -attr.normal;
+    }
+    return attr;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "sceneStructs.h"
+#include "utilities.h"
+
+// Area light sampling for next-event estimation. Emissive cubes and
+// uniformly scaled spheres are sampled uniformly by area; other emitters
+// (meshes, implicits, squashed spheres) are only found by BSDF sampling.
+
+/** Whether an emissive `geom` goes in the light list. */
+__host__ __device__ inline bool isSampledLightShape(const Geom& geom) {
+    if (geom.type == CUBE) {
+        return true;
+    }
+    if (geom.type != SPHERE) {
+        return false;
+    }
+    glm::vec3 s = glm::abs(geom.scale);
+    return fabsf(s.x - s.y) <= 1e-4f * s.x && fabsf(s.x - s.z) <= 1e-4f * s.x;
+}
+
+/** World-space areas of the cube's x, y and z faces (one of each pair). */
+__host__ __device__ inline glm::vec3 cubeFaceAreas(const Geom& geom) {
+    glm::vec3 ax = glm::vec3(geom.transform[0]);
+    glm::vec3 ay = glm::vec3(geom.transform[1]);
+    glm::vec3 az = glm::vec3(geom.transform[2]);
+    return glm::vec3(glm::length(glm::cross(ay, az)), glm::length(glm::cross(az, ax)),
+        glm::length(glm::cross(ax, ay)));
+}
+
+/** World-space surface area of a geom for which isSampledLightShape holds. */
+__host__ __device__ inline float lightArea(const Geom& geom) {
+    if (geom.type == CUBE) {
+        glm::vec3 a = cubeFaceAreas(geom);
+        return 2.0f * (a.x + a.y + a.z);
+    }
+    float radius = 0.5f * glm::length(glm::vec3(geom.transform[0]));
+    return 4.0f * PI * radius * radius;
+}
+
+/**
+ * Uniform point on the light's surface for `u` in [0, 1)^3, with the
+ * outward normal there.
+ */
+__host__ __device__ inline void sampleLightSurface(const Geom& geom, glm::vec3 u,
+    glm::vec3& point, glm::vec3& normal) {
+    glm::vec3 p;
+    glm::vec3 n;
+    if (geom.type == CUBE) {
+        // Face pair by area, then the side from where u.x fell inside it
+        glm::vec3 a = cubeFaceAreas(geom);
+        float pick = u.x * (a.x + a.y + a.z);
+        int axis = pick < a.x ? 0 : pick < a.x + a.y ? 1 : 2;
+        float start = axis == 0 ? 0.0f : axis == 1 ? a.x : a.x + a.y;
+        float side = (pick - start) < 0.5f * a[axis] ? -0.5f : 0.5f;
+        p[axis] = side;
+        p[(axis + 1) % 3] = u.y - 0.5f;
+        p[(axis + 2) % 3] = u.z - 0.5f;
+        n = glm::vec3(0.0f);
+        n[axis] = 2.0f * side;
+    }
+    else {
+        float z = 1.0f - 2.0f * u.x;
+        float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+        float phi = TWO_PI * u.y;
+        n = glm::vec3(r * cosf(phi), r * sinf(phi), z);
+        p = 0.5f * n;
+    }
+    point = glm::vec3(geom.transform * glm::vec4(p, 1.0f));
+    normal = glm::normalize(glm::vec3(geom.invTranspose * glm::vec4(n, 0.0f)));
+}
+
+/**
+ * Solid-angle pdf of picking one of `lightCount` lights uniformly and then a
+ * point of it by area, seen from `distance` away at `cosLight` to its normal.
+ */
+__host__ __device__ inline float lightSolidAnglePdf(int lightCount, float area, float distance, float cosLight) {
+    return distance * distance / (cosLight * area * lightCount);
+}
+
+/** Power heuristic (beta = 2) weight of the strategy with pdf `pdfA`. */
+__host__ __device__ inline float powerHeuristic(float pdfA, float pdfB) {
+    float a = pdfA * pdfA;
+    float b = pdfB * pdfB;
+    return a / (a + b);
+}
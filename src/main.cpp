@@ -1,11 +1,16 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "main.h"
 #include "preview.h"
+#include <chrono>
 #include <cstring>
 #include "tiny_obj_loader.h"
 
 static std::string startTimeString;
 
+// Stopping criteria, restarted with the render on every camera change
+static std::chrono::high_resolution_clock::time_point renderStart;
+static RenderStopStatus stopStatus = initialStopStatus();
+
 // For camera controls
 static bool leftMousePressed = false;
 static bool rightMousePressed = false;
@@ -44,10 +49,16 @@ int main(int argc, char** argv) {
 	const char* sceneFile = argv[1];
 
 	// Load scene file
-	scene = new Scene(sceneFile);
+	try {
+		scene = new Scene(sceneFile);
+	} catch (const std::exception& e) {
+		printf("Could not load %s: %s\n", sceneFile, e.what());
+		return 1;
+	}
 
 	//Create Instance for ImGUIData
 	guiData = new GuiDataContainer();
+	guiData->TelemetryBaseName = scene->state.imageName + "." + startTimeString;
 
 	// Set up camera stuff from loaded path tracer settings
 	iteration = 0;
@@ -79,9 +90,15 @@ int main(int argc, char** argv) {
 	InitImguiData(guiData);
 	InitDataContainer(guiData);
 
+	// The scene stays on the device for the whole session; camera moves
+	// only restart the accumulation
+	pathtraceInit(scene);
+
 	// GLFW main loop
 	mainLoop();
 
+	pathtraceFree(scene);
+
 	return 0;
 }
 
@@ -101,6 +118,9 @@ void saveImage() {
 	std::string filename = renderState->imageName;
 	std::ostringstream ss;
 	ss << filename << "." << startTimeString << "." << samples << "samp";
+	if (stopStatus.reason != STOP_NONE) {
+		ss << "." << stopReasonName(stopStatus.reason);
+	}
 	filename = ss.str();
 
 	// CHECKITOUT
@@ -133,11 +153,12 @@ void runCuda() {
 	// No data is moved (Win & Linux). When mapped to CUDA, OpenGL should not use this buffer
 
 	if (iteration == 0) {
-		pathtraceFree(scene);
-		pathtraceInit(scene);
+		pathtraceResetImage();
+		renderStart = std::chrono::high_resolution_clock::now();
+		stopStatus = initialStopStatus();
 	}
 
-	if (iteration < renderState->iterations) {
+	if (stopStatus.reason == STOP_NONE) {
 		uchar4* pbo_dptr = NULL;
 		iteration++;
 		cudaGLMapBufferObject((void**)&pbo_dptr, pbo);
@@ -148,8 +169,12 @@ void runCuda() {
 
 		// unmap buffer object
 		cudaGLUnmapBufferObject(pbo);
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+		checkStopCriteria(*renderState, iteration, seconds, pathtraceErrorEstimate, stopStatus);
 	}
 	else {
+		printf("%s samples=%lld\n", stopSummary(stopStatus).c_str(), pathtraceSampleCount());
 		saveImage();
 		pathtraceFree(scene);
 		cudaDeviceReset();
@@ -17,6 +17,7 @@
 #include "sceneStructs.h"
 #include "image.h"
 #include "pathtrace.h"
+#include "renderStop.h"
 #include "utilities.h"
 #include "scene.h"
 
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include "glm/glm.hpp"
+
+/**
+ * Octahedral normal encoding: the unit sphere is folded onto an octahedron
+ * and flattened to [-1, 1]^2, stored as two snorm16 in one uint. Error is
+ * below 0.01 degrees. A zero vector encodes as +Z.
+ */
+__host__ __device__ inline unsigned int encodeOctNormal(glm::vec3 n) {
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 == 0.f) {
+        return glm::packSnorm2x16(glm::vec2(0.f));
+    }
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.f) {
+        p = glm::vec2((1.f - fabsf(p.y)) * (p.x >= 0.f ? 1.f : -1.f),
+                      (1.f - fabsf(p.x)) * (p.y >= 0.f ? 1.f : -1.f));
+    }
+    return glm::packSnorm2x16(p);
+}
+
+__host__ __device__ inline glm::vec3 decodeOctNormal(unsigned int packed) {
+    glm::vec2 p = glm::unpackSnorm2x16(packed);
+    glm::vec3 n(p.x, p.y, 1.f - fabsf(p.x) - fabsf(p.y));
+    float t = glm::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+/** Two half floats in one uint, precise to 1/2048 for UVs in [0, 1]. */
+__host__ __device__ inline unsigned int encodeHalfUV(glm::vec2 uv) {
+    return glm::packHalf2x16(uv);
+}
+
+__host__ __device__ inline glm::vec2 decodeHalfUV(unsigned int packed) {
+    return glm::unpackHalf2x16(packed);
+}
@@ -7,12 +7,12 @@
 #include "utilities.h"
 
 
-__host__ __device__ float hashN(float n)
+__host__ __device__ inline float hashN(float n)
 {
     return glm::fract(sin(n) * 43758.5453);
 }
 
-__host__ __device__ float random2D(glm::vec2 x)
+__host__ __device__ inline float random2D(glm::vec2 x)
 {
     glm::vec2 p = floor(x);
     glm::vec2 f = fract(x);
@@ -25,13 +25,13 @@ __host__ __device__ float random2D(glm::vec2 x)
         glm::mix(hashN(n + 57.f), hashN(n + 58.f), f.x), f.y);
 }
 
-glm::vec2 random2(glm::vec2 p) {
+__host__ __device__ inline glm::vec2 random2(glm::vec2 p) {
     return glm::fract(sin(glm::vec2(glm::dot(p, glm::vec2(127.1f, 311.7f)),
         glm::dot(p, glm::vec2(269.5f, 183.3f))))
         * 43758.5453f);
 }
 
-__host__ __device__ float WorleyNoise(glm::vec2 uv) {
+__host__ __device__ inline float WorleyNoise(glm::vec2 uv) {
     uv *= 10.0; // Now the space is 10x10 instead of 1x1. Change this to any number you want.
     glm::vec2 uvInt = floor(uv);
     glm::vec2 uvFract = fract(uv);
@@ -48,7 +48,7 @@ __host__ __device__ float WorleyNoise(glm::vec2 uv) {
     return minDist;
 }
 
-__host__ __device__ float interpNoise2D(glm::vec2 p) {
+__host__ __device__ inline float interpNoise2D(glm::vec2 p) {
     int intX = int(floor(p.x));
     float fractX = glm::fract(p.x);
     int intY = int(floor(p.y));
@@ -64,7 +64,7 @@ __host__ __device__ float interpNoise2D(glm::vec2 p) {
     return glm::mix(i1, i2, fractY);
 }
 
-__host__ __device__ float fbm2D(glm::vec2 p, float freq, float persistence, float amp) {
+__host__ __device__ inline float fbm2D(glm::vec2 p, float freq, float persistence, float amp) {
     float total = 0.f;
     int octaves = 8;
     for (int i = 0; i < octaves; i++) {
@@ -75,7 +75,7 @@ __host__ __device__ float fbm2D(glm::vec2 p, float freq, float persistence, floa
     return total;
 }
 
-__host__ __device__ float random3D(glm::vec3 x)
+__host__ __device__ inline float random3D(glm::vec3 x)
 {
     glm::vec3 p = floor(x);
     glm::vec3 f = fract(x);
@@ -89,7 +89,7 @@ __host__ __device__ float random3D(glm::vec3 x)
 }
 
 
-__host__ __device__ float interpNoise3D(glm::vec3 p) {
+__host__ __device__ inline float interpNoise3D(glm::vec3 p) {
     int intX = int(floor(p.x));
     float fractX = glm::fract(p.x);
     int intY = int(floor(p.y));
@@ -118,7 +118,7 @@ __host__ __device__ float interpNoise3D(glm::vec3 p) {
     return glm::mix(i3, i6, fractX);
 }
 
-__host__ __device__ float fbm3D(glm::vec3 p, float freq, float persistence) {
+__host__ __device__ inline float fbm3D(glm::vec3 p, float freq, float persistence) {
     float total = 0.f;
     //float persistence = 0.5f;
     int octaves = 8;
@@ -131,14 +131,14 @@ __host__ __device__ float fbm3D(glm::vec3 p, float freq, float persistence) {
     }
     return total;
 }
- __host__ __device__ float smoothstep(float a, float b, float x)
+ __host__ __device__ inline float smoothstep(float a, float b, float x)
  {
      float X = ((x - a) / (b - a));
      float t = max(0.f, min(1.f, X));
      return t * t * (3.0 - (2.0 * t));
  }
 
-__host__ __device__ glm::vec3 getProceduralColor1(PathSegment& pathSegment, glm::vec3 intersect, glm::vec3 normal, glm::vec3 color) {
+__host__ __device__ inline glm::vec3 getProceduralColor1(PathSegment& pathSegment, glm::vec3 intersect, glm::vec3 normal, glm::vec3 color) {
 
     glm::vec3 isectCpy = glm::normalize(intersect) * 2.f - 1.f;
     glm::vec4 baseCol = glm::vec4(1.0, 1.0, 0.0, 1.0);
@@ -169,7 +169,7 @@ __host__ __device__ glm::vec3 getProceduralColor1(PathSegment& pathSegment, glm:
     return glm::vec3(out_color.x, out_color.y, out_color.z);
 }
 
-__host__ __device__ glm::vec3 getProceduralColor2(PathSegment& pathSegment, glm::vec3 intersect, glm::vec3 normal, glm::vec3 color) {
+__host__ __device__ inline glm::vec3 getProceduralColor2(PathSegment& pathSegment, glm::vec3 intersect, glm::vec3 normal, glm::vec3 color) {
 
     glm::vec3 p_copy = intersect;
 
@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <glm/gtx/norm.hpp>
+
+#include "meshEncoding.h"
+#include "objLoader.h"
+#include "mappedFile.h"
+#include "threadPool.h"
+
+namespace {
+    enum ObjLineType {
+        LINE_OTHER,
+        LINE_POSITION,
+        LINE_TEXCOORD,
+        LINE_NORMAL,
+        LINE_FACE
+    };
+
+    /**
+     * A line-aligned slice of the file. Counts come from the first pass and
+     * offsets are their exclusive prefix sums over preceding chunks.
+     */
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+        int positionCount;
+        int texcoordCount;
+        int normalCount;
+        int triCount;
+        int positionOffset;
+        int texcoordOffset;
+        int normalOffset;
+        int triOffset;
+        BoundingBox bounds;
+        bool hasNormals;
+        bool hasUVs;
+        bool error;
+    };
+
+    inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char* skipSpaces(const char* p, const char* end) {
+        while (p < end && isSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    inline const char* findLineEnd(const char* p, const char* end) {
+        const char* e = (const char*)memchr(p, '\n', end - p);
+        return e == NULL ? end : e;
+    }
+
+    /** Classifies a line and advances p past its keyword. */
+    inline ObjLineType lineType(const char*& p, const char* end) {
+        p = skipSpaces(p, end);
+        if (end - p >= 2 && p[0] == 'v' && isSpace(p[1])) {
+            p += 2;
+            return LINE_POSITION;
+        }
+        if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+            p += 3;
+            return LINE_TEXCOORD;
+        }
+        if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+            p += 3;
+            return LINE_NORMAL;
+        }
+        if (end - p >= 2 && p[0] == 'f' && isSpace(p[1])) {
+            p += 2;
+            return LINE_FACE;
+        }
+        return LINE_OTHER;
+    }
+
+    bool parseInt(const char*& p, const char* end, int& value) {
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return false;
+        }
+        int v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v = v * 10 + (*p - '0');
+            p++;
+        }
+        value = negative ? -v : v;
+        return true;
+    }
+
+    /** Locale-independent decimal float parser; much faster than strtof. */
+    float parseFloat(const char*& p, const char* end) {
+        p = skipSpaces(p, end);
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        double mantissa = 0.0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10.0 + (*p - '0');
+            p++;
+        }
+        int exponent = 0;
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && *p >= '0' && *p <= '9') {
+                mantissa = mantissa * 10.0 + (*p - '0');
+                exponent--;
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            int e = 0;
+            if (parseInt(p, end, e)) {
+                exponent += e;
+            }
+        }
+        double scale = 1.0;
+        double base = exponent < 0 ? 0.1 : 10.0;
+        for (int n = std::abs(exponent); n > 0; n >>= 1) {
+            if (n & 1) {
+                scale *= base;
+            }
+            base *= base;
+        }
+        float value = (float)(mantissa * scale);
+        return negative ? -value : value;
+    }
+
+    int countFaceVertices(const char* p, const char* end) {
+        int count = 0;
+        while (true) {
+            p = skipSpaces(p, end);
+            if (p == end || *p == '#') {
+                return count;
+            }
+            count++;
+            while (p < end && !isSpace(*p)) {
+                p++;
+            }
+        }
+    }
+
+    /** Turns a 1-based or negative (relative) OBJ index into a 0-based one. */
+    inline int resolveIndex(int index, int countSoFar) {
+        return index > 0 ? index - 1 : countSoFar + index;
+    }
+
+    void countChunk(ObjChunk& chunk) {
+        chunk.positionCount = 0;
+        chunk.texcoordCount = 0;
+        chunk.normalCount = 0;
+        chunk.triCount = 0;
+        for (const char* line = chunk.begin; line < chunk.end; ) {
+            const char* end = findLineEnd(line, chunk.end);
+            const char* p = line;
+            switch (lineType(p, end)) {
+            case LINE_POSITION: chunk.positionCount++; break;
+            case LINE_TEXCOORD: chunk.texcoordCount++; break;
+            case LINE_NORMAL:   chunk.normalCount++; break;
+            case LINE_FACE:     chunk.triCount += std::max(0, countFaceVertices(p, end) - 2); break;
+            default: break;
+            }
+            line = end + 1;
+        }
+    }
+
+    /** Parsed OBJ attribute arrays, indexed with resolved 0-based indices. */
+    struct ObjAttributes {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texcoords;
+        std::vector<glm::vec3> normals;
+    };
+
+    void parseVertices(const ObjChunk& chunk, ObjAttributes& attribs) {
+        glm::vec3* pos = attribs.positions.data() + chunk.positionOffset;
+        glm::vec2* uv = attribs.texcoords.data() + chunk.texcoordOffset;
+        glm::vec3* nor = attribs.normals.data() + chunk.normalOffset;
+        for (const char* line = chunk.begin; line < chunk.end; ) {
+            const char* end = findLineEnd(line, chunk.end);
+            const char* p = line;
+            ObjLineType type = lineType(p, end);
+            if (type == LINE_POSITION || type == LINE_NORMAL) {
+                glm::vec3 v;
+                v.x = parseFloat(p, end);
+                v.y = parseFloat(p, end);
+                v.z = parseFloat(p, end);
+                *(type == LINE_POSITION ? pos++ : nor++) = v;
+            }
+            else if (type == LINE_TEXCOORD) {
+                glm::vec2 v;
+                v.x = parseFloat(p, end);
+                v.y = parseFloat(p, end);
+                *uv++ = v;
+            }
+            line = end + 1;
+        }
+    }
+
+    /**
+     * Writes triangle (a, b, c) of a face. In a file with normals, corners
+     * that have none get the triangle's geometric normal, so shading
+     * interpolates the face normal there rather than the +Z a zero normal
+     * decodes to.
+     */
+    inline void emitTriangle(const MeshVertex* face, const char* faceHasNormal, int a, int b, int c,
+            bool fileHasNormals, MeshVertex*& out) {
+        const int corners[3] = { a, b, c };
+        unsigned int faceNormal = 0;
+        if (fileHasNormals && !(faceHasNormal[a] && faceHasNormal[b] && faceHasNormal[c])) {
+            faceNormal = encodeOctNormal(glm::cross(face[b].pos - face[a].pos, face[c].pos - face[a].pos));
+        }
+        for (int i : corners) {
+            *out = face[i];
+            if (fileHasNormals && !faceHasNormal[i]) {
+                out->nor = faceNormal;
+            }
+            out++;
+        }
+    }
+
+    /**
+     * Parses the faces of a chunk, triangulates them and writes three
+     * encoded MeshVertex corners per triangle at the chunk's offset.
+     */
+    void parseFaces(ObjChunk& chunk, const ObjAttributes& attribs, MeshVertex* corners) {
+        MeshVertex* out = corners + 3 * chunk.triOffset;
+        int positionsSoFar = chunk.positionOffset;
+        int texcoordsSoFar = chunk.texcoordOffset;
+        int normalsSoFar = chunk.normalOffset;
+        int positionTotal = attribs.positions.size();
+        int texcoordTotal = attribs.texcoords.size();
+        int normalTotal = attribs.normals.size();
+        chunk.bounds.min = glm::vec3(INT_MAX, INT_MAX, INT_MAX);
+        chunk.bounds.max = glm::vec3(INT_MIN, INT_MIN, INT_MIN);
+        chunk.hasNormals = false;
+        chunk.hasUVs = false;
+        chunk.error = false;
+        std::vector<MeshVertex> face;
+        std::vector<char> faceHasNormal;
+
+        for (const char* line = chunk.begin; line < chunk.end; ) {
+            const char* end = findLineEnd(line, chunk.end);
+            const char* p = line;
+            ObjLineType type = lineType(p, end);
+            line = end + 1;
+            if (type == LINE_POSITION) {
+                positionsSoFar++;
+                continue;
+            }
+            if (type == LINE_TEXCOORD) {
+                texcoordsSoFar++;
+                continue;
+            }
+            if (type == LINE_NORMAL) {
+                normalsSoFar++;
+                continue;
+            }
+            if (type != LINE_FACE) {
+                continue;
+            }
+
+            face.clear();
+            faceHasNormal.clear();
+            while (true) {
+                p = skipSpaces(p, end);
+                if (p == end || *p == '#') {
+                    break;
+                }
+                int vi = 0;
+                int ti = 0;
+                int ni = 0;
+                bool hasUV = false;
+                bool hasNormal = false;
+                parseInt(p, end, vi);
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p != '/') {
+                        hasUV = parseInt(p, end, ti);
+                    }
+                    if (p < end && *p == '/') {
+                        p++;
+                        hasNormal = parseInt(p, end, ni);
+                    }
+                }
+                while (p < end && !isSpace(*p)) {
+                    p++;
+                }
+
+                // A bad position index is fatal; like tinyobj, bad texcoord
+                // and normal indices just drop that attribute
+                vi = resolveIndex(vi, positionsSoFar);
+                ti = resolveIndex(ti, texcoordsSoFar);
+                ni = resolveIndex(ni, normalsSoFar);
+                if (vi < 0 || vi >= positionTotal) {
+                    chunk.error = true;
+                    return;
+                }
+                hasUV = hasUV && ti >= 0 && ti < texcoordTotal;
+                hasNormal = hasNormal && ni >= 0 && ni < normalTotal;
+
+                // + 0.f folds -0 into +0 so welding compares bits safely
+                MeshVertex v;
+                v.pos = attribs.positions[vi] + 0.f;
+                v.nor = encodeOctNormal(hasNormal ? attribs.normals[ni] : glm::vec3(0.f));
+                v.uv = encodeHalfUV(hasUV ? attribs.texcoords[ti] : glm::vec2(0.f));
+                chunk.hasNormals |= hasNormal;
+                chunk.hasUVs |= hasUV;
+                chunk.bounds.min = glm::min(chunk.bounds.min, v.pos);
+                chunk.bounds.max = glm::max(chunk.bounds.max, v.pos);
+                face.push_back(v);
+                faceHasNormal.push_back(hasNormal);
+            }
+
+            // Quads split along the shorter diagonal, larger polygons as a fan
+            int n = face.size();
+            bool fileHasNormals = normalTotal > 0;
+            if (n == 4 && glm::length2(face[2].pos - face[0].pos) >= glm::length2(face[3].pos - face[1].pos)) {
+                emitTriangle(face.data(), faceHasNormal.data(), 0, 1, 3, fileHasNormals, out);
+                emitTriangle(face.data(), faceHasNormal.data(), 1, 2, 3, fileHasNormals, out);
+                continue;
+            }
+            for (int v = 2; v < n; v++) {
+                emitTriangle(face.data(), faceHasNormal.data(), 0, v - 1, v, fileHasNormals, out);
+            }
+        }
+    }
+
+    inline uint32_t hashVertex(const MeshVertex& v) {
+        uint32_t words[5];
+        memcpy(words, &v, sizeof(words));
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < 5; i++) {
+            h = (h ^ words[i]) * 16777619u;
+            h ^= h >> 15;
+        }
+        return h;
+    }
+
+    /**
+     * Merges bit-identical corners into shared vertices with an open
+     * addressing table, writing one index per corner. Welds in place: the
+     * unique vertices are packed to the front of `vertices`, which never
+     * overtakes the corner being read.
+     *
+     * @return  The number of unique vertices.
+     */
+    int weldVertices(MeshVertex* vertices, int cornerCount, uint32_t* indices) {
+        const uint32_t empty = 0xffffffffu;
+        uint32_t capacity = 16;
+        while (capacity < 2u * cornerCount) {
+            capacity *= 2;
+        }
+        std::vector<uint32_t> table(capacity, empty);
+
+        int vertexCount = 0;
+        for (int c = 0; c < cornerCount; c++) {
+            MeshVertex v = vertices[c];
+            uint32_t slot = hashVertex(v) & (capacity - 1);
+            while (table[slot] != empty && memcmp(&vertices[table[slot]], &v, sizeof(MeshVertex)) != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            if (table[slot] == empty) {
+                table[slot] = vertexCount;
+                vertices[vertexCount++] = v;
+            }
+            indices[c] = table[slot];
+        }
+        return vertexCount;
+    }
+}
+
+int loadObjMesh(const std::string& path, Mesh* mesh, ObjLoadStats* stats) {
+    auto start = std::chrono::high_resolution_clock::now();
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "ObjLoader: cannot read " << path << std::endl;
+        return -1;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // Cut into line-aligned chunks, a few per thread for load balance
+    ThreadPool& pool = ThreadPool::shared();
+    int chunkCount = (int)std::min<size_t>((pool.size() + 1) * OBJ_CHUNKS_PER_THREAD,
+        size / OBJ_MIN_CHUNK_BYTES + 1);
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char* chunkBegin = data;
+    for (int c = 0; c < chunkCount; c++) {
+        const char* chunkEnd = data + size * (c + 1) / chunkCount;
+        if (chunkEnd < chunkBegin) {
+            chunkEnd = chunkBegin;
+        }
+        if (chunkEnd < data + size) {
+            chunkEnd = findLineEnd(chunkEnd, data + size);
+            chunkEnd = std::min(chunkEnd + 1, data + size);
+        }
+        chunks[c].begin = chunkBegin;
+        chunks[c].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    pool.parallelFor(chunkCount, [&](int c) { countChunk(chunks[c]); });
+
+    ObjAttributes attribs;
+    int positionTotal = 0;
+    int texcoordTotal = 0;
+    int normalTotal = 0;
+    int triTotal = 0;
+    for (int c = 0; c < chunkCount; c++) {
+        chunks[c].positionOffset = positionTotal;
+        chunks[c].texcoordOffset = texcoordTotal;
+        chunks[c].normalOffset = normalTotal;
+        chunks[c].triOffset = triTotal;
+        positionTotal += chunks[c].positionCount;
+        texcoordTotal += chunks[c].texcoordCount;
+        normalTotal += chunks[c].normalCount;
+        triTotal += chunks[c].triCount;
+    }
+    attribs.positions.resize(positionTotal);
+    attribs.texcoords.resize(texcoordTotal);
+    attribs.normals.resize(normalTotal);
+    pool.parallelFor(chunkCount, [&](int c) { parseVertices(chunks[c], attribs); });
+
+    // Corners are welded in place, so only the unique vertices are copied
+    // out into the mesh's right-sized storage
+    std::vector<MeshVertex> corners(3 * (size_t)triTotal);
+    pool.parallelFor(chunkCount, [&](int c) { parseFaces(chunks[c], attribs, corners.data()); });
+
+    BoundingBox bounds;
+    bounds.min = glm::vec3(INT_MAX, INT_MAX, INT_MAX);
+    bounds.max = glm::vec3(INT_MIN, INT_MIN, INT_MIN);
+    bool hasNormals = false;
+    bool hasUVs = false;
+    for (int c = 0; c < chunkCount; c++) {
+        if (chunks[c].error) {
+            std::cerr << "ObjLoader: face index out of range in " << path << std::endl;
+            return -1;
+        }
+        bounds.min = glm::min(bounds.min, chunks[c].bounds.min);
+        bounds.max = glm::max(bounds.max, chunks[c].bounds.max);
+        hasNormals |= chunks[c].hasNormals;
+        hasUVs |= chunks[c].hasUVs;
+    }
+
+    glm::uvec3* indices = new glm::uvec3[triTotal];
+    int vertexCount = weldVertices(corners.data(), 3 * triTotal, (uint32_t*)indices);
+    MeshVertex* vertices = new MeshVertex[vertexCount];
+    std::copy(corners.begin(), corners.begin() + vertexCount, vertices);
+
+    mesh->triCount = triTotal;
+    mesh->vertexCount = vertexCount;
+    mesh->vertices = vertices;
+    mesh->indices = indices;
+    mesh->hasNormals = hasNormals;
+    mesh->hasUVs = hasUVs;
+    mesh->boundingBox = bounds;
+
+    if (stats != NULL) {
+        auto end = std::chrono::high_resolution_clock::now();
+        stats->bytes = size;
+        stats->triangles = triTotal;
+        stats->vertices = vertexCount;
+        stats->objVertices = positionTotal;
+        stats->chunks = chunkCount;
+        stats->seconds = std::chrono::duration<double>(end - start).count();
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "sceneStructs.h"
+
+#define OBJ_CHUNKS_PER_THREAD 4
+#define OBJ_MIN_CHUNK_BYTES (256 * 1024)
+
+struct ObjLoadStats {
+    size_t bytes;
+    int triangles;
+    int vertices;      // after welding
+    int objVertices;   // `v` lines in the file
+    int chunks;
+    double seconds;
+};
+
+/**
+ * Loads an OBJ file as an indexed mesh on the shared thread pool. The mapped
+ * file is cut into line-aligned chunks that are scanned three times: count
+ * attributes and triangles, parse attributes, then parse faces. The counts
+ * give every chunk its output offsets, so no pass needs to synchronize.
+ * Polygons are triangulated the way tinyobj did: quads along the shorter
+ * diagonal, larger faces as a fan. Corners are then encoded (octahedral
+ * normals, half UVs) and welded in place, so corners whose encoded vertex
+ * is bit-identical share one entry of mesh->vertices. In a file with
+ * normals, corners without one take their triangle's geometric normal.
+ *
+ * Fills triCount, vertexCount, vertices, indices, hasNormals, hasUVs and
+ * boundingBox.
+ *
+ * @return  0 on success, -1 if the file cannot be read or is malformed.
+ */
+int loadObjMesh(const std::string& path, Mesh* mesh, ObjLoadStats* stats);
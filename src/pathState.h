@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include <cuda_fp16.h>
+#include "glm/glm.hpp"
+#include "sceneStructs.h"
+
+// Structure-of-arrays path state for the GPU wavefront loop. Paths keep
+// their slot for the whole iteration: stages load just the streams they
+// need into a PathSegment, and compaction and sorting move a list of slots
+// instead of the paths themselves.
+
+#define PATH_MAX_BOUNCES 255    // remainingBounces is stored in a byte
+
+/** Path throughput (PathSegment::color) in half precision. */
+struct HalfColor {
+    __half r;
+    __half g;
+    __half b;
+};
+
+/**
+ * One device array per field, indexed by path slot. Kernels take it by
+ * value.
+ */
+struct PathState {
+    glm::vec3* origin;
+    glm::vec3* direction;
+    HalfColor* throughput;
+    glm::vec3* radiance;
+    float* bsdfPdf;
+    int* pixelIndex;                    // global, so tiles need no offset
+    unsigned char* remainingBounces;    // the only stream compaction reads
+};
+
+__host__ __device__ inline HalfColor toHalfColor(const glm::vec3& c) {
+    HalfColor h;
+    h.r = __float2half(c.x);
+    h.g = __float2half(c.y);
+    h.b = __float2half(c.z);
+    return h;
+}
+
+__host__ __device__ inline glm::vec3 fromHalfColor(const HalfColor& h) {
+    return glm::vec3(__half2float(h.r), __half2float(h.g), __half2float(h.b));
+}
+
+/** Every field of the path in `slot`. */
+__host__ __device__ inline PathSegment loadPath(const PathState& paths, int slot) {
+    PathSegment p;
+    p.ray.origin = paths.origin[slot];
+    p.ray.direction = paths.direction[slot];
+    p.color = fromHalfColor(paths.throughput[slot]);
+    p.radiance = paths.radiance[slot];
+    p.bsdfPdf = paths.bsdfPdf[slot];
+    p.pixelIndex = paths.pixelIndex[slot];
+    p.remainingBounces = paths.remainingBounces[slot];
+    return p;
+}
+
+__host__ __device__ inline void storePath(const PathState& paths, int slot, const PathSegment& p) {
+    paths.origin[slot] = p.ray.origin;
+    paths.direction[slot] = p.ray.direction;
+    paths.throughput[slot] = toHalfColor(p.color);
+    paths.radiance[slot] = p.radiance;
+    paths.bsdfPdf[slot] = p.bsdfPdf;
+    paths.pixelIndex[slot] = p.pixelIndex;
+    paths.remainingBounces[slot] = (unsigned char)p.remainingBounces;
+}
+
+/** Bytes of device memory one path takes in a PathState. */
+inline size_t pathStateBytesPerPath() {
+    return 2 * sizeof(glm::vec3) + sizeof(HalfColor) + sizeof(glm::vec3) + sizeof(float) + sizeof(int)
+        + sizeof(unsigned char);
+}
+
+inline void allocPathState(PathState& paths, int count) {
+    cudaMalloc(&paths.origin, count * sizeof(glm::vec3));
+    cudaMalloc(&paths.direction, count * sizeof(glm::vec3));
+    cudaMalloc(&paths.throughput, count * sizeof(HalfColor));
+    cudaMalloc(&paths.radiance, count * sizeof(glm::vec3));
+    cudaMalloc(&paths.bsdfPdf, count * sizeof(float));
+    cudaMalloc(&paths.pixelIndex, count * sizeof(int));
+    cudaMalloc(&paths.remainingBounces, count * sizeof(unsigned char));
+}
+
+/** Frees the streams and nulls them; a no-op on a null PathState. */
+inline void freePathState(PathState& paths) {
+    cudaFree(paths.origin);
+    cudaFree(paths.direction);
+    cudaFree(paths.throughput);
+    cudaFree(paths.radiance);
+    cudaFree(paths.bsdfPdf);
+    cudaFree(paths.pixelIndex);
+    cudaFree(paths.remainingBounces);
+    paths = PathState();
+}
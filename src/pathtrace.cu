@@ -1,9 +1,15 @@
 #include <cstdio>
 #include <cuda.h>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <utility>
+#include <vector>
 #include <thrust/execution_policy.h>
-#include <thrust/random.h>
 #include <thrust/partition.h>
+#include <thrust/sequence.h>
+#include <thrust/transform_reduce.h>
+#include <thrust/functional.h>
 
 #include "sceneStructs.h"
 #include "scene.h"
@@ -13,6 +19,12 @@
 #include "pathtrace.h"
 #include "intersections.h"
 #include "interactions.h"
+#include "pathtraceCore.h"
+#include "pathState.h"
+#include "blueNoise.h"
+#include "common.h"
+#include "telemetry.h"
+#include "../stream_compaction/efficient.h"
 
 #include <device_launch_parameters.h>
 
@@ -21,14 +33,52 @@
 #define FILENAME (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 #define checkCUDAError(msg) checkCUDAErrorFn(msg, FILENAME, __LINE__)
 
-#define PIOVER4 0.78539816339
-#define PIOVER2 1.57079632679
 #define PI 3.14159265359
 
 #define ANTIALIASING 1
 #define CACHEINTERSECTIONS 0
+#define CACHE_PATTERNS 16	// camera sample patterns whose first hits are cached, used in turn
+#define CACHE_BUDGET_MB 256	// device memory the first-hit cache may use; fewer patterns if needed
 #define DOF 1
 #define SORTMATERIALS 1
+#define MATERIALQUEUES 1	// takes precedence over SORTMATERIALS
+#define SCENE_BVH 1
+#define EFFICIENTCOMPACTION 0	// our own stream compaction instead of thrust::partition
+#define NEXTEVENT 1	// sample the light list at diffuse vertices
+#define ADAPTIVESAMPLING 0	// stop tracing pixels whose relative error is below ADAPTIVE_THRESHOLD
+#define ADAPTIVE_THRESHOLD 0.02f
+#define ADAPTIVE_MIN_SAMPLES 16	// before a pixel may stop
+#define SOBOLSAMPLER 1	// Owen-scrambled Sobol samples instead of hashed white noise
+#define BLUENOISESAMPLER 0	// Sobol with blue-noise camera samples; takes precedence over SOBOLSAMPLER
+#define PATH_BUDGET_MB 0	// device memory the path pool may use; the image is traced in tiles that fit. 0 = no cap
+#define TILE_ORDER TILE_ORDER_SCANLINE
+#define PATH_POOL_MIN_CAPACITY 64	// one 8x8 tile, whatever the budget
+
+static PathTraceOptions options = defaultPathTraceOptions();
+
+PathTraceOptions defaultPathTraceOptions() {
+	PathTraceOptions o;
+	o.antialiasing = ANTIALIASING;
+	o.cacheIntersections = CACHEINTERSECTIONS;
+	o.cachePatterns = CACHE_PATTERNS;
+	o.cacheBudgetMB = CACHE_BUDGET_MB;
+	o.depthOfField = DOF;
+	o.shading = MATERIALQUEUES ? SHADING_QUEUES : SORTMATERIALS ? SHADING_SORTED : SHADING_UNSORTED;
+	o.compaction = EFFICIENTCOMPACTION ? COMPACTION_EFFICIENT : COMPACTION_THRUST;
+	o.sceneBVH = SCENE_BVH;
+	o.nextEventEstimation = NEXTEVENT;
+	o.adaptiveSampling = ADAPTIVESAMPLING;
+	o.adaptiveThreshold = ADAPTIVE_THRESHOLD;
+	o.sampler = BLUENOISESAMPLER ? SAMPLER_BLUE_NOISE : SOBOLSAMPLER ? SAMPLER_SOBOL : SAMPLER_RANDOM;
+	o.pathBudgetMB = PATH_BUDGET_MB;
+	o.tileOrder = TILE_ORDER;
+	o.pauseOnError = true;
+	return o;
+}
+
+void pathtraceSetOptions(const PathTraceOptions& newOptions) {
+	options = newOptions;
+}
 
 void checkCUDAErrorFn(const char* msg, const char* file, int line) {
 #if ERRORCHECK
@@ -44,32 +94,29 @@ void checkCUDAErrorFn(const char* msg, const char* file, int line) {
 	}
 	fprintf(stderr, ": %s: %s\n", msg, cudaGetErrorString(err));
 #  ifdef _WIN32
-	getchar();
+	if (options.pauseOnError) {
+		getchar();
+	}
 #  endif
 	exit(EXIT_FAILURE);
 #endif
 }
 
-__host__ __device__
-thrust::default_random_engine makeSeededRandomEngine(int iter, int index, int depth) {
-	int h = utilhash((1 << 31) | (depth << 22) | iter) ^ utilhash(index);
-	return thrust::default_random_engine(h);
-}
-
 //Kernel that writes the image to the OpenGL PBO directly.
 __global__ void sendImageToPBO(uchar4* pbo, glm::ivec2 resolution,
-	int iter, glm::vec3* image) {
+	const PixelStats* pixelStats, glm::vec3* image) {
 	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
 	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
 
 	if (x < resolution.x && y < resolution.y) {
 		int index = x + (y * resolution.x);
 		glm::vec3 pix = image[index];
+		float samples = fmaxf((float)pixelStats[index].samples, 1.0f);
 
 		glm::ivec3 color;
-		color.x = glm::clamp((int)(pix.x / iter * 255.0), 0, 255);
-		color.y = glm::clamp((int)(pix.y / iter * 255.0), 0, 255);
-		color.z = glm::clamp((int)(pix.z / iter * 255.0), 0, 255);
+		color.x = glm::clamp((int)(pix.x / samples * 255.0), 0, 255);
+		color.y = glm::clamp((int)(pix.y / samples * 255.0), 0, 255);
+		color.z = glm::clamp((int)(pix.z / samples * 255.0), 0, 255);
 
 		// Each thread writes one pixel location in the texture (textel)
 		pbo[index].w = 0;
@@ -83,12 +130,40 @@ static Scene* hst_scene = NULL;
 static GuiDataContainer* guiData = NULL;
 static glm::vec3* dev_image = NULL;
 static Geom* dev_geoms = NULL;
+static Mesh* dev_meshes = NULL;
 static Material* dev_materials = NULL;
-static PathSegment* dev_paths = NULL;
+static PathState dev_paths;	// the path pool: one slot per camera sample of the current tile
+static int* dev_activePaths = NULL;	// slots of the paths still bouncing, compacted every bounce
 static ShadeableIntersection* dev_intersections = NULL;
+static BVHNode* dev_sceneBVH = NULL;
+static int* dev_sceneGeomIndices = NULL;
 // TODO: static variables for device memory, any extra info you need, etc
 // ...
-static ShadeableIntersection* dev_cache_intersections = NULL;
+static ShadeableIntersection* dev_cache_intersections = NULL;	// first hits, pixelcount per pattern, tile by tile
+static int cachePatternCount = 0;	// patterns that fit the budget; 0 while the cache is off
+static std::vector<bool> cachedPatterns;	// which patterns have been traced for cachedCamera
+static Camera cachedCamera;
+static int* dev_shadingQueue = NULL;
+static int* dev_shadingCounts = NULL;
+static int* dev_activePaths_compacted = NULL;	// Efficient::compact target, swapped with dev_activePaths
+static int* dev_materialKeys = NULL;	// SHADING_SORTED: material id of each active path
+static StreamCompaction::Efficient::Workspace compactionWorkspace;
+static int* dev_terminationCounts = NULL;
+static Light* dev_lights = NULL;
+static ShadowRay* dev_shadowRays = NULL;	// one per path while next-event estimation is on
+static PixelStats* dev_pixelStats = NULL;	// per-pixel sample count and luminance mean/variance
+static int* dev_allPixels = NULL;		// adaptive sampling: 0 .. pixelcount - 1, compacted into
+static int* dev_activePixels = NULL;	// the pixels still above the error threshold
+static int activePixelCount = 0;
+static glm::vec3* dev_hostImage = NULL;	// adaptive sampling: image rescaled for the host copy
+static float* dev_blueNoise = NULL;	// SAMPLER_BLUE_NOISE: the camera samples' blue-noise tile
+static int poolCapacity = 0;	// slots in every per-path buffer
+static glm::ivec2 tileSize;
+static std::vector<glm::ivec2> tileOrigins;	// in tracing order
+static std::vector<int> tileCacheOffsets;	// where each tile's first hits start within a cache pattern
+static size_t deviceBytesBefore = 0;	// in use when pathtraceInit started
+static size_t peakDeviceBytes = 0;	// over deviceBytesBefore
+static long long sampleCount = 0;
 
 
 void InitDataContainer(GuiDataContainer* imGuiData)
@@ -96,85 +171,326 @@ void InitDataContainer(GuiDataContainer* imGuiData)
 	guiData = imGuiData;
 }
 
-void pathtraceInit(Scene* scene) {
-	hst_scene = scene;
-
-	const Camera& cam = hst_scene->state.camera;
-	const int pixelcount = cam.resolution.x * cam.resolution.y;
+/**
+ * How many camera patterns the first-hit cache holds: options.cachePatterns,
+ * or as many as options.cacheBudgetMB allows.
+ */
+static int firstHitCachePatterns(const PathTraceOptions& o, int pixelcount) {
+	if (!o.cacheIntersections || pixelcount <= 0) {
+		return 0;
+	}
+	size_t patternBytes = (size_t)pixelcount * sizeof(ShadeableIntersection);
+	size_t fit = ((size_t)o.cacheBudgetMB << 20) / patternBytes;
+	return (int)std::min<size_t>(o.cachePatterns, fit);
+}
 
-	cudaMalloc(&dev_image, pixelcount * sizeof(glm::vec3));
-	cudaMemset(dev_image, 0, pixelcount * sizeof(glm::vec3));
+size_t pathtraceBytesPerPath(const PathTraceOptions& o, bool sceneHasLights) {
+	size_t bytes = pathStateBytesPerPath() + sizeof(int) + sizeof(ShadeableIntersection);
+	if (o.shading == SHADING_QUEUES) {
+		bytes += sizeof(int);
+	}
+	if (o.shading == SHADING_SORTED) {
+		bytes += sizeof(int);
+	}
+	if (o.nextEventEstimation && sceneHasLights) {
+		bytes += sizeof(ShadowRay);
+	}
+	if (o.compaction == COMPACTION_EFFICIENT) {
+		bytes += 2 * sizeof(int);	// the second slot list and the scan's flags
+	}
+	return bytes;
+}
 
-	cudaMalloc(&dev_paths, pixelcount * sizeof(PathSegment));
+/** Interleaves the low 16 bits of x and y, x in the even bits. */
+static unsigned int mortonCode(unsigned int x, unsigned int y) {
+	unsigned int code = 0;
+	for (int bit = 0; bit < 16; bit++) {
+		code |= ((x >> bit) & 1u) << (2 * bit) | ((y >> bit) & 1u) << (2 * bit + 1);
+	}
+	return code;
+}
 
-	for (auto& geom : scene->geoms) {
-		if (geom.type == OBJ)
-		{
-			cudaMalloc(&geom.dev_triangles, geom.triCount * sizeof(Triangle));
-			cudaMemcpy(geom.dev_triangles, geom.triangles, geom.triCount * sizeof(Triangle), cudaMemcpyHostToDevice);
+/**
+ * Splits the image into tiles of at most `capacity` pixels and lists them
+ * in options.tileOrder. Tiles are as square as the capacity allows, in
+ * multiples of the 8x8 block that generates camera rays, unless one tile
+ * spans the image. Each tile's first hits are cached contiguously, in
+ * tracing order.
+ */
+static void layoutTiles(glm::ivec2 resolution, int capacity) {
+	if (capacity >= resolution.x * resolution.y) {
+		tileSize = resolution;
+	}
+	else {
+		int side = std::max(8, (int)sqrtf((float)capacity) / 8 * 8);
+		tileSize.x = std::min(resolution.x, side);
+		tileSize.y = std::min(resolution.y, std::max(8, capacity / tileSize.x / 8 * 8));
+	}
+	const int tilesX = (resolution.x + tileSize.x - 1) / tileSize.x;
+	const int tilesY = (resolution.y + tileSize.y - 1) / tileSize.y;
+
+	std::vector<glm::ivec2> tiles;
+	for (int ty = 0; ty < tilesY; ty++) {
+		for (int i = 0; i < tilesX; i++) {
+			int tx = options.tileOrder == TILE_ORDER_SERPENTINE && ty % 2 == 1 ? tilesX - 1 - i : i;
+			tiles.push_back(glm::ivec2(tx, ty));
 		}
 	}
-	
+	if (options.tileOrder == TILE_ORDER_MORTON) {
+		std::stable_sort(tiles.begin(), tiles.end(), [](const glm::ivec2& a, const glm::ivec2& b) {
+			return mortonCode(a.x, a.y) < mortonCode(b.x, b.y);
+		});
+	}
+
+	tileOrigins.clear();
+	tileCacheOffsets.clear();
+	int offset = 0;
+	for (const glm::ivec2& tile : tiles) {
+		glm::ivec2 origin = tile * tileSize;
+		glm::ivec2 extent = glm::min(tileSize, resolution - origin);
+		tileOrigins.push_back(origin);
+		tileCacheOffsets.push_back(offset);
+		offset += extent.x * extent.y;
+	}
+}
+
+/** Device memory in use now, over what was in use before pathtraceInit. */
+static void recordPeakMemory() {
+	size_t freeBytes = 0;
+	size_t totalBytes = 0;
+	cudaMemGetInfo(&freeBytes, &totalBytes);
+	size_t used = totalBytes - freeBytes;
+	if (used > deviceBytesBefore) {
+		peakDeviceBytes = std::max(peakDeviceBytes, used - deviceBytesBefore);
+	}
+}
+
+/** Whether cached first hits traced from `a` are still valid from `b`. */
+static bool sameCamera(const Camera& a, const Camera& b) {
+	return a.resolution == b.resolution && a.position == b.position && a.view == b.view
+		&& a.up == b.up && a.right == b.right && a.pixelLength == b.pixelLength
+		&& a.lensRadius == b.lensRadius && a.focalDist == b.focalDist;
+}
+
+/**
+ * Uploads what lives as long as the scene: meshes, geoms, BVHs, materials
+ * and the light list. Camera moves do not touch these.
+ */
+static void initSceneBuffers(Scene* scene) {
+	// Each mesh is uploaded once, however many OBJ geoms instance it.
+	// Shading reads the vertex and index buffers to resolve normals and UVs
+	// of a hit; the BVH path intersects the precomputed triangle blocks.
+	for (auto& mesh : scene->meshes) {
+		cudaMalloc(&mesh.dev_vertices, mesh.vertexCount * sizeof(MeshVertex));
+		cudaMemcpy(mesh.dev_vertices, mesh.vertices, mesh.vertexCount * sizeof(MeshVertex), cudaMemcpyHostToDevice);
+		cudaMalloc(&mesh.dev_indices, mesh.triCount * sizeof(glm::uvec3));
+		cudaMemcpy(mesh.dev_indices, mesh.indices, mesh.triCount * sizeof(glm::uvec3), cudaMemcpyHostToDevice);
+#if MESH_BVH
+		cudaMalloc(&mesh.dev_triBlocks, mesh.triBlockCount * sizeof(TriangleBlock));
+		cudaMemcpy(mesh.dev_triBlocks, mesh.triBlocks, mesh.triBlockCount * sizeof(TriangleBlock), cudaMemcpyHostToDevice);
+#endif
+		cudaMalloc(&mesh.dev_bvhNodes, mesh.bvhNodeCount * sizeof(BVHNode));
+		cudaMemcpy(mesh.dev_bvhNodes, mesh.bvhNodes, mesh.bvhNodeCount * sizeof(BVHNode), cudaMemcpyHostToDevice);
+	}
+
+	cudaMalloc(&dev_meshes, scene->meshes.size() * sizeof(Mesh));
+	cudaMemcpy(dev_meshes, scene->meshes.data(), scene->meshes.size() * sizeof(Mesh), cudaMemcpyHostToDevice);
+
 	cudaMalloc(&dev_geoms, scene->geoms.size() * sizeof(Geom));
 	cudaMemcpy(dev_geoms, scene->geoms.data(), scene->geoms.size() * sizeof(Geom), cudaMemcpyHostToDevice);
 
+	cudaMalloc(&dev_sceneBVH, scene->sceneBVH.size() * sizeof(BVHNode));
+	cudaMemcpy(dev_sceneBVH, scene->sceneBVH.data(), scene->sceneBVH.size() * sizeof(BVHNode), cudaMemcpyHostToDevice);
+
+	cudaMalloc(&dev_sceneGeomIndices, scene->sceneGeomIndices.size() * sizeof(int));
+	cudaMemcpy(dev_sceneGeomIndices, scene->sceneGeomIndices.data(), scene->sceneGeomIndices.size() * sizeof(int), cudaMemcpyHostToDevice);
+
 	cudaMalloc(&dev_materials, scene->materials.size() * sizeof(Material));
 	cudaMemcpy(dev_materials, scene->materials.data(), scene->materials.size() * sizeof(Material), cudaMemcpyHostToDevice);
 
-	cudaMalloc(&dev_intersections, pixelcount * sizeof(ShadeableIntersection));
-	cudaMemset(dev_intersections, 0, pixelcount * sizeof(ShadeableIntersection));
-
-	// TODO: initialize any extra device memeory you need
-#if CACHEINTERSECTIONS
-	cudaMalloc(&dev_cache_intersections, pixelcount * sizeof(ShadeableIntersection));
-	cudaMemset(dev_cache_intersections, 0, pixelcount * sizeof(ShadeableIntersection));
-#endif
-	checkCUDAError("pathtraceInit");
+	if (options.nextEventEstimation && !scene->lights.empty()) {
+		cudaMalloc(&dev_lights, scene->lights.size() * sizeof(Light));
+		cudaMemcpy(dev_lights, scene->lights.data(), scene->lights.size() * sizeof(Light), cudaMemcpyHostToDevice);
+	}
 }
 
-void pathtraceFree(Scene* scene) {
-	cudaFree(dev_image);  // no-op if dev_image is null
-	cudaFree(dev_paths);
-
-	//for (auto& geom : scene->geoms) {
-	//	for (int i = 0; i < geom.triCount; i++) {
-	//		//delete(geom.triangles);
-	//		cudaFree(geom.dev_triangles);
-	//	}
-	//}
+static void freeSceneBuffers(Scene* scene) {
+	// The triangle blocks are only allocated for the BVH path; otherwise
+	// they are still NULL
+	for (auto& mesh : scene->meshes) {
+		cudaFree(mesh.dev_vertices);
+		mesh.dev_vertices = NULL;
+		cudaFree(mesh.dev_indices);
+		mesh.dev_indices = NULL;
+		cudaFree(mesh.dev_triBlocks);
+		mesh.dev_triBlocks = NULL;
+		cudaFree(mesh.dev_bvhNodes);
+		mesh.dev_bvhNodes = NULL;
+	}
 
 	cudaFree(dev_geoms);
+	dev_geoms = NULL;
+	cudaFree(dev_meshes);
+	dev_meshes = NULL;
+	cudaFree(dev_sceneBVH);
+	dev_sceneBVH = NULL;
+	cudaFree(dev_sceneGeomIndices);
+	dev_sceneGeomIndices = NULL;
 	cudaFree(dev_materials);
+	dev_materials = NULL;
+	cudaFree(dev_lights);
+	dev_lights = NULL;
+}
+
+/** Allocates the buffers one render at this resolution works in. */
+static void initRenderBuffers(Scene* scene, int pixelcount) {
+	cudaMalloc(&dev_image, pixelcount * sizeof(glm::vec3));
+	cudaMalloc(&dev_pixelStats, pixelcount * sizeof(PixelStats));
+
+	if (scene->state.traceDepth > PATH_MAX_BOUNCES) {
+		fprintf(stderr, "Path state holds at most %d bounces\n", PATH_MAX_BOUNCES);
+		exit(EXIT_FAILURE);
+	}
+
+	// Per-path buffers hold one slot per pixel, or as many as fit
+	// options.pathBudgetMB, in which case pathtrace() reuses them tile by tile
+	poolCapacity = pixelcount;
+	if (options.pathBudgetMB > 0) {
+		size_t fit = ((size_t)options.pathBudgetMB << 20) / pathtraceBytesPerPath(options, !scene->lights.empty());
+		poolCapacity = (int)std::min<size_t>(pixelcount, std::max<size_t>(fit, PATH_POOL_MIN_CAPACITY));
+	}
+	layoutTiles(scene->state.camera.resolution, poolCapacity);
+	if (tileOrigins.size() > 1) {
+		printf("Path pool: %d paths in %d MB, %d tiles of %dx%d\n",
+			poolCapacity, options.pathBudgetMB, (int)tileOrigins.size(), tileSize.x, tileSize.y);
+	}
+
+	allocPathState(dev_paths, poolCapacity);
+	cudaMalloc(&dev_activePaths, poolCapacity * sizeof(int));
+
+	cudaMalloc(&dev_intersections, poolCapacity * sizeof(ShadeableIntersection));
+	cudaMemset(dev_intersections, 0, poolCapacity * sizeof(ShadeableIntersection));
+
+	// TODO: initialize any extra device memeory you need
+	cachePatternCount = firstHitCachePatterns(options, pixelcount);
+	if (options.cacheIntersections && cachePatternCount < options.cachePatterns) {
+		printf("First-hit cache: %d of %d patterns fit in %d MB\n",
+			cachePatternCount, options.cachePatterns, options.cacheBudgetMB);
+	}
+	if (cachePatternCount > 0) {
+		cudaMalloc(&dev_cache_intersections, (size_t)cachePatternCount * pixelcount * sizeof(ShadeableIntersection));
+		cachedPatterns.assign(cachePatternCount, false);
+		cachedCamera = scene->state.camera;
+	}
+	if (options.shading == SHADING_QUEUES) {
+		cudaMalloc(&dev_shadingQueue, poolCapacity * sizeof(int));
+		cudaMalloc(&dev_shadingCounts, MATERIAL_CLASS_COUNT * sizeof(int));
+	}
+	if (options.shading == SHADING_SORTED) {
+		cudaMalloc(&dev_materialKeys, poolCapacity * sizeof(int));
+	}
+	cudaMalloc(&dev_terminationCounts, TERMINATION_REASON_COUNT * sizeof(int));
+	if (dev_lights) {
+		cudaMalloc(&dev_shadowRays, poolCapacity * sizeof(ShadowRay));
+	}
+	if (options.compaction == COMPACTION_EFFICIENT) {
+		cudaMalloc(&dev_activePaths_compacted, poolCapacity * sizeof(int));
+		compactionWorkspace.reserve(poolCapacity);
+	}
+	if (options.adaptiveSampling) {
+		cudaMalloc(&dev_allPixels, pixelcount * sizeof(int));
+		thrust::sequence(thrust::device, dev_allPixels, dev_allPixels + pixelcount);
+		cudaMalloc(&dev_activePixels, pixelcount * sizeof(int));
+		cudaMalloc(&dev_hostImage, pixelcount * sizeof(glm::vec3));
+		compactionWorkspace.reserve(pixelcount);
+	}
+	if (options.sampler == SAMPLER_BLUE_NOISE) {
+		const std::vector<float>& blueNoise = blueNoiseTexture();
+		cudaMalloc(&dev_blueNoise, blueNoise.size() * sizeof(float));
+		cudaMemcpy(dev_blueNoise, blueNoise.data(), blueNoise.size() * sizeof(float), cudaMemcpyHostToDevice);
+	}
+}
+
+static void freeRenderBuffers() {
+	cudaFree(dev_image);  // no-op if dev_image is null
+	dev_image = NULL;
+	freePathState(dev_paths);
+	cudaFree(dev_activePaths);
+	dev_activePaths = NULL;
 	cudaFree(dev_intersections);
+	dev_intersections = NULL;
 	// TODO: clean up any extra device memory you created
 
-#if CACHEINTERSECTIONS
 	cudaFree(dev_cache_intersections);
-#endif
-
-	checkCUDAError("pathtraceFree");
+	dev_cache_intersections = NULL;
+	cachePatternCount = 0;
+	cachedPatterns.clear();
+	cudaFree(dev_shadingQueue);
+	dev_shadingQueue = NULL;
+	cudaFree(dev_shadingCounts);
+	dev_shadingCounts = NULL;
+	cudaFree(dev_activePaths_compacted);
+	dev_activePaths_compacted = NULL;
+	cudaFree(dev_materialKeys);
+	dev_materialKeys = NULL;
+	cudaFree(dev_terminationCounts);
+	dev_terminationCounts = NULL;
+	cudaFree(dev_shadowRays);
+	dev_shadowRays = NULL;
+	cudaFree(dev_pixelStats);
+	dev_pixelStats = NULL;
+	cudaFree(dev_allPixels);
+	dev_allPixels = NULL;
+	cudaFree(dev_activePixels);
+	dev_activePixels = NULL;
+	cudaFree(dev_hostImage);
+	dev_hostImage = NULL;
+	cudaFree(dev_blueNoise);
+	dev_blueNoise = NULL;
+	poolCapacity = 0;
+	tileOrigins.clear();
+	tileCacheOffsets.clear();
+	compactionWorkspace.release();
 }
 
-__host__ __device__ glm::vec2 concentricDiskSampling(const glm::vec2 &u) {
+void pathtraceInit(Scene* scene) {
+	hst_scene = scene;
 
-	//Map uniform random numbers to [-1, 1]
-	glm::vec2 uOffset = 2.f * u - glm::vec2(1.f, 1.f);
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
 
-	// Handle degeneracy at origin
-	if (uOffset.x == 0 && uOffset.y == 0)
-		return glm::vec2(0.f, 0.f);
+	size_t freeBytes = 0;
+	size_t totalBytes = 0;
+	cudaMemGetInfo(&freeBytes, &totalBytes);
+	deviceBytesBefore = totalBytes - freeBytes;
+	peakDeviceBytes = 0;
 
-	// Apply concentric mapping to point
-	float theta, r;
-	if (std::abs(uOffset.x) > std::abs(uOffset.y)) {
-		r = uOffset.x;
-		theta = PIOVER4 * (uOffset.y / uOffset.x);
-	}
-	else {
-		r = uOffset.y;
-		theta = PIOVER2 - PIOVER4 * (uOffset.x / uOffset.y);
+	initSceneBuffers(scene);
+	initRenderBuffers(scene, pixelcount);
+	pathtraceResetImage();
+	recordPeakMemory();
+	checkCUDAError("pathtraceInit");
+}
+
+void pathtraceResetImage() {
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+
+	cudaMemset(dev_image, 0, pixelcount * sizeof(glm::vec3));
+	cudaMemset(dev_pixelStats, 0, pixelcount * sizeof(PixelStats));
+	sampleCount = 0;
+	if (options.adaptiveSampling) {
+		cudaMemcpy(dev_activePixels, dev_allPixels, pixelcount * sizeof(int), cudaMemcpyDeviceToDevice);
+		activePixelCount = pixelcount;
 	}
-	return r * glm::vec2(cos(theta), sin(theta));
+	// The first-hit cache notices the camera change itself (sameCamera)
+	checkCUDAError("pathtraceResetImage");
+}
+
+void pathtraceFree(Scene* scene) {
+	freeRenderBuffers();
+	freeSceneBuffers(scene);
+	checkCUDAError("pathtraceFree");
 }
 
 /**
@@ -184,57 +500,40 @@ __host__ __device__ glm::vec2 concentricDiskSampling(const glm::vec2 &u) {
 * Antialiasing - add rays for sub-pixel sampling
 * motion blur - jitter rays "in time"
 * lens effect - jitter ray origin positions based on a lens
+*
+* One path per pixel of the tile at `tileOrigin`, in slots numbered row by
+* row across the tile.
 */
-__global__ void generateRayFromCamera(Camera cam, int iter, int traceDepth, PathSegment* pathSegments)
+__global__ void generateRayFromCamera(Camera cam, int iter, int traceDepth, bool antialiasing, bool dof,
+	int firstHitPatterns, int samplerType, const float* blueNoise, glm::ivec2 tileOrigin, glm::ivec2 tileExtent,
+	PathState paths, int* activePaths)
 {
 	int x = (blockIdx.x * blockDim.x) + threadIdx.x;
 	int y = (blockIdx.y * blockDim.y) + threadIdx.y;
-	thrust::default_random_engine rng = makeSeededRandomEngine(iter, x + y * cam.resolution.x, 0);
-	thrust::uniform_real_distribution<float> u01(0, 1);
-
-	float jitterX = u01(rng);
-	float jitterY = u01(rng);
-
-	if (x < cam.resolution.x && y < cam.resolution.y) {
-		int index = x + (y * cam.resolution.x);
-		PathSegment& segment = pathSegments[index];
-
-		segment.ray.origin = cam.position;
-		segment.color = glm::vec3(1.0f, 1.0f, 1.0f);
-
-		// TODO: implement antialiasing by jittering the ray
-#if ANTIALIASING
-			segment.ray.direction = glm::normalize(cam.view
-				- cam.right * cam.pixelLength.x * ((float)(x + jitterX) - (float)cam.resolution.x * 0.5f)
-				- cam.up * cam.pixelLength.y * ((float)(y + jitterY) - (float)cam.resolution.y * 0.5f)
-			);
-
-#else
-			segment.ray.direction = glm::normalize(cam.view
-				- cam.right * cam.pixelLength.x * ((float)(x) - (float)cam.resolution.x * 0.5f)
-				- cam.up * cam.pixelLength.y * ((float)(y) - (float)cam.resolution.y * 0.5f)
-			);
-#endif
 
-#if DOF
-		float lensRadius = cam.lensRadius;
-		glm::vec2 randomSample = glm::vec2(u01(rng), u01(rng));
-		if (lensRadius > 0) {
-			// Sample point on lens
-			glm::vec2 pLens = lensRadius / 2 * concentricDiskSampling(randomSample);
-
-			// Compute point on plane of focus
-			float ft = cam.focalDist; // glm::length(cam.lookAt - cam.position);
-			glm::vec3 pFocus = getPointOnRay(segment.ray, ft);
-
-			// Update ray for effect of lens
-			segment.ray.origin += pLens.x * cam.right + pLens.y * cam.up;
-			//segment.ray.origin += glm::vec3(pLens.x, pLens.y, 0);
-			segment.ray.direction = glm::normalize(pFocus - segment.ray.origin);
-		}
-#endif
-		segment.pixelIndex = index;
-		segment.remainingBounces = traceDepth;
+	if (x < tileExtent.x && y < tileExtent.y) {
+		int slot = x + (y * tileExtent.x);
+		PathSegment path;
+		generatePathSegment(cam, iter, tileOrigin.x + x, tileOrigin.y + y, traceDepth, antialiasing, dof,
+			firstHitPatterns, samplerType, blueNoise, path);
+		storePath(paths, slot, path);
+		activePaths[slot] = slot;
+	}
+}
+
+/** generateRayFromCamera for the listed pixels only, one path per pixel. */
+__global__ void generateRayForPixels(Camera cam, int iter, int traceDepth, bool antialiasing, bool dof,
+	int firstHitPatterns, int samplerType, const float* blueNoise, int num_pixels, const int* pixels, PathState paths,
+	int* activePaths)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_pixels) {
+		int pixel = pixels[idx];
+		PathSegment path;
+		generatePathSegment(cam, iter, pixel % cam.resolution.x, pixel / cam.resolution.x, traceDepth,
+			antialiasing, dof, firstHitPatterns, samplerType, blueNoise, path);
+		storePath(paths, idx, path);
+		activePaths[idx] = idx;
 	}
 }
 
@@ -245,9 +544,14 @@ __global__ void generateRayFromCamera(Camera cam, int iter, int traceDepth, Path
 __global__ void computeIntersections(
 	int depth
 	, int num_paths
-	, PathSegment* pathSegments
+	, const int* activePaths
+	, PathState paths
 	, Geom* geoms
 	, int geoms_size
+	, Mesh* meshes
+	, BVHNode* sceneBVH
+	, int* sceneGeomIndices
+	, bool useSceneBVH
 	, ShadeableIntersection* intersections
 )
 {
@@ -258,71 +562,23 @@ __global__ void computeIntersections(
 
 	if (path_index < num_paths)
 	{
-		PathSegment pathSegment = pathSegments[path_index];
-
-		float t;
-		glm::vec3 intersect_point;
-		glm::vec3 normal;
-		float t_min = FLT_MAX;
-		int hit_geom_index = -1;
-		bool outside = true;
-
-		glm::vec3 tmp_intersect;
-		glm::vec3 tmp_normal;
-
-		// naive parse through global geoms
-
-		for (int i = 0; i < geoms_size; i++)
-		{
-			Geom& geom = geoms[i];
-
-			if (geom.type == CUBE)
-			{
-				t = boxIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-			else if (geom.type == SPHERE)
-			{
-				t = sphereIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-			// TODO: add more intersection tests here... triangle? metaball? CSG?
-			else if (geom.type == OBJ)
-			{
-				t = objIntersectionTest(geom, geom.dev_triangles, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-			else if (geom.type == IMPLICIT)
-			{
-				t = implicitIntersectionTest(geom, pathSegment.ray, tmp_intersect, tmp_normal, outside);
-			}
-
-			// Compute the minimum t from the intersection tests to determine what
-			// scene geometry object was hit first.
-			if (t > 0.0f && t_min > t)
-			{
-				t_min = t;
-				hit_geom_index = i;
-				intersect_point = tmp_intersect;
-				normal = tmp_normal;
-			}
-		}
-
-		if (hit_geom_index == -1)
-		{
-			intersections[path_index].t = -1.0f;
-			pathSegments[path_index].remainingBounces = 0;
-		}
-		else
-		{
-			//The ray hits something
-			intersections[path_index].t = t_min;
-			intersections[path_index].materialId = geoms[hit_geom_index].materialid;
-			intersections[path_index].surfaceNormal = normal;
+		// Only the ray is read; a miss writes back the bounce count
+		int slot = activePaths[path_index];
+		PathSegment path;
+		path.ray.origin = paths.origin[slot];
+		path.ray.direction = paths.direction[slot];
+		path.remainingBounces = 1;
+		intersectPathSegment(path, geoms, geoms_size, meshes,
+			sceneBVH, sceneGeomIndices, useSceneBVH, intersections[slot]);
+		if (path.remainingBounces == 0) {
+			paths.remainingBounces[slot] = 0;
 		}
 	}
 }
 
 // LOOK: "fake" shader demonstrating what you might do with the info in
-// a ShadeableIntersection, as well as how to use thrust's random number
-// generator. Observe that since the thrust random number generator basically
+// a ShadeableIntersection, as well as how to use the sampler's random
+// numbers. Observe that since the random numbers basically
 // adds "noise" to the iteration, the image should start off noisy and get
 // cleaner as more iterations are computed.
 //
@@ -335,6 +591,8 @@ __global__ void shadeFakeMaterial(
 	, ShadeableIntersection* shadeableIntersections
 	, PathSegment* pathSegments
 	, Material* materials
+	, Geom* geoms
+	, Mesh* meshes
 )
 {
 	int idx = blockIdx.x * blockDim.x + threadIdx.x;
@@ -343,10 +601,9 @@ __global__ void shadeFakeMaterial(
 		ShadeableIntersection intersection = shadeableIntersections[idx];
 		if (intersection.t > 0.0f) { // if the intersection exists...
 		  // Set up the RNG
-		  // LOOK: this is how you use thrust's RNG! Please look at
-		  // makeSeededRandomEngine as well.
-			thrust::default_random_engine rng = makeSeededRandomEngine(iter, idx, 0);
-			thrust::uniform_real_distribution<float> u01(0, 1);
+		  // LOOK: this is how you draw random numbers! Please look at
+		  // sampler.h as well.
+			Sampler sampler = makeSampler(SAMPLER_RANDOM, idx, iter - 1, 0);
 
 			Material material = materials[intersection.materialId];
 			glm::vec3 materialColor = material.color;
@@ -359,9 +616,10 @@ __global__ void shadeFakeMaterial(
 			// like what you would expect from shading in a rasterizer like OpenGL.
 			// TODO: replace this! you should be able to start with basically a one-liner
 			else {
-				float lightTerm = glm::dot(intersection.surfaceNormal, glm::vec3(0.0f, 1.0f, 0.0f));
+				HitAttributes hit = resolveHitAttributes(intersection, pathSegments[idx].ray, geoms, meshes);
+				float lightTerm = glm::dot(hit.normal, glm::vec3(0.0f, 1.0f, 0.0f));
 				pathSegments[idx].color *= (materialColor * lightTerm) * 0.3f + ((1.0f - intersection.t * 0.02f) * materialColor) * 0.7f;
-				pathSegments[idx].color *= u01(rng); // apply some noise because why not
+				pathSegments[idx].color *= sample1D(sampler); // apply some noise because why not
 			}
 			// If there was no intersection, color the ray black.
 			// Lots of renderers use 4 channel color, RGBA, where A = alpha, often
@@ -377,88 +635,362 @@ __global__ void shadeFakeMaterial(
 
 __global__ void shadeWithMaterial(
 	int iter
+	, int samplerType
 	, int num_paths
+	, int rouletteBounces
+	, const int* activePaths
 	, ShadeableIntersection* shadeableIntersections
-	, PathSegment* pathSegments
+	, PathState paths
 	, Material* materials
+	, Geom* geoms
+	, Mesh* meshes
+	, LightList lights
+	, ShadowRay* shadowRays
 )
 {
 	int idx = blockIdx.x * blockDim.x + threadIdx.x;
 	if (idx < num_paths)
 	{
-		ShadeableIntersection intersection = shadeableIntersections[idx];
-		if (intersection.t > 0.0f) { // if the intersection exists...
-		  // Set up the RNG
-		  // LOOK: this is how you use thrust's RNG! Please look at
-		  // makeSeededRandomEngine as well.
-			thrust::default_random_engine rng = makeSeededRandomEngine(iter, idx, pathSegments->remainingBounces);
-			thrust::uniform_real_distribution<float> u01(0, 1);
-
-			Material material = materials[intersection.materialId];
-			glm::vec3 materialColor = material.color;
+		int slot = activePaths[idx];
+		PathSegment path = loadPath(paths, slot);
+		shadePathSegment(iter, samplerType, rouletteBounces,
+			shadeableIntersections[slot], path, materials, geoms, meshes,
+			lights, shadowRays ? shadowRays + slot : NULL);
+		storePath(paths, slot, path);
+	}
+}
 
-			// If the material indicates that the object was a light, "light" the ray
-			if (material.emittance > 0.0f) {
-				pathSegments[idx].color *= (materialColor * material.emittance);
-				pathSegments[idx].remainingBounces = 0;
-			}
-			// Otherwise, do some pseudo-lighting computation. This is actually more
-			// like what you would expect from shading in a rasterizer like OpenGL.
-			// TODO: replace this! you should be able to start with basically a one-liner
-			else {
-				// 2. Ideal diffused shading and bounce
-				// 3. Perfect specular reflection
-				glm::vec3 pointOfIntersection = getPointOnRay(pathSegments[idx].ray, intersection.t);
-				scatterRay(pathSegments[idx], pointOfIntersection, intersection.surfaceNormal, material, rng);
-			}
-			// If there was no intersection, color the ray black.
-			// Lots of renderers use 4 channel color, RGBA, where A = alpha, often
-			// used for opacity, in which case they can indicate "no opacity".
-			// This can be useful for post-processing and image compositing.
-		}
-		else {
-			pathSegments[idx].color = glm::vec3(0.0f);
-			pathSegments[idx].remainingBounces = 0;
+/** Traces the light samples taken by the shading stage, one thread per path. */
+__global__ void traceShadowRays(
+	int num_paths
+	, const int* activePaths
+	, const ShadowRay* shadowRays
+	, PathState paths
+	, Geom* geoms
+	, int geoms_size
+	, Mesh* meshes
+	, BVHNode* sceneBVH
+	, int* sceneGeomIndices
+	, bool useSceneBVH
+)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_paths)
+	{
+		int slot = activePaths[idx];
+		if (shadowRays[slot].maxT > 0.0f) {
+			PathSegment path;
+			path.radiance = paths.radiance[slot];
+			traceShadowRay(shadowRays[slot], path, geoms, geoms_size, meshes,
+				sceneBVH, sceneGeomIndices, useSceneBVH);
+			paths.radiance[slot] = path.radiance;
 		}
 	}
 }
 
+/**
+ * Telemetry: adds the paths that ended this bounce to `counts` by
+ * TerminationReason, histogrammed per block like countShadingBins. Every
+ * live path has the same remainingBounces, so a scattered path that ended
+ * before the last bounce lost at Russian roulette.
+ */
+__global__ void countTerminations(
+	int num_paths
+	, bool lastBounce
+	, const int* activePaths
+	, PathState paths
+	, const ShadeableIntersection* shadeableIntersections
+	, const Material* materials
+	, int* counts
+)
+{
+	__shared__ int blockCounts[TERMINATION_REASON_COUNT];
+	if (threadIdx.x < TERMINATION_REASON_COUNT) {
+		blockCounts[threadIdx.x] = 0;
+	}
+	__syncthreads();
+
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	int slot = idx < num_paths ? activePaths[idx] : 0;
+	if (idx < num_paths && paths.remainingBounces[slot] == 0) {
+		const ShadeableIntersection& intersection = shadeableIntersections[slot];
+		int reason = !(intersection.t > 0.0f) ? TERMINATED_MISS
+			: materials[intersection.materialId].emittance > 0.0f ? TERMINATED_LIGHT
+			: lastBounce ? TERMINATED_DEPTH : TERMINATED_ROULETTE;
+		atomicAdd(&blockCounts[reason], 1);
+	}
+	__syncthreads();
+
+	if (threadIdx.x < TERMINATION_REASON_COUNT && blockCounts[threadIdx.x] > 0) {
+		atomicAdd(&counts[threadIdx.x], blockCounts[threadIdx.x]);
+	}
+}
+
+/**
+ * Adds every path's shading bin to `counts`. Bins are counted in shared
+ * memory first, so each block does one global atomic per bin.
+ */
+__global__ void countShadingBins(
+	int num_paths
+	, const int* activePaths
+	, const ShadeableIntersection* shadeableIntersections
+	, const Material* materials
+	, int* counts
+)
+{
+	__shared__ int blockCounts[MATERIAL_CLASS_COUNT];
+	if (threadIdx.x < MATERIAL_CLASS_COUNT) {
+		blockCounts[threadIdx.x] = 0;
+	}
+	__syncthreads();
+
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_paths) {
+		atomicAdd(&blockCounts[shadingBin(shadeableIntersections[activePaths[idx]], materials)], 1);
+	}
+	__syncthreads();
+
+	if (threadIdx.x < MATERIAL_CLASS_COUNT && blockCounts[threadIdx.x] > 0) {
+		atomicAdd(&counts[threadIdx.x], blockCounts[threadIdx.x]);
+	}
+}
+
+/**
+ * Writes each active path's slot into its bin's queue. `cursors` starts at each
+ * queue's offset; a block reserves its range of every queue with one atomic,
+ * then threads write at their rank within the block.
+ */
+__global__ void fillShadingQueues(
+	int num_paths
+	, const int* activePaths
+	, const ShadeableIntersection* shadeableIntersections
+	, const Material* materials
+	, int* cursors
+	, int* queue
+)
+{
+	__shared__ int blockCounts[MATERIAL_CLASS_COUNT];
+	__shared__ int blockBase[MATERIAL_CLASS_COUNT];
+	if (threadIdx.x < MATERIAL_CLASS_COUNT) {
+		blockCounts[threadIdx.x] = 0;
+	}
+	__syncthreads();
+
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	int slot = 0;
+	int bin = 0;
+	int rank = 0;
+	if (idx < num_paths) {
+		slot = activePaths[idx];
+		bin = shadingBin(shadeableIntersections[slot], materials);
+		rank = atomicAdd(&blockCounts[bin], 1);
+	}
+	__syncthreads();
+
+	if (threadIdx.x < MATERIAL_CLASS_COUNT && blockCounts[threadIdx.x] > 0) {
+		blockBase[threadIdx.x] = atomicAdd(&cursors[threadIdx.x], blockCounts[threadIdx.x]);
+	}
+	__syncthreads();
+
+	if (idx < num_paths) {
+		queue[blockBase[bin] + rank] = slot;
+	}
+}
+
+/** shadeWithMaterial for one queue, all of whose paths are MATERIAL_CLASS. */
+template <int MATERIAL_CLASS>
+__global__ void shadeMaterialQueue(
+	int iter
+	, int samplerType
+	, int queue_size
+	, int rouletteBounces
+	, const int* queue
+	, ShadeableIntersection* shadeableIntersections
+	, PathState paths
+	, Material* materials
+	, Geom* geoms
+	, Mesh* meshes
+	, LightList lights
+	, ShadowRay* shadowRays
+)
+{
+	int i = blockIdx.x * blockDim.x + threadIdx.x;
+	if (i < queue_size)
+	{
+		int slot = queue[i];
+		PathSegment path = loadPath(paths, slot);
+		shadePathSegmentAs<MATERIAL_CLASS>(iter, samplerType, rouletteBounces,
+			shadeableIntersections[slot], path, materials, geoms, meshes,
+			lights, shadowRays ? shadowRays + slot : NULL);
+		storePath(paths, slot, path);
+	}
+}
+
+/**
+ * Shades through per-class queues instead of sorting: a counting sort on the
+ * class of each path's material gives an index queue per class, then each
+ * queue runs a kernel specialized for its class. Paths stay in their slots;
+ * only one int per path is written.
+ *
+ * buildShadingQueues does the counting sort into dev_shadingQueue, and
+ * shadeWithMaterialQueues launches the per-class kernels.
+ */
+static void buildShadingQueues(int num_paths, int blockSize1d,
+	int counts[MATERIAL_CLASS_COUNT], int offsets[MATERIAL_CLASS_COUNT]) {
+	dim3 numblocks = (num_paths + blockSize1d - 1) / blockSize1d;
+
+	cudaMemset(dev_shadingCounts, 0, MATERIAL_CLASS_COUNT * sizeof(int));
+	countShadingBins << <numblocks, blockSize1d >> > (num_paths, dev_activePaths, dev_intersections, dev_materials,
+		dev_shadingCounts);
+
+	cudaMemcpy(counts, dev_shadingCounts, MATERIAL_CLASS_COUNT * sizeof(int), cudaMemcpyDeviceToHost);
+	int offset = 0;
+	for (int c = 0; c < MATERIAL_CLASS_COUNT; c++) {
+		offsets[c] = offset;
+		offset += counts[c];
+	}
+	cudaMemcpy(dev_shadingCounts, offsets, MATERIAL_CLASS_COUNT * sizeof(int), cudaMemcpyHostToDevice);
+	fillShadingQueues << <numblocks, blockSize1d >> > (num_paths, dev_activePaths, dev_intersections, dev_materials,
+		dev_shadingCounts, dev_shadingQueue);
+}
+
+static void shadeWithMaterialQueues(int iter, int rouletteBounces, const LightList& lights,
+	const int counts[MATERIAL_CLASS_COUNT], const int offsets[MATERIAL_CLASS_COUNT], int blockSize1d) {
+
+#define SHADE_QUEUE(c) \
+	if (counts[c] > 0) { \
+		shadeMaterialQueue<c> << <(counts[c] + blockSize1d - 1) / blockSize1d, blockSize1d >> > ( \
+			iter, options.sampler, counts[c], rouletteBounces, dev_shadingQueue + offsets[c], dev_intersections, \
+			dev_paths, dev_materials, dev_geoms, dev_meshes, lights, dev_shadowRays); \
+	}
+	SHADE_QUEUE(MATERIAL_MISS)
+	SHADE_QUEUE(MATERIAL_EMISSIVE)
+	SHADE_QUEUE(MATERIAL_DIFFUSE)
+	SHADE_QUEUE(MATERIAL_REFLECTIVE)
+	SHADE_QUEUE(MATERIAL_REFRACTIVE)
+	SHADE_QUEUE(MATERIAL_PROCEDURAL)
+#undef SHADE_QUEUE
+	checkCUDAError("shade material queues");
+}
 
 // Add the current iteration's output to the overall image
-__global__ void finalGather(int nPaths, glm::vec3* image, PathSegment* iterationPaths)
+__global__ void finalGather(int nPaths, glm::vec3* image, PixelStats* pixelStats, PathState iterationPaths)
 {
 	int index = (blockIdx.x * blockDim.x) + threadIdx.x;
 
 	if (index < nPaths)
 	{
-		PathSegment iterationPath = iterationPaths[index];
-		image[iterationPath.pixelIndex] += iterationPath.color;
+		glm::vec3 sample = fromHalfColor(iterationPaths.throughput[index]) + iterationPaths.radiance[index];
+		int pixel = iterationPaths.pixelIndex[index];
+		image[pixel] += sample;
+		addPixelSample(pixelStats[pixel], sample);
+	}
+}
+
+/** Adaptive sampling: pixels that still need samples. */
+struct PixelUnconverged {
+	const PixelStats* pixelStats;
+	float threshold;
+
+	__host__ __device__ bool operator()(int pixel) const {
+		const PixelStats& stats = pixelStats[pixel];
+		return stats.samples < ADAPTIVE_MIN_SAMPLES || pixelRelativeError(stats) > threshold;
+	}
+};
+
+/**
+ * Rescales each pixel's sum to `iter` samples, so host code that divides
+ * the image by the iteration count sees each pixel's own mean.
+ */
+__global__ void rescaleToIterations(int pixelcount, int iter, const glm::vec3* image,
+	const PixelStats* pixelStats, glm::vec3* out)
+{
+	int index = (blockIdx.x * blockDim.x) + threadIdx.x;
+	if (index < pixelcount) {
+		int samples = pixelStats[index].samples;
+		out[index] = samples > 0 ? image[index] * ((float)iter / samples) : glm::vec3(0.0f);
 	}
 }
 
+/** Whether the path in a slot is still bouncing. */
 struct is_Terminated {
+	const unsigned char* remainingBounces;
+
 	__host__ __device__
-		bool operator()(const PathSegment& path) {
-		return path.remainingBounces;
+		bool operator()(int slot) const {
+		return remainingBounces[slot] > 0;
 	}
 };
 
-struct compareMaterialId {
-	__host__ __device__ bool operator()(const ShadeableIntersection& isect1, const ShadeableIntersection& isect2) {
-		return isect1.materialId < isect2.materialId;
+/** SHADING_SORTED: the sort key of each active path. */
+__global__ void gatherMaterialIds(int num_paths, const int* activePaths,
+	const ShadeableIntersection* shadeableIntersections, int* keys)
+{
+	int idx = blockIdx.x * blockDim.x + threadIdx.x;
+	if (idx < num_paths) {
+		keys[idx] = shadeableIntersections[activePaths[idx]].materialId;
 	}
-};
+}
 
 
+static PathTracer::Common::PerformanceTimer& timer()
+{
+	static PathTracer::Common::PerformanceTimer timer;
+	return timer;
+}
+
+/** Starts timing a stage of the loop when telemetry is being recorded. */
+static void startStage(bool telemetry) {
+	if (telemetry) {
+		timer().startGpuTimer();
+	}
+}
+
+/** @return  Milliseconds since startStage, or 0 without telemetry. */
+static float endStage(bool telemetry) {
+	if (!telemetry) {
+		return 0.0f;
+	}
+	timer().endGpuTimer();
+	return timer().getGpuElapsedTimeForPreviousOperation();
+}
+
+/**
+ * Adds one tile's bounce to the iteration's statistics for that depth;
+ * stage times and path counts are summed over the tiles.
+ */
+static void addBounceTelemetry(IterationTelemetry& iteration, const BounceTelemetry& bounce) {
+	if (iteration.bounces.size() <= bounce.depth) {
+		iteration.bounces.push_back(bounce);
+		return;
+	}
+	BounceTelemetry& sum = iteration.bounces[bounce.depth];
+	sum.pathsIn += bounce.pathsIn;
+	sum.pathsOut += bounce.pathsOut;
+	for (int r = 0; r < TERMINATION_REASON_COUNT; r++) {
+		sum.terminated[r] += bounce.terminated[r];
+	}
+	sum.intersectMs += bounce.intersectMs;
+	sum.sortMs += bounce.sortMs;
+	sum.shadeMs += bounce.shadeMs;
+	sum.compactMs += bounce.compactMs;
+}
+
 /**
  * Wrapper for the __global__ call that sets up the kernel calls and does a ton
  * of memory management
  */
-void pathtrace(uchar4* pbo, int frame, int iter) {
+int pathtrace(uchar4* pbo, int frame, int iter) {
 	const int traceDepth = hst_scene->state.traceDepth;
+	const int roulette = rouletteBounces(traceDepth, hst_scene->state.rouletteDepth);
 	const Camera& cam = hst_scene->state.camera;
 	const int pixelcount = cam.resolution.x * cam.resolution.y;
 
+	LightList lights;
+	lights.lights = dev_lights;
+	lights.lightCount = dev_shadowRays ? hst_scene->lights.size() : 0;
+	lights.geoms = dev_geoms;
+
 	// 2D block for generating ray from camera
 	const dim3 blockSize2d(8, 8);
 	const dim3 blocksPerGrid2d(
@@ -499,116 +1031,284 @@ void pathtrace(uchar4* pbo, int frame, int iter) {
 
 	// TODO: perform one iteration of path tracing
 
-	generateRayFromCamera << <blocksPerGrid2d, blockSize2d >> > (cam, iter, traceDepth, dev_paths);	// iter sample number
-	checkCUDAError("generate camera ray");
-
-	int depth = 0;
-	PathSegment* dev_path_end = dev_paths + pixelcount;
-	int num_paths = dev_path_end - dev_paths;	// initially number of rays cast is equal to pixel count and then it goes on decreasing after each round of stream compaction
-
-	// --- PathSegment Tracing Stage ---
-	// Shoot ray into scene, bounce between objects, push shading chunks
-	int new_num_paths = num_paths;
-	bool iterationComplete = false;
-	while (!iterationComplete) {
-
-		// dev_cache_intersections, set it to 0
-		// clean shading chunks
-		cudaMemset(dev_intersections, 0, pixelcount * sizeof(ShadeableIntersection));
-
-		// tracing
-		dim3 numblocksPathSegmentTracing = (new_num_paths + blockSize1d - 1) / blockSize1d;
-
-#if CACHEINTERSECTIONS
-		if (depth == 0 && iter == 1) {
-			computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-				depth
-				, new_num_paths
-				, dev_paths
-				, dev_geoms
-				, hst_scene->geoms.size()
-				, dev_cache_intersections
-				);
-		}
-		
-		if (depth == 0) {
-			cudaMemcpy(dev_intersections, dev_cache_intersections, pixelcount * sizeof(ShadeableIntersection), cudaMemcpyDeviceToDevice);
+	const bool telemetry = guiData != NULL && guiData->RecordTelemetry;
+	IterationTelemetry iterationStats = {};
+	iterationStats.iteration = iter;
+	auto wallStart = std::chrono::high_resolution_clock::now();
+
+	// The first-hit cache is only good for the camera it was traced from
+	const int cachePattern = cachePatternCount > 0 ? (iter - 1) % cachePatternCount : 0;
+	if (cachePatternCount > 0 && !sameCamera(cam, cachedCamera)) {
+		cachedPatterns.assign(cachePatternCount, false);
+		cachedCamera = cam;
+	}
+
+	// The path pool takes the image a tile at a time, in tileOrigins order.
+	// With adaptive sampling, only pixels still above the error threshold get
+	// a path, and the pool takes them poolCapacity at a time in pixel order.
+	const int pixelsToTrace = options.adaptiveSampling ? activePixelCount : pixelcount;
+	const int tileCount = options.adaptiveSampling ? (pixelsToTrace + poolCapacity - 1) / poolCapacity
+		: (int)tileOrigins.size();
+
+	// With the cache enabled, camera rays cycle through cachePatternCount
+	// fixed sample patterns, so each pattern's first bounce is traced once
+	// and then reused. It is laid out like the tiles' slots, which only
+	// line up with pixels while every pixel gets a path.
+	const bool useCache = cachePatternCount > 0 && pixelsToTrace == pixelcount;
+	const bool patternCached = useCache && cachedPatterns[cachePattern];
+
+	int raysTraced = 0;
+	for (int tile = 0; tile < tileCount; tile++) {
+		int num_paths;
+		size_t cacheOffset;
+		startStage(telemetry);
+		if (!options.adaptiveSampling) {
+			glm::ivec2 tileOrigin = tileOrigins[tile];
+			glm::ivec2 tileExtent = glm::min(tileSize, cam.resolution - tileOrigin);
+			const dim3 blocksPerTile(
+				(tileExtent.x + blockSize2d.x - 1) / blockSize2d.x,
+				(tileExtent.y + blockSize2d.y - 1) / blockSize2d.y);
+			generateRayFromCamera << <blocksPerTile, blockSize2d >> > (cam, iter, traceDepth,
+				options.antialiasing, options.depthOfField, cachePatternCount, options.sampler, dev_blueNoise,
+				tileOrigin, tileExtent, dev_paths, dev_activePaths);	// iter sample number
+			num_paths = tileExtent.x * tileExtent.y;
+			cacheOffset = tileCacheOffsets[tile];
 		}
 		else {
-			computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-				depth
-				, new_num_paths
-				, dev_paths
-				, dev_geoms
-				, hst_scene->geoms.size()
-				, dev_intersections
-				);
+			int first = tile * poolCapacity;
+			num_paths = std::min(poolCapacity, pixelsToTrace - first);
+			generateRayForPixels << <(num_paths + blockSize1d - 1) / blockSize1d, blockSize1d >> > (cam, iter, traceDepth,
+				options.antialiasing, options.depthOfField, cachePatternCount, options.sampler, dev_blueNoise, num_paths,
+				dev_activePixels + first, dev_paths, dev_activePaths);
+			cacheOffset = first;
 		}
-#else
-		computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
-			depth
-			, new_num_paths
-			, dev_paths
-			, dev_geoms
-			, hst_scene->geoms.size()
-			, dev_intersections
-			);
-#endif
+		checkCUDAError("generate camera ray");
+		iterationStats.generateMs += endStage(telemetry);
+
+		int depth = 0;
+
+		// --- PathSegment Tracing Stage ---
+		// Shoot ray into scene, bounce between objects, push shading chunks
+		int new_num_paths = num_paths;
+		bool tileComplete = false;
+		while (!tileComplete) {
+			BounceTelemetry bounceStats = {};
+			bounceStats.depth = depth;
+			bounceStats.pathsIn = new_num_paths;
+			startStage(telemetry);
+
+			// dev_cache_intersections, set it to 0
+			// clean shading chunks
+			cudaMemset(dev_intersections, 0, num_paths * sizeof(ShadeableIntersection));
+
+			// tracing
+			dim3 numblocksPathSegmentTracing = (new_num_paths + blockSize1d - 1) / blockSize1d;
+
+			bool cacheBounce = useCache && depth == 0;
+			ShadeableIntersection* dev_cached = dev_cache_intersections + (size_t)cachePattern * pixelcount + cacheOffset;
+			if (!cacheBounce || !patternCached) {
+				computeIntersections << <numblocksPathSegmentTracing, blockSize1d >> > (
+					depth
+					, new_num_paths
+					, dev_activePaths
+					, dev_paths
+					, dev_geoms
+					, hst_scene->geoms.size()
+					, dev_meshes
+					, dev_sceneBVH
+					, dev_sceneGeomIndices
+					, options.sceneBVH
+					, cacheBounce ? dev_cached : dev_intersections
+					);
+			}
+			if (cacheBounce) {
+				cudaMemcpy(dev_intersections, dev_cached, num_paths * sizeof(ShadeableIntersection), cudaMemcpyDeviceToDevice);
+			}
 
-		checkCUDAError("trace one bounce");
-		cudaDeviceSynchronize();
-		depth++;
-
-		// TODO:
-		// --- Shading Stage ---
-		// Shade path segments based on intersections and generate new rays by
-		// evaluating the BSDF.
-		// Start off with just a big kernel that handles all the different
-		// materials you have in the scenefile.
-		// TODO: compare between directly shading the path segments and shading
-		// path segments that have been reshuffled to be contiguous in memory.
-
-#if SORTMATERIALS
-		// 1. Sort ray by material
-		thrust::sort_by_key(thrust::device, dev_intersections, dev_intersections + new_num_paths, dev_paths, compareMaterialId());
-#endif
-		// 2. Ideal diffused shading and bounce and // 3. Perfect specular reflection
-		shadeWithMaterial << <numblocksPathSegmentTracing, blockSize1d >> > (
-			iter,
-			new_num_paths,
-			dev_intersections,
-			dev_paths,
-			dev_materials
-			);
-
-		// 4. Stream compaction
-		dev_path_end = thrust::partition(thrust::device, dev_paths, dev_paths + new_num_paths, is_Terminated());
-		new_num_paths = dev_path_end - dev_paths;
-
-		// 5. Cache first bounce
-
-		if (new_num_paths == 0){
-			iterationComplete = true;
-		}
+			checkCUDAError("trace one bounce");
+			cudaDeviceSynchronize();
+			bounceStats.intersectMs = endStage(telemetry);
+			raysTraced += new_num_paths;
+			depth++;
+
+			// TODO:
+			// --- Shading Stage ---
+			// Shade path segments based on intersections and generate new rays by
+			// evaluating the BSDF.
+			// Start off with just a big kernel that handles all the different
+			// materials you have in the scenefile.
+			// TODO: compare between directly shading the path segments and shading
+			// path segments that have been reshuffled to be contiguous in memory.
+
+			// 1. Sort ray by material
+			int queueCounts[MATERIAL_CLASS_COUNT];
+			int queueOffsets[MATERIAL_CLASS_COUNT];
+			startStage(telemetry);
+			if (options.shading == SHADING_QUEUES) {
+				buildShadingQueues(new_num_paths, blockSize1d, queueCounts, queueOffsets);
+			}
+			else if (options.shading == SHADING_SORTED) {
+				// Only the slot list is reordered; paths and intersections stay put
+				gatherMaterialIds << <numblocksPathSegmentTracing, blockSize1d >> > (new_num_paths, dev_activePaths,
+					dev_intersections, dev_materialKeys);
+				thrust::sort_by_key(thrust::device, dev_materialKeys, dev_materialKeys + new_num_paths, dev_activePaths);
+			}
+			bounceStats.sortMs = endStage(telemetry);
+
+			// 2. Ideal diffused shading and bounce and // 3. Perfect specular reflection
+			startStage(telemetry);
+			if (options.shading == SHADING_QUEUES) {
+				shadeWithMaterialQueues(iter, roulette, lights, queueCounts, queueOffsets, blockSize1d);
+			}
+			else {
+				shadeWithMaterial << <numblocksPathSegmentTracing, blockSize1d >> > (
+					iter,
+					options.sampler,
+					new_num_paths,
+					roulette,
+					dev_activePaths,
+					dev_intersections,
+					dev_paths,
+					dev_materials,
+					dev_geoms,
+					dev_meshes,
+					lights,
+					dev_shadowRays
+					);
+			}
+			// Shadow rays are counted as part of shading
+			if (dev_shadowRays) {
+				traceShadowRays << <numblocksPathSegmentTracing, blockSize1d >> > (
+					new_num_paths
+					, dev_activePaths
+					, dev_shadowRays
+					, dev_paths
+					, dev_geoms
+					, hst_scene->geoms.size()
+					, dev_meshes
+					, dev_sceneBVH
+					, dev_sceneGeomIndices
+					, options.sceneBVH
+					);
+			}
+			bounceStats.shadeMs = endStage(telemetry);
+
+			if (telemetry) {
+				cudaMemset(dev_terminationCounts, 0, TERMINATION_REASON_COUNT * sizeof(int));
+				countTerminations << <numblocksPathSegmentTracing, blockSize1d >> > (new_num_paths, depth == traceDepth,
+					dev_activePaths, dev_paths, dev_intersections, dev_materials, dev_terminationCounts);
+				cudaMemcpy(bounceStats.terminated, dev_terminationCounts,
+					TERMINATION_REASON_COUNT * sizeof(int), cudaMemcpyDeviceToHost);
+			}
 
-		if (guiData != NULL)
-		{
-			guiData->TracedDepth = depth;
+			// 4. Stream compaction of the slot list. Terminated paths keep their
+			// slots for finalGather, so nothing else moves.
+			startStage(telemetry);
+			is_Terminated alive = { dev_paths.remainingBounces };
+			if (options.compaction == COMPACTION_EFFICIENT) {
+				new_num_paths = StreamCompaction::Efficient::compact(new_num_paths, dev_activePaths_compacted, dev_activePaths,
+					alive, compactionWorkspace);
+				std::swap(dev_activePaths, dev_activePaths_compacted);
+			}
+			else {
+				int* dev_path_end = thrust::partition(thrust::device, dev_activePaths, dev_activePaths + new_num_paths, alive);
+				new_num_paths = dev_path_end - dev_activePaths;
+			}
+			bounceStats.compactMs = endStage(telemetry);
+			bounceStats.pathsOut = new_num_paths;
+			if (telemetry) {
+				addBounceTelemetry(iterationStats, bounceStats);
+			}
+
+			if (new_num_paths == 0){
+				tileComplete = true;
+			}
+
+			if (guiData != NULL)
+			{
+				guiData->TracedDepth = depth;
+			}
 		}
+
+		// Assemble this tile and apply it to the image
+		startStage(telemetry);
+		finalGather << <(num_paths + blockSize1d - 1) / blockSize1d, blockSize1d >> > (num_paths, dev_image,
+			dev_pixelStats, dev_paths);
+		sampleCount += num_paths;
+		iterationStats.gatherMs += endStage(telemetry);
+		recordPeakMemory();
+	}
+	if (useCache) {
+		cachedPatterns[cachePattern] = true;
 	}
 
-	// Assemble this iteration and apply it to the image
 	dim3 numBlocksPixels = (pixelcount + blockSize1d - 1) / blockSize1d;
-	finalGather << <numBlocksPixels, blockSize1d >> > (num_paths, dev_image, dev_paths);
+	startStage(telemetry);
+	if (options.adaptiveSampling) {
+		PixelUnconverged unconverged = { dev_pixelStats, options.adaptiveThreshold };
+		activePixelCount = StreamCompaction::Efficient::compact(pixelcount, dev_activePixels, dev_allPixels,
+			unconverged, compactionWorkspace);
+	}
+	iterationStats.gatherMs += endStage(telemetry);
+	if (guiData != NULL) {
+		guiData->ActivePixels = options.adaptiveSampling ? activePixelCount : pixelcount;
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 
 	// Send results to OpenGL buffer for rendering
-	sendImageToPBO << <blocksPerGrid2d, blockSize2d >> > (pbo, cam.resolution, iter, dev_image);
+	if (pbo != NULL) {
+		sendImageToPBO << <blocksPerGrid2d, blockSize2d >> > (pbo, cam.resolution, dev_pixelStats, dev_image);
+	}
 
 	// Retrieve image from GPU
-	cudaMemcpy(hst_scene->state.image.data(), dev_image,
+	const glm::vec3* imageForHost = dev_image;
+	if (options.adaptiveSampling) {
+		rescaleToIterations << <numBlocksPixels, blockSize1d >> > (pixelcount, iter, dev_image, dev_pixelStats,
+			dev_hostImage);
+		imageForHost = dev_hostImage;
+	}
+	cudaMemcpy(hst_scene->state.image.data(), imageForHost,
 		pixelcount * sizeof(glm::vec3), cudaMemcpyDeviceToHost);
 
 	checkCUDAError("pathtrace");
+	if (telemetry) {
+		iterationStats.totalMs = std::chrono::duration<float, std::milli>(
+			std::chrono::high_resolution_clock::now() - wallStart).count();
+		guiData->Telemetry.push_back(iterationStats);
+	}
+	return raysTraced;
+}
+
+long long pathtraceSampleCount() {
+	return sampleCount;
+}
+
+int pathtraceCachePatterns() {
+	return cachePatternCount;
+}
+
+PathPoolInfo pathtracePathPool() {
+	PathPoolInfo info;
+	info.capacity = poolCapacity;
+	info.tileSize = tileSize;
+	info.tiles = tileOrigins.size();
+	info.bytesPerPath = pathtraceBytesPerPath(options, dev_lights != NULL);
+	info.poolBytes = (size_t)poolCapacity * info.bytesPerPath;
+	info.peakDeviceBytes = peakDeviceBytes;
+	return info;
+}
+
+struct SquaredPixelError {
+	__host__ __device__ float operator()(const PixelStats& stats) const {
+		return squaredPixelError(stats);
+	}
+};
+
+float pathtraceErrorEstimate() {
+	const Camera& cam = hst_scene->state.camera;
+	const int pixelcount = cam.resolution.x * cam.resolution.y;
+	float sum = thrust::transform_reduce(thrust::device, dev_pixelStats, dev_pixelStats + pixelcount,
+		SquaredPixelError(), 0.0f, thrust::plus<float>());
+	return sqrtf(sum / pixelcount);
 }
@@ -2,8 +2,113 @@
 
 #include <vector>
 #include "scene.h"
+#include "sampler.h"
+
+// How paths are ordered for the shading stage of each bounce
+enum ShadingMode {
+    SHADING_UNSORTED,   // shade paths where they are
+    SHADING_SORTED,     // sort the active path slots by material id first
+    SHADING_QUEUES      // one index queue per material class (counting sort)
+};
+
+// How terminated paths are removed from the active slot list after each bounce
+enum CompactionMode {
+    COMPACTION_THRUST,      // thrust::partition in place
+    COMPACTION_EFFICIENT    // StreamCompaction::Efficient::compact into a second list
+};
+
+// Order an iteration's tiles are traced in when the path pool is smaller
+// than the image
+enum TileOrder {
+    TILE_ORDER_SCANLINE,    // rows of tiles, each left to right
+    TILE_ORDER_SERPENTINE,  // rows of tiles in alternating directions, so consecutive tiles touch
+    TILE_ORDER_MORTON       // Z-order curve over the tile grid, so runs of tiles stay compact
+};
+
+// Runtime feature switches. Defaults come from the #defines at the top of
+// pathtrace.cu; the batch renderer overrides them from the command line.
+struct PathTraceOptions {
+    bool antialiasing;
+    bool cacheIntersections;    // reuse the first bounce of each camera sample pattern
+    int cachePatterns;          // stratified patterns the camera cycles through while caching
+    int cacheBudgetMB;          // cap on the cache's device memory; fewer patterns if it is exceeded
+    bool depthOfField;
+    int shading;            // ShadingMode
+    int compaction;         // CompactionMode
+    bool sceneBVH;
+    bool nextEventEstimation;   // shadow rays to the light list at diffuse vertices, MIS-weighted
+    bool adaptiveSampling;      // only trace pixels whose relative error is above adaptiveThreshold
+    float adaptiveThreshold;
+    int sampler;            // SamplerType
+    int pathBudgetMB;       // cap on the path pool's device memory; the image is traced in tiles that fit. 0 = no cap
+    int tileOrder;          // TileOrder
+    bool pauseOnError;      // wait for a key before exiting on a CUDA error (Windows)
+};
+
+PathTraceOptions defaultPathTraceOptions();
+void pathtraceSetOptions(const PathTraceOptions& options);
 
 void InitDataContainer(GuiDataContainer* guiData);
+
+/**
+ * Uploads the scene (meshes, geoms, BVHs, materials, lights), which stays
+ * resident until pathtraceFree, and allocates the buffers for rendering it
+ * at the camera's resolution: the image and per-pixel statistics, and a
+ * pool of per-path buffers with a slot per pixel, or as many as
+ * options.pathBudgetMB holds, in which case each iteration is traced tile
+ * by tile.
+ */
 void pathtraceInit(Scene *scene);
+
+/** Frees everything pathtraceInit allocated, each mesh's arrays included. */
 void pathtraceFree(Scene* scene);
-void pathtrace(uchar4 *pbo, int frame, int iteration);
+
+/**
+ * Starts the render over, e.g. after the camera moved: clears the image
+ * and per-pixel statistics only. The resolution must not have changed.
+ */
+void pathtraceResetImage();
+
+/**
+ * Traces one sample per pixel and accumulates it. `pbo` may be NULL when
+ * there is no display to update.
+ *
+ * @return  Number of rays traced (path segments summed over all bounces).
+ */
+int pathtrace(uchar4 *pbo, int frame, int iteration);
+
+/**
+ * Camera samples taken since pathtraceInit. Fewer than iterations times
+ * pixels once adaptive sampling retires converged pixels.
+ */
+long long pathtraceSampleCount();
+
+/** Camera patterns in the first-hit cache since pathtraceInit; 0 if it is off. */
+int pathtraceCachePatterns();
+
+/** How pathtraceInit laid out the path pool and the tiles it is reused for. */
+struct PathPoolInfo {
+    int capacity;           // paths in flight at once
+    glm::ivec2 tileSize;    // the whole image when one tile fits
+    int tiles;              // per iteration; with adaptive sampling, at most this many chunks of pixels
+    size_t bytesPerPath;    // of every per-path buffer together
+    size_t poolBytes;       // capacity * bytesPerPath
+    size_t peakDeviceBytes; // most device memory in use after pathtraceInit and after each tile, over what
+                            // was in use before pathtraceInit
+};
+
+PathPoolInfo pathtracePathPool();
+
+/**
+ * Device memory one path of the pool takes with these options: its path
+ * state, slot, intersection, and the shading, shadow ray and compaction
+ * buffers the options turn on. Temporary storage thrust allocates inside
+ * sorts and partitions is not included.
+ */
+size_t pathtraceBytesPerPath(const PathTraceOptions& options, bool sceneHasLights);
+
+/**
+ * Relative RMS error of the image so far, from each pixel's luminance
+ * variance (see squaredPixelError). Reduces over every pixel on the device.
+ */
+float pathtraceErrorEstimate();
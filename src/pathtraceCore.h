@@ -0,0 +1,379 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "sceneStructs.h"
+#include "intersections.h"
+#include "interactions.h"
+#include "lights.h"
+#include "sampler.h"
+
+// Per-path stages of the wavefront loop. The CUDA kernels in pathtrace.cu
+// run them one thread per path; the CPU backend runs them per tile.
+
+#define PIOVER4 0.78539816339
+#define PIOVER2 1.57079632679
+#define PIXEL_ERROR_MIN_LUMINANCE 0.01f	// darker pixels are judged against this instead of their mean
+
+/**
+ * Running luminance statistics of one pixel (Welford), kept beside the
+ * image sums. `samples` is also what the pixel's sum is normalized by.
+ */
+struct PixelStats {
+    float mean;
+    float m2;           // sum of squared deviations from the mean
+    int samples;
+};
+
+/**
+ * The scene's light list for next-event estimation. A lightCount of 0 turns
+ * it off: paths then only gather light by hitting it.
+ */
+struct LightList {
+    const Light* lights;
+    int lightCount;
+    const Geom* geoms;      // all geoms, indexed by Light::geomId
+};
+
+__host__ __device__ inline glm::vec2 concentricDiskSampling(const glm::vec2 &u) {
+
+    //Map uniform random numbers to [-1, 1]
+    glm::vec2 uOffset = 2.f * u - glm::vec2(1.f, 1.f);
+
+    // Handle degeneracy at origin
+    if (uOffset.x == 0 && uOffset.y == 0)
+        return glm::vec2(0.f, 0.f);
+
+    // Apply concentric mapping to point
+    float theta, r;
+    if (fabsf(uOffset.x) > fabsf(uOffset.y)) {
+        r = uOffset.x;
+        theta = PIOVER4 * (uOffset.y / uOffset.x);
+    }
+    else {
+        r = uOffset.y;
+        theta = PIOVER2 - PIOVER4 * (uOffset.x / uOffset.y);
+    }
+    return r * glm::vec2(cos(theta), sin(theta));
+}
+
+/** `i` with its base-`base` digits mirrored about the radix point, in [0, 1). */
+__host__ __device__ inline float radicalInverse(int base, int i) {
+    float inverseBase = 1.0f / base;
+    float scale = inverseBase;
+    float result = 0.0f;
+    while (i > 0) {
+        result += (i % base) * scale;
+        i /= base;
+        scale *= inverseBase;
+    }
+    return result;
+}
+
+/**
+ * Sub-pixel jitter and lens sample of camera pattern `pattern` out of
+ * `patternCount`. The jitters form a Hammersley set and the lens samples
+ * a Halton set, so any run of patternCount iterations covers the pixel
+ * and the lens evenly. Each pixel shifts the whole set by its own random
+ * offset (Cranley-Patterson rotation) so neighbours do not alias.
+ */
+__host__ __device__ inline void firstHitPatternSample(int pattern, int patternCount, int index,
+    glm::vec2& jitter, glm::vec2& lens) {
+    // Keyed by a sample index no iteration reaches, so the offsets are
+    // independent of every sample the render takes
+    const unsigned int offsetIndex = 0xffffffffu;
+    glm::vec2 jitterOffset = glm::vec2(randomSample(index, offsetIndex, 0), randomSample(index, offsetIndex, 1));
+    glm::vec2 lensOffset = glm::vec2(randomSample(index, offsetIndex, 2), randomSample(index, offsetIndex, 3));
+
+    jitter = glm::fract(glm::vec2((pattern + 0.5f) / patternCount, radicalInverse(2, pattern)) + jitterOffset);
+    lens = glm::fract(glm::vec2(radicalInverse(3, pattern), radicalInverse(5, pattern)) + lensOffset);
+}
+
+/**
+ * Camera ray for pixel (x, y) of sample `iter`, jittered inside the pixel
+ * when antialiasing and across the lens when depth of field is on. The
+ * jitter and lens sample are the camera dimensions of a `samplerType`
+ * sampler; SAMPLER_BLUE_NOISE reads them from the `blueNoise` tile, which
+ * may be NULL for the other types.
+ *
+ * @param firstHitPatterns  If positive, the jitter and lens sample are
+ *                          pattern (iter - 1) mod firstHitPatterns of
+ *                          firstHitPatternSample rather than random, so
+ *                          the first intersection repeats with the pattern.
+ */
+__host__ __device__ inline void generatePathSegment(const Camera& cam, int iter, int x, int y,
+    int traceDepth, bool antialiasing, bool dof, int firstHitPatterns, int samplerType, const float* blueNoise,
+    PathSegment& segment) {
+    int index = x + (y * cam.resolution.x);
+    glm::vec2 jitter;
+    glm::vec2 lensSample;
+    if (firstHitPatterns > 0) {
+        firstHitPatternSample((iter - 1) % firstHitPatterns, firstHitPatterns, index, jitter, lensSample);
+    }
+    else if (samplerType == SAMPLER_BLUE_NOISE) {
+        glm::vec4 u = blueNoiseCameraSample(blueNoise, x, y, iter - 1);
+        jitter = glm::vec2(u.x, u.y);
+        lensSample = glm::vec2(u.z, u.w);
+    }
+    else {
+        Sampler sampler = cameraSampler(samplerType, index, iter);
+        jitter = sample2D(sampler);
+        lensSample = sample2D(sampler);
+    }
+    float jitterX = jitter.x;
+    float jitterY = jitter.y;
+
+    segment.ray.origin = cam.position;
+    segment.color = glm::vec3(1.0f, 1.0f, 1.0f);
+    segment.radiance = glm::vec3(0.0f);
+    segment.bsdfPdf = 0.0f;
+
+    // TODO: implement antialiasing by jittering the ray
+    if (!antialiasing) {
+        jitterX = 0.f;
+        jitterY = 0.f;
+    }
+    segment.ray.direction = glm::normalize(cam.view
+        - cam.right * cam.pixelLength.x * ((float)(x + jitterX) - (float)cam.resolution.x * 0.5f)
+        - cam.up * cam.pixelLength.y * ((float)(y + jitterY) - (float)cam.resolution.y * 0.5f)
+    );
+
+    float lensRadius = cam.lensRadius;
+    if (dof && lensRadius > 0) {
+        // Sample point on lens
+        glm::vec2 pLens = lensRadius / 2 * concentricDiskSampling(lensSample);
+
+        // Compute point on plane of focus
+        float ft = cam.focalDist; // glm::length(cam.lookAt - cam.position);
+        glm::vec3 pFocus = getPointOnRay(segment.ray, ft);
+
+        // Update ray for effect of lens
+        segment.ray.origin += pLens.x * cam.right + pLens.y * cam.up;
+        segment.ray.direction = glm::normalize(pFocus - segment.ray.origin);
+    }
+    segment.pixelIndex = index;
+    segment.remainingBounces = traceDepth;
+}
+
+/**
+ * Closest hit for one path, through the scene BVH or by testing every geom.
+ * A miss terminates the path.
+ */
+__host__ __device__ inline void intersectPathSegment(PathSegment& pathSegment,
+    Geom* geoms, int geoms_size, const Mesh* meshes, BVHNode* sceneBVH, int* sceneGeomIndices,
+    bool useSceneBVH, ShadeableIntersection& intersection) {
+    // naive parse through global geoms unless the scene BVH is enabled
+    int hit_geom_index = useSceneBVH
+        ? sceneBVHIntersectionTest(geoms, meshes, sceneBVH, sceneGeomIndices, pathSegment.ray, intersection)
+        : sceneLinearIntersectionTest(geoms, geoms_size, meshes, pathSegment.ray, intersection);
+
+    if (hit_geom_index == -1)
+    {
+        intersection.t = -1.0f;
+        pathSegment.remainingBounces = 0;
+    }
+    else
+    {
+        //The ray hits something
+        intersection.materialId = geoms[hit_geom_index].materialid;
+    }
+}
+
+__host__ __device__ inline float luminance(const glm::vec3& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+__host__ __device__ inline void addPixelSample(PixelStats& stats, const glm::vec3& sample) {
+    float l = luminance(sample);
+    stats.samples++;
+    float delta = l - stats.mean;
+    stats.mean += delta / stats.samples;
+    stats.m2 += delta * (l - stats.mean);
+}
+
+/**
+ * Standard error of the pixel's mean luminance relative to that mean (or
+ * to PIXEL_ERROR_MIN_LUMINANCE for dark pixels). FLT_MAX below two samples.
+ */
+__host__ __device__ inline float pixelRelativeError(const PixelStats& stats) {
+    if (stats.samples < 2) {
+        return FLT_MAX;
+    }
+    float variance = stats.m2 / (stats.samples - 1);
+    return sqrtf(variance / stats.samples) / fmaxf(stats.mean, PIXEL_ERROR_MIN_LUMINANCE);
+}
+
+/**
+ * Square of pixelRelativeError for one pixel, summed by the framebuffer
+ * estimates; infinite below two samples.
+ */
+__host__ __device__ inline float squaredPixelError(const PixelStats& stats) {
+    float e = pixelRelativeError(stats);
+    return e * e;
+}
+
+/** Shading queue a path goes to: its material's class, or MATERIAL_MISS. */
+__host__ __device__ inline int shadingBin(const ShadeableIntersection& intersection, const Material* materials) {
+    return intersection.t > 0.0f ? materialClassOf(materials[intersection.materialId]) : MATERIAL_MISS;
+}
+
+/**
+ * Value of remainingBounces, after scattering, from which on shading plays
+ * Russian roulette: once `rouletteDepth` bounces are done. -1 when
+ * rouletteDepth is negative (off), which no live path matches.
+ */
+__host__ __device__ inline int rouletteBounces(int traceDepth, int rouletteDepth) {
+    return rouletteDepth < 0 ? -1 : traceDepth - rouletteDepth;
+}
+
+/**
+ * Russian roulette on `u` in [0, 1): the path survives with probability
+ * equal to its largest throughput component, capped at 0.95, and is
+ * reweighted by the inverse so the estimate stays unbiased. Otherwise it
+ * ends and contributes nothing.
+ */
+__host__ __device__ inline void russianRoulette(PathSegment& pathSegment, float u) {
+    const glm::vec3& throughput = pathSegment.color;
+    float survival = fminf(fmaxf(throughput.x, fmaxf(throughput.y, throughput.z)), 0.95f);
+    if (u < survival) {
+        pathSegment.color /= survival;
+    }
+    else {
+        pathSegment.color = glm::vec3(0.0f);
+        pathSegment.remainingBounces = 0;
+    }
+}
+
+/**
+ * Next-event estimation at a diffuse vertex: picks a light uniformly and a
+ * point on it by area, and stores the contribution it makes if unoccluded,
+ * weighted by the power heuristic against sampling the BSDF, in `shadowRay`.
+ * At the path's last vertex the BSDF direction is never traced, so the light
+ * sample takes the full weight there.
+ */
+__host__ __device__ inline void sampleDirectLight(const LightList& lights, const Material* materials,
+    const PathSegment& pathSegment, glm::vec3 point, glm::vec3 normal, const Material& material,
+    Sampler& sampler, ShadowRay& shadowRay) {
+    int pick = min((int)(sample1D(sampler) * lights.lightCount), lights.lightCount - 1);
+    const Light& light = lights.lights[pick];
+    const Geom& geom = lights.geoms[light.geomId];
+    glm::vec3 lightPoint;
+    glm::vec3 lightNormal;
+    float face = sample1D(sampler);
+    glm::vec3 u(face, sample2D(sampler));
+    sampleLightSurface(geom, u, lightPoint, lightNormal);
+
+    glm::vec3 toLight = lightPoint - point;
+    float distance = glm::length(toLight);
+    glm::vec3 wi = toLight / distance;
+    float cosSurface = glm::dot(normal, wi);
+    float cosLight = -glm::dot(lightNormal, wi);
+    if (cosSurface <= 0.0f || cosLight <= 0.0f) {
+        return;
+    }
+
+    float lightPdf = lightSolidAnglePdf(lights.lightCount, light.area, distance, cosLight);
+    float bsdfPdf = cosSurface / PI;
+    float misWeight = pathSegment.remainingBounces > 1 ? powerHeuristic(lightPdf, bsdfPdf) : 1.0f;
+    const Material& emitter = materials[geom.materialid];
+    glm::vec3 bsdf = material.color / PI;
+    shadowRay.ray.origin = point + 0.001f * wi;
+    shadowRay.ray.direction = wi;
+    shadowRay.maxT = distance * 0.999f - 0.002f;
+    shadowRay.radiance = pathSegment.color * bsdf * emitter.color * emitter.emittance
+        * (cosSurface * misWeight / lightPdf);
+}
+
+/**
+ * Shadow ray stage: adds the path's light sample to its radiance unless
+ * something lies between the path vertex and the light.
+ */
+__host__ __device__ inline void traceShadowRay(const ShadowRay& shadowRay, PathSegment& pathSegment,
+    Geom* geoms, int geoms_size, const Mesh* meshes, BVHNode* sceneBVH, int* sceneGeomIndices,
+    bool useSceneBVH) {
+    if (!(shadowRay.maxT > 0.0f)) {
+        return;
+    }
+    ShadeableIntersection hit;
+    int hit_geom_index = useSceneBVH
+        ? sceneBVHIntersectionTest(geoms, meshes, sceneBVH, sceneGeomIndices, shadowRay.ray, hit)
+        : sceneLinearIntersectionTest(geoms, geoms_size, meshes, shadowRay.ray, hit);
+    if (hit_geom_index == -1 || hit.t >= shadowRay.maxT) {
+        pathSegment.radiance += shadowRay.radiance;
+    }
+}
+
+/**
+ * Shades one path: lights end it, other materials scatter it, misses turn
+ * it black. Samples come from a `samplerType` sampler keyed by the path's
+ * own pixel and remaining bounces, so the result does not depend on where
+ * the path sits in the wavefront. Scattered paths with at most
+ * `rouletteBounces` bounces left go through Russian roulette.
+ *
+ * With next-event estimation on (`shadowRay` not NULL, lights.lightCount
+ * > 0), diffuse vertices also sample a light into `shadowRay`, and light
+ * found by BSDF sampling is weighted against that sample.
+ *
+ * The hit's normal is resolved from `geoms` and `meshes` here, and only
+ * for the paths that use it.
+ *
+ * MATERIAL_CLASS is the path's shadingBin when it is known, which lets the
+ * compiler drop the tests and branches that cannot apply.
+ */
+template <int MATERIAL_CLASS>
+__host__ __device__ inline void shadePathSegmentAs(int iter, int samplerType, int rouletteBounces,
+    const ShadeableIntersection& intersection, PathSegment& pathSegment, const Material* materials,
+    const Geom* geoms, const Mesh* meshes, const LightList& lights, ShadowRay* shadowRay) {
+    const bool generic = MATERIAL_CLASS == MATERIAL_GENERIC;
+    if (shadowRay) {
+        shadowRay->maxT = 0.0f;
+    }
+    if (MATERIAL_CLASS == MATERIAL_MISS || (generic && !(intersection.t > 0.0f))) {
+        // If there was no intersection, color the ray black.
+        pathSegment.color = glm::vec3(0.0f);
+        pathSegment.remainingBounces = 0;
+        return;
+    }
+
+    Material material = materials[intersection.materialId];
+    glm::vec3 materialColor = material.color;
+
+    // If the material indicates that the object was a light, "light" the ray
+    if (MATERIAL_CLASS == MATERIAL_EMISSIVE || (generic && material.emittance > 0.0f)) {
+        // MIS weight if the vertex the path came from also sampled this light
+        float misWeight = 1.0f;
+        if (pathSegment.bsdfPdf > 0.0f && isSampledLightShape(geoms[intersection.geomId])) {
+            const Geom& geom = geoms[intersection.geomId];
+            HitAttributes hit = resolveHitAttributes(intersection, pathSegment.ray, geoms, meshes);
+            float cosLight = fabsf(glm::dot(hit.normal, pathSegment.ray.direction));
+            float lightPdf = lightSolidAnglePdf(lights.lightCount, lightArea(geom), intersection.t, cosLight);
+            misWeight = powerHeuristic(pathSegment.bsdfPdf, lightPdf);
+        }
+        pathSegment.color *= (materialColor * material.emittance * misWeight);
+        pathSegment.remainingBounces = 0;
+        return;
+    }
+
+    // 2. Ideal diffused shading and bounce
+    // 3. Perfect specular reflection
+    Sampler sampler = bounceSampler(samplerType, pathSegment.pixelIndex, iter, pathSegment.remainingBounces);
+    HitAttributes hit = resolveHitAttributes(intersection, pathSegment.ray, geoms, meshes);
+    const bool sampleLight = shadowRay && lights.lightCount > 0
+        && (MATERIAL_CLASS == MATERIAL_DIFFUSE || (generic && materialClassOf(material) == MATERIAL_DIFFUSE));
+    if (sampleLight) {
+        sampleDirectLight(lights, materials, pathSegment, hit.point, hit.normal, material, sampler, *shadowRay);
+    }
+    scatterRayAs<MATERIAL_CLASS>(pathSegment, hit.point, hit.normal, material, sampler);
+    pathSegment.bsdfPdf = sampleLight
+        ? fmaxf(glm::dot(hit.normal, pathSegment.ray.direction), 0.0f) / PI : 0.0f;
+
+    if (pathSegment.remainingBounces > 0 && pathSegment.remainingBounces <= rouletteBounces) {
+        russianRoulette(pathSegment, sample1D(sampler));
+    }
+}
+
+__host__ __device__ inline void shadePathSegment(int iter, int samplerType, int rouletteBounces,
+    const ShadeableIntersection& intersection, PathSegment& pathSegment, const Material* materials,
+    const Geom* geoms, const Mesh* meshes, const LightList& lights, ShadowRay* shadowRay) {
+    shadePathSegmentAs<MATERIAL_GENERIC>(iter, samplerType, rouletteBounces, intersection, pathSegment,
+        materials, geoms, meshes, lights, shadowRay);
+}
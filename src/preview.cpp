@@ -188,6 +188,59 @@ void InitImguiData(GuiDataContainer* guiData)
 }
 
 
+/** Bounce statistics of the latest iteration, and export of everything recorded. */
+static void RenderTelemetry()
+{
+	ImGui::Separator();
+	ImGui::Checkbox("Record bounce statistics", &imguiData->RecordTelemetry);
+	const std::vector<IterationTelemetry>& telemetry = imguiData->Telemetry;
+	if (telemetry.empty()) {
+		return;
+	}
+
+	const IterationTelemetry& last = telemetry.back();
+	ImGui::Text("Iteration %d: %.2f ms (generate %.2f ms, gather %.2f ms), %d iterations recorded",
+		last.iteration, last.totalMs, last.generateMs, last.gatherMs, (int)telemetry.size());
+	const char* columns[] = { "Depth", "In", "Out", "Miss", "Light", "Depth limit",
+		"Roulette", "Intersect ms", "Sort ms", "Shade ms", "Compact ms" };
+	const int columnCount = sizeof(columns) / sizeof(columns[0]);
+	if (ImGui::BeginTable("bounces", columnCount, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		for (int c = 0; c < columnCount; c++) {
+			ImGui::TableSetupColumn(columns[c]);
+		}
+		ImGui::TableHeadersRow();
+		for (const BounceTelemetry& b : last.bounces) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.depth);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.pathsIn);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.pathsOut);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.terminated[TERMINATED_MISS]);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.terminated[TERMINATED_LIGHT]);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.terminated[TERMINATED_DEPTH]);
+			ImGui::TableNextColumn(); ImGui::Text("%d", b.terminated[TERMINATED_ROULETTE]);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", b.intersectMs);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", b.sortMs);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", b.shadeMs);
+			ImGui::TableNextColumn(); ImGui::Text("%.3f", b.compactMs);
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::Button("Save CSV")) {
+		std::string path = imguiData->TelemetryBaseName + ".stats.csv";
+		printf("%s %s\n", saveTelemetryCSV(path, telemetry) ? "Saved" : "Could not write", path.c_str());
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Save JSON")) {
+		std::string path = imguiData->TelemetryBaseName + ".stats.json";
+		printf("%s %s\n", saveTelemetryJSON(path, telemetry) ? "Saved" : "Could not write", path.c_str());
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear")) {
+		imguiData->Telemetry.clear();
+	}
+}
+
 // LOOK: Un-Comment to check ImGui Usage
 void RenderImGui()
 {
@@ -218,7 +271,9 @@ void RenderImGui()
 	ImGui::SameLine();
 	ImGui::Text("counter = %d", counter);
 	ImGui::Text("Traced Depth %d", imguiData->TracedDepth);
+	ImGui::Text("Active Pixels %d", imguiData->ActivePixels);
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+	RenderTelemetry();
 	ImGui::End();
 
 
@@ -0,0 +1,60 @@
+#include <cstdio>
+
+#include "renderStop.h"
+
+const char* stopReasonName(int reason) {
+    switch (reason) {
+    case STOP_ITERATIONS:
+        return "iterations";
+    case STOP_TARGET_ERROR:
+        return "target_error";
+    case STOP_TIME_BUDGET:
+        return "time_budget";
+    default:
+        return "running";
+    }
+}
+
+RenderStopStatus initialStopStatus() {
+    RenderStopStatus status;
+    status.reason = STOP_NONE;
+    status.iterations = 0;
+    status.error = -1.0f;
+    status.seconds = 0.0;
+    return status;
+}
+
+bool checkStopCriteria(const RenderState& state, int iteration, double seconds,
+    float (*estimateError)(), RenderStopStatus& status) {
+    status.iterations = iteration;
+    status.seconds = seconds;
+
+    bool check = iteration % state.stopCheckInterval == 0;
+    bool measured = false;
+    if (check && state.targetError > 0.0f) {
+        status.error = estimateError();
+        measured = true;
+        if (status.error <= state.targetError) {
+            status.reason = STOP_TARGET_ERROR;
+        }
+    }
+    if (status.reason == STOP_NONE && check && state.timeBudget > 0.0f && seconds >= state.timeBudget) {
+        status.reason = STOP_TIME_BUDGET;
+    }
+    if (status.reason == STOP_NONE && iteration >= (int)state.iterations) {
+        status.reason = STOP_ITERATIONS;
+    }
+
+    // Whatever fired, report the error the render ended with
+    if (status.reason != STOP_NONE && !measured) {
+        status.error = estimateError();
+    }
+    return status.reason != STOP_NONE;
+}
+
+std::string stopSummary(const RenderStopStatus& status) {
+    char line[160];
+    snprintf(line, sizeof(line), "stop=%s iterations=%d error=%.6f seconds=%.3f",
+        stopReasonName(status.reason), status.iterations, status.error, status.seconds);
+    return line;
+}
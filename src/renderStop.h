@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include "sceneStructs.h"
+
+// Why a render ended
+enum StopReason {
+    STOP_NONE,              // still running
+    STOP_ITERATIONS,        // reached the scene's ITERATIONS
+    STOP_TARGET_ERROR,      // error estimate at or below TARGETERROR
+    STOP_TIME_BUDGET        // TIMEBUDGET seconds spent
+};
+
+/** "running", "iterations", "target_error" or "time_budget". */
+const char* stopReasonName(int reason);
+
+/** How a render went, as last updated by checkStopCriteria. */
+struct RenderStopStatus {
+    int reason;             // StopReason
+    int iterations;         // completed
+    float error;            // latest framebuffer error estimate; negative until measured
+    double seconds;
+};
+
+RenderStopStatus initialStopStatus();
+
+/**
+ * Records that `iteration` finished `seconds` into the render and decides
+ * whether to stop. ITERATIONS is always enforced. The error target and
+ * the time budget are tested every state.stopCheckInterval iterations.
+ * `estimateError` reduces over the whole framebuffer, so it is only
+ * called on those iterations when there is an error target, and once
+ * more when the render stops.
+ *
+ * @return  true once status.reason is no longer STOP_NONE.
+ */
+bool checkStopCriteria(const RenderState& state, int iteration, double seconds,
+    float (*estimateError)(), RenderStopStatus& status);
+
+/** One line of `key=value` pairs: stop, iterations, error, seconds. */
+std::string stopSummary(const RenderStopStatus& status);
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cuda_runtime.h>
+#include "glm/glm.hpp"
+
+// Stateless sample generation. Every sample is a pure function of the
+// pixel, the sample index (iteration - 1) and a dimension, so there is no
+// generator to seed or carry around and any stage can recompute any value.
+//
+// Dimensions 0-3 are the camera's (pixel jitter, then lens). Each bounce
+// then gets SAMPLER_BOUNCE_DIMENSIONS of its own, keyed by the path's
+// remaining bounces, which the shading stage hands out in the order it
+// draws them. The blue-noise sampler draws the camera's dimensions from
+// blueNoiseCameraSample and the rest like the Sobol sampler.
+
+#define SAMPLER_CAMERA_DIMENSIONS 4
+#define SAMPLER_BOUNCE_DIMENSIONS 16
+#define SOBOL_DIMENSIONS 4
+#define SOBOL_INDEX_BITS 24     // of the scrambled index; samples are floats with 24 bits anyway
+#define BLUE_NOISE_SIZE 64      // texels along each side of the blue-noise tile
+
+enum SamplerType {
+    SAMPLER_RANDOM,     // PCG hash of pixel, sample and dimension
+    SAMPLER_SOBOL,      // Owen-scrambled Sobol, padded in groups of SOBOL_DIMENSIONS
+    SAMPLER_BLUE_NOISE  // Sobol, with camera samples spread over pixels by a blue-noise tile
+};
+
+/**
+ * Generator matrices of the first four Sobol dimensions (Joe and Kuo's
+ * direction numbers), one column per index bit.
+ */
+#define SOBOL_MATRICES { \
+    { 0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000, \
+      0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000, \
+      0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100, \
+      0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001 }, \
+    { 0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000, \
+      0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000, \
+      0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00, \
+      0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff }, \
+    { 0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000, \
+      0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000, \
+      0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500, \
+      0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555 }, \
+    { 0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000, \
+      0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000, \
+      0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00, \
+      0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093 } }
+
+static const unsigned int sobolMatrices[SOBOL_DIMENSIONS][32] = SOBOL_MATRICES;
+#ifdef __CUDACC__
+// Global rather than constant memory: neighbouring threads read unrelated
+// columns, which constant memory would serialize
+static __device__ const unsigned int dev_sobolMatrices[SOBOL_DIMENSIONS][32] = SOBOL_MATRICES;
+#endif
+
+/** PCG output permutation of a single LCG step (Jarzynski and Olano). */
+__host__ __device__ inline unsigned int pcgHash(unsigned int v) {
+    unsigned int state = v * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+/** The top 24 bits of `bits` as a float in [0, 1). */
+__host__ __device__ inline float bitsToUnitFloat(unsigned int bits) {
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+__host__ __device__ inline unsigned int reverseBits(unsigned int x) {
+#ifdef __CUDA_ARCH__
+    return __brev(x);
+#else
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+#endif
+}
+
+/**
+ * Hash-based nested uniform (Owen) scramble of the bits of `x`: each bit is
+ * flipped depending on the bits above it only (Laine-Karras permutation on
+ * the reversed bits, with Burley's constants).
+ */
+__host__ __device__ inline unsigned int nestedUniformScramble(unsigned int x, unsigned int seed) {
+    x = reverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverseBits(x);
+}
+
+/**
+ * Sobol point `index` in `dimension` (< SOBOL_DIMENSIONS), as 32 bits.
+ * Only the low SOBOL_INDEX_BITS of the index are used.
+ */
+__host__ __device__ inline unsigned int sobolBits(unsigned int index, int dimension) {
+#ifdef __CUDA_ARCH__
+    const unsigned int* matrix = dev_sobolMatrices[dimension];
+#else
+    const unsigned int* matrix = sobolMatrices[dimension];
+#endif
+    // Scrambled indices have random bits, so mask rather than branch
+    unsigned int result = 0;
+    for (int bit = 0; bit < SOBOL_INDEX_BITS; bit++) {
+        result ^= matrix[bit] & (0u - ((index >> bit) & 1u));
+    }
+    return result;
+}
+
+/** Counter-based white noise in [0, 1). */
+__host__ __device__ inline float randomSample(unsigned int pixel, unsigned int sampleIndex, unsigned int dimension) {
+    return bitsToUnitFloat(pcgHash(pcgHash(pcgHash(pixel) + sampleIndex) + dimension));
+}
+
+/**
+ * Owen-scrambled Sobol sample in [0, 1). Dimensions are taken in groups of
+ * SOBOL_DIMENSIONS; each pixel and group shuffles the sample order with its
+ * own scramble of the index, so any aligned power-of-two run of samples is
+ * a stratified set within a group and groups are decorrelated from each
+ * other.
+ */
+__host__ __device__ inline float sobolSample(unsigned int pixel, unsigned int sampleIndex, unsigned int dimension) {
+    unsigned int groupSeed = pcgHash(pcgHash(pixel) + dimension / SOBOL_DIMENSIONS);
+    unsigned int index = nestedUniformScramble(sampleIndex, groupSeed);
+    unsigned int bits = sobolBits(index, dimension % SOBOL_DIMENSIONS);
+    return bitsToUnitFloat(nestedUniformScramble(bits, pcgHash(groupSeed + dimension)));
+}
+
+__host__ __device__ inline float sampleDimension(int type, unsigned int pixel, unsigned int sampleIndex,
+    unsigned int dimension) {
+    return type == SAMPLER_RANDOM ? randomSample(pixel, sampleIndex, dimension)
+        : sobolSample(pixel, sampleIndex, dimension);
+}
+
+/**
+ * Camera dimensions of the blue-noise sampler for pixel (x, y): jitter in
+ * xy, lens in zw. Every pixel takes the same unscrambled Sobol point
+ * `sampleIndex`, shifted modulo 1 by the BLUE_NOISE_SIZE tile `blueNoise`
+ * (see blueNoise.h). All four dimensions share the tile, each reading it
+ * at its own toroidal offset so they stay uncorrelated.
+ *
+ * A pixel's samples are thus a rotated Sobol sequence, stratified at every
+ * power of two, while neighbouring pixels are rotated by values far apart,
+ * which pushes the error of low sample counts to high frequencies.
+ */
+__host__ __device__ inline glm::vec4 blueNoiseCameraSample(const float* blueNoise, int x, int y,
+    unsigned int sampleIndex) {
+    const int half = BLUE_NOISE_SIZE / 2;
+    const int quarter = BLUE_NOISE_SIZE / 4;
+    const int offsetX[SOBOL_DIMENSIONS] = { 0, half, quarter, half + quarter };
+    const int offsetY[SOBOL_DIMENSIONS] = { 0, quarter, half + quarter, half };
+    float u[SOBOL_DIMENSIONS];
+    for (int d = 0; d < SOBOL_DIMENSIONS; d++) {
+        int tx = (x + offsetX[d]) % BLUE_NOISE_SIZE;
+        int ty = (y + offsetY[d]) % BLUE_NOISE_SIZE;
+        u[d] = bitsToUnitFloat(sobolBits(sampleIndex, d)) + blueNoise[ty * BLUE_NOISE_SIZE + tx];
+        u[d] = u[d] >= 1.0f ? u[d] - 1.0f : u[d];
+    }
+    return glm::vec4(u[0], u[1], u[2], u[3]);
+}
+
+/** One path's cursor into the sample space. Copy it by value. */
+struct Sampler {
+    int type;                   // SamplerType
+    unsigned int pixel;
+    unsigned int sampleIndex;
+    unsigned int dimension;     // next dimension to hand out
+};
+
+__host__ __device__ inline Sampler makeSampler(int type, int pixel, int sampleIndex, int dimension) {
+    Sampler s;
+    s.type = type;
+    s.pixel = pixel;
+    s.sampleIndex = sampleIndex;
+    s.dimension = dimension;
+    return s;
+}
+
+/** Sampler for the camera ray of iteration `iter` (from 1). */
+__host__ __device__ inline Sampler cameraSampler(int type, int pixel, int iter) {
+    return makeSampler(type, pixel, iter - 1, 0);
+}
+
+/** Sampler for shading a path of iteration `iter` that has `remainingBounces` left. */
+__host__ __device__ inline Sampler bounceSampler(int type, int pixel, int iter, int remainingBounces) {
+    return makeSampler(type, pixel, iter - 1,
+        SAMPLER_CAMERA_DIMENSIONS + remainingBounces * SAMPLER_BOUNCE_DIMENSIONS);
+}
+
+__host__ __device__ inline float sample1D(Sampler& s) {
+    return sampleDimension(s.type, s.pixel, s.sampleIndex, s.dimension++);
+}
+
+/**
+ * Two dimensions starting at the next even one, so a pair never straddles
+ * Sobol groups and stays stratified in 2D.
+ */
+__host__ __device__ inline glm::vec2 sample2D(Sampler& s) {
+    s.dimension = (s.dimension + 1) & ~1u;
+    float x = sampleDimension(s.type, s.pixel, s.sampleIndex, s.dimension);
+    float y = sampleDimension(s.type, s.pixel, s.sampleIndex, s.dimension + 1);
+    s.dimension += 2;
+    return glm::vec2(x, y);
+}
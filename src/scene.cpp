@@ -4,16 +4,33 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "tiny_obj_loader.h"
+#include <chrono>
+#include <stdexcept>
+
+#include "bvh.h"
+#include "lights.h"
+#include "objLoader.h"
+#include "threadPool.h"
 
 Scene::Scene(string filename) {
     cout << "Reading scene from " << filename << " ..." << endl;
     cout << " " << endl;
+
+#if SCENE_CACHE
+    uint64_t sceneHash = 0;
+    string cachePath = filename + SCENE_CACHE_EXTENSION;
+    bool cacheable = utilityCore::hashFile(filename, sceneHash);
+    if (cacheable && loadCache(cachePath, sceneHash)) {
+        buildLightList();
+        return;
+    }
+#endif
+
     char* fname = (char*)filename.c_str();
     fp_in.open(fname);
     if (!fp_in.is_open()) {
         cout << "Error reading from file - aborting!" << endl;
-        throw;
+        throw std::runtime_error("cannot open " + filename);
     }
     while (fp_in.good()) {
         string line;
@@ -32,6 +49,53 @@ Scene::Scene(string filename) {
             }
         }
     }
+    loadPendingMeshes();
+    buildSceneBVH();
+    buildLightList();
+
+#if SCENE_CACHE
+    if (cacheable) {
+        saveCache(cachePath, sceneHash);
+    }
+#endif
+}
+
+Scene::~Scene() {
+    fp_in.close();
+    cacheFile.close();
+}
+
+void Scene::buildSceneBVH() {
+    std::vector<BoundingBox> geomBounds(geoms.size());
+    for (int i = 0; i < geoms.size(); i++) {
+        geomBounds[i] = geomWorldBounds(geoms[i]);
+    }
+    int depth = buildBVH(geomBounds, sceneGeomIndices, sceneBVH);
+    cout << "Built scene BVH: " << geoms.size() << " geoms, "
+        << sceneBVH.size() << " nodes, depth " << depth << endl;
+}
+
+void Scene::buildLightList() {
+    lights.clear();
+    int unsampled = 0;
+    for (int i = 0; i < geoms.size(); i++) {
+        if (materials[geoms[i].materialid].emittance <= 0.0f) {
+            continue;
+        }
+        if (!isSampledLightShape(geoms[i])) {
+            unsampled++;
+            continue;
+        }
+        Light light;
+        light.geomId = i;
+        light.area = lightArea(geoms[i]);
+        lights.push_back(light);
+    }
+    cout << "Built light list: " << lights.size() << " lights";
+    if (unsampled > 0) {
+        cout << ", " << unsampled << " emissive geoms left to BSDF sampling";
+    }
+    cout << endl;
 }
 
 int Scene::getImplicitType(Geom* newGeom) {
@@ -124,111 +188,101 @@ int Scene::loadTransformations(Geom* newGeom) {
     return 0;
 }
 
-int Scene::loadObjFile(string objectPath, Geom *newGeom)
+int Scene::loadObjFile(string objectPath, Mesh* newMesh, ObjLoadStats& stats, ostream& log)
 {
-    tinyobj::ObjReaderConfig reader_config;
-    reader_config.mtl_search_path = "./"; // Path to material files
-
-    tinyobj::ObjReader reader;
-
-    if (!reader.ParseFromFile(objectPath, reader_config)) {
-        if (!reader.Error().empty()) {
-            std::cerr << "TinyObjReader: " << reader.Error();
-        }
-        exit(1);
-    }
-
-    if (!reader.Warning().empty()) {
-        std::cout << "TinyObjReader: " << reader.Warning();
+    if (loadObjMesh(objectPath, newMesh, &stats) != 0) {
+        return -1;
     }
+    newMesh->dev_vertices = NULL;
+    newMesh->dev_indices = NULL;
+    log << "Parsed " << objectPath << ": " << stats.bytes / (1024.0 * 1024.0) << " MB, "
+        << stats.triangles << " triangles, " << stats.chunks << " chunks in "
+        << stats.seconds * 1e3 << " ms (" << stats.bytes / (1024.0 * 1024.0) / stats.seconds << " MB/s, "
+        << stats.triangles / stats.seconds * 1e-6 << " Mtri/s)" << endl;
+
+    size_t meshBytes = newMesh->vertexCount * sizeof(MeshVertex) + newMesh->triCount * sizeof(glm::uvec3);
+    log << "Welded " << stats.objVertices << " OBJ vertices into " << newMesh->vertexCount << ": "
+        << (double)meshBytes / glm::max(newMesh->triCount, 1) << " bytes/triangle (was "
+        << sizeof(Triangle) << ")" << endl;
+
+    // Build the BVH, which also reorders the triangles for contiguous leaves
+    std::vector<BVHNode> bvhNodes;
+    int bvhDepth = buildMeshBVH(newMesh->vertices, newMesh->indices, newMesh->triCount, bvhNodes);
+
+    // Precompute intersection data per leaf; leaves now index blocks
+    std::vector<TriangleBlock> triBlocks;
+    buildTriangleBlocks(newMesh->vertices, newMesh->indices, bvhNodes, triBlocks);
+
+    newMesh->bvhNodeCount = bvhNodes.size();
+    newMesh->bvhNodes = bvhNodes.empty() ? NULL : new BVHNode[bvhNodes.size()];
+    std::copy(bvhNodes.begin(), bvhNodes.end(), newMesh->bvhNodes);
+    newMesh->dev_bvhNodes = NULL;
+    log << "Built BVH: " << newMesh->triCount << " triangles, "
+        << newMesh->bvhNodeCount << " nodes, depth " << bvhDepth << ", "
+        << triBlocks.size() << " triangle blocks" << endl;
+    newMesh->triBlockCount = triBlocks.size();
+    newMesh->triBlocks = triBlocks.empty() ? NULL : new TriangleBlock[triBlocks.size()];
+    std::copy(triBlocks.begin(), triBlocks.end(), newMesh->triBlocks);
+    newMesh->dev_triBlocks = NULL;
 
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
-    auto& materials = reader.GetMaterials();
-    std::vector<Triangle> triangles;
-
-    glm::vec3 minPos = newGeom->boundingBox.min;
-    glm::vec3 maxPos = newGeom->boundingBox.max;
-
-    // Loop over shapess
-    for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces(polygon)
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-            Triangle triangle;
-
-            int vertCnt = 0;
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-                tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-                tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-
-                triangle.pos[vertCnt] = glm::vec3(vx, vy, vz);
-
-                if (minPos.x > vx) { minPos.x = vx; }
-                if (minPos.y > vy) { minPos.y = vy; }
-                if (minPos.z > vz) { minPos.z = vz; }
-                
-                if (maxPos.x < vx) { maxPos.x = vx; }
-                if (maxPos.y < vy) { maxPos.y = vy; }
-                if (maxPos.z < vz) { maxPos.z = vz; }
-
-                // Check if `normal_index` is zero or positive. negative = no normal data
-                if (idx.normal_index >= 0) {
-                    tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
-                    tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
-                    tinyobj::real_t nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
-
-                    triangle.nor[vertCnt] = glm::vec3(nx, ny, nz);
-                }
-
-                //// Check if `texcoord_index` is zero or positive. negative = no texcoord data
-                //if (idx.texcoord_index >= 0) {
-                //    tinyobj::real_t tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
-                //    tinyobj::real_t ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
-
-                //    triangle.uv[vertCnt] = glm::vec2(tx, ty);
-                //}
-
+    return 0;
+}
 
-                // Optional: vertex colors
-                // tinyobj::real_t red   = attrib.colors[3*size_t(idx.vertex_index)+0];
-                // tinyobj::real_t green = attrib.colors[3*size_t(idx.vertex_index)+1];
-                // tinyobj::real_t blue  = attrib.colors[3*size_t(idx.vertex_index)+2];
+int Scene::loadMesh(string objectPath) {
+    string key = utilityCore::canonicalPath(objectPath);
+    std::map<string, int>::iterator it = meshIds.find(key);
+    if (it != meshIds.end()) {
+        cout << "Reusing mesh " << it->second << " for " << objectPath << endl;
+        return it->second;
+    }
 
-                vertCnt++;
-                if (vertCnt == 3) { break; }
-            }
+    // Reserve the slot now; the file is parsed later by loadPendingMeshes
+    int id = meshes.size();
+    meshes.push_back(Mesh());
+    meshIds[key] = id;
+    pendingMeshes.push_back(std::make_pair(id, objectPath));
+    cout << "Queued mesh " << id << " from " << objectPath << endl;
+    return id;
+}
 
-            triangles.push_back(triangle);
-            index_offset += fv;
+void Scene::loadPendingMeshes() {
+    if (pendingMeshes.empty()) {
+        return;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<int> results(pendingMeshes.size());
+    std::vector<ObjLoadStats> stats(pendingMeshes.size());
+    std::vector<std::ostringstream> logs(pendingMeshes.size());
+    ThreadPool::shared().parallelFor(pendingMeshes.size(), [&](int i) {
+        results[i] = loadObjFile(pendingMeshes[i].second, &meshes[pendingMeshes[i].first], stats[i], logs[i]);
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+
+    size_t bytes = 0;
+    int triCount = 0;
+    for (int i = 0; i < pendingMeshes.size(); i++) {
+        cout << logs[i].str();
+        if (results[i] != 0) {
+            throw std::runtime_error("cannot load mesh " + pendingMeshes[i].second);
         }
+        cout << "Loaded mesh " << pendingMeshes[i].first << " from " << pendingMeshes[i].second << endl;
+        bytes += stats[i].bytes;
+        triCount += stats[i].triangles;
     }
-    newGeom->boundingBox.min = minPos;
-    newGeom->boundingBox.max = maxPos;
-    newGeom->triCount = triangles.size();
-    newGeom->triangles = new Triangle[triangles.size()];
-    Triangle* t = newGeom->triangles;
-    for (int i = 0; i < triangles.size(); i++) {
-        *t = triangles[i];
-        t++;
+    double seconds = std::chrono::duration<double>(end - start).count();
+    cout << "Loaded " << pendingMeshes.size() << " meshes on " << ThreadPool::shared().size() + 1
+        << " threads: " << bytes / (1024.0 * 1024.0) << " MB, " << triCount << " triangles in "
+        << seconds * 1e3 << " ms including BVH builds (" << bytes / (1024.0 * 1024.0) / seconds << " MB/s, "
+        << triCount / seconds * 1e-6 << " Mtri/s end to end)" << endl;
+    pendingMeshes.clear();
+
+    for (int i = 0; i < geoms.size(); i++) {
+        if (geoms[i].type == OBJ && geoms[i].meshid >= 0) {
+            geoms[i].boundingBox = meshes[geoms[i].meshid].boundingBox;
+        }
     }
-    Triangle* tcpu = newGeom->triangles;
-
-    return 0;
-    //printf("\n*****SCENE*****\n");
-    //for (int i = 0; i < newGeom->triCount; i++) {
-    //    printf("\n %f, %f, %f", tcpu->nor[0].x, tcpu->nor[0].y, tcpu->nor[0].z);
-    //    tcpu++;
-    //}
-    //printf("\n#########\n");
 }
 
-
 int Scene::loadGeom(string objectid) {
     int id = atoi(objectid.c_str());
     if (id != geoms.size()) {
@@ -248,9 +302,7 @@ int Scene::loadGeom(string objectid) {
             if (strcmp(line.c_str(), "implicit") == 0) {
                 cout << "Creating implicit surface..." << endl;
                 newGeom.type = IMPLICIT;
-                newGeom.triCount = 0;
-                newGeom.triangles = NULL;
-                newGeom.dev_triangles = NULL;
+                newGeom.meshid = -1;
                 retVal = getImplicitType(&newGeom);
             }
             else if (strcmp(line.c_str(), "obj") == 0) {
@@ -258,19 +310,16 @@ int Scene::loadGeom(string objectid) {
                 newGeom.type = OBJ;
                 utilityCore::safeGetline(fp_in, line);
                 if (!line.empty() && fp_in.good()) {
-                    retVal =  loadObjFile(line.c_str(), &newGeom);
+                    // Bounds are filled in once the mesh has been loaded
+                    newGeom.meshid = loadMesh(line);
                 }
             } else if (strcmp(line.c_str(), "sphere") == 0) {
                 cout << "Creating new sphere..." << endl;
                 newGeom.type = SPHERE;
-                newGeom.triCount = 0;
-                newGeom.triangles = NULL;
-                newGeom.dev_triangles = NULL;
+                newGeom.meshid = -1;
             } else if (strcmp(line.c_str(), "cube") == 0) {
                 cout << "Creating new cube..." << endl;
-                newGeom.triCount = 0;
-                newGeom.triangles = NULL;
-                newGeom.dev_triangles = NULL;
+                newGeom.meshid = -1;
                 newGeom.type = CUBE;
             }
         }
@@ -291,6 +340,10 @@ int Scene::loadCamera() {
     RenderState &state = this->state;
     Camera &camera = state.camera;
     float fovy;
+    state.rouletteDepth = -1;
+    state.targetError = 0.0f;
+    state.timeBudget = 0.0f;
+    state.stopCheckInterval = 1;
 
     //load static properties
     for (int i = 0; i < 7; i++) {
@@ -325,6 +378,14 @@ int Scene::loadCamera() {
             camera.lookAt = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
         } else if (strcmp(tokens[0].c_str(), "UP") == 0) {
             camera.up = glm::vec3(atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()));
+        } else if (strcmp(tokens[0].c_str(), "ROULETTE") == 0) {
+            state.rouletteDepth = atoi(tokens[1].c_str());
+        } else if (strcmp(tokens[0].c_str(), "TARGETERROR") == 0) {
+            state.targetError = atof(tokens[1].c_str());
+        } else if (strcmp(tokens[0].c_str(), "TIMEBUDGET") == 0) {
+            state.timeBudget = atof(tokens[1].c_str());
+        } else if (strcmp(tokens[0].c_str(), "CHECKEVERY") == 0) {
+            state.stopCheckInterval = std::max(1, atoi(tokens[1].c_str()));
         }
 
         utilityCore::safeGetline(fp_in, line);
@@ -336,12 +397,12 @@ int Scene::loadCamera() {
     float fovx = (atan(xscaled) * 180) / PI;
     camera.fov = glm::vec2(fovx, fovy);
 
+    camera.view = glm::normalize(camera.lookAt - camera.position);
     camera.right = glm::normalize(glm::cross(camera.view, camera.up));
+    camera.up = glm::cross(camera.right, camera.view);
     camera.pixelLength = glm::vec2(2 * xscaled / (float)camera.resolution.x,
                                    2 * yscaled / (float)camera.resolution.y);
 
-    camera.view = glm::normalize(camera.lookAt - camera.position);
-
     //set up render camera stuff
     int arraylen = camera.resolution.x * camera.resolution.y;
     state.image.resize(arraylen);
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include "glm/glm.hpp"
 #include "utilities.h"
 #include "sceneStructs.h"
+#include "sceneCache.h"
+#include "objLoader.h"
 
 using namespace std;
 
@@ -15,16 +18,30 @@ private:
     ifstream fp_in;
     int loadMaterial(string materialid);
     int loadGeom(string objectid);
-    int loadObjFile(string objectPath, Geom * newGeom);
+    int loadMesh(string objectPath);
+    int loadObjFile(string objectPath, Mesh* newMesh, ObjLoadStats& stats, ostream& log);
+    void loadPendingMeshes();
     int getImplicitType(Geom* newGeom);
     int Scene::linkMaterial(Geom* newGeom);
     int Scene::loadTransformations(Geom* newGeom);
     int loadCamera();
+    void buildSceneBVH();
+    void buildLightList();
+    bool loadCache(const string& cachePath, uint64_t sceneHash);
+    void saveCache(const string& cachePath, uint64_t sceneHash);
+
+    std::vector<std::pair<int, string> > pendingMeshes;   // mesh id, OBJ path
+    MappedFile cacheFile;   // backs the mesh arrays when loaded from cache
 public:
     Scene(string filename);
     ~Scene();
 
     std::vector<Geom> geoms;
+    std::vector<Mesh> meshes;
+    std::map<string, int> meshIds;   // canonical OBJ path -> index into meshes
     std::vector<Material> materials;
+    std::vector<BVHNode> sceneBVH;
+    std::vector<int> sceneGeomIndices;
+    std::vector<Light> lights;       // emissive geoms sampled by next-event estimation
     RenderState state;
 };
@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "scene.h"
+#include "sceneCache.h"
+
+static const char SCENE_CACHE_MAGIC[8] = { 'C', 'P', 'T', 'S', 'C', 'E', 'N', 'E' };
+
+namespace {
+    uint64_t layoutHash() {
+        uint64_t sizes[] = {
+            SCENE_CACHE_VERSION, TRI_BLOCK_WIDTH,
+            sizeof(SceneCacheHeader), sizeof(SceneCacheMesh),
+            sizeof(Camera), sizeof(Material), sizeof(Geom),
+            sizeof(MeshVertex), sizeof(glm::uvec3), sizeof(TriangleBlock), sizeof(BVHNode)
+        };
+        return utilityCore::hashBytes(sizes, sizeof(sizes));
+    }
+
+    size_t payloadStart() {
+        return (sizeof(SceneCacheHeader) + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+    }
+
+    /**
+     * Checks that a section lies inside the file, is aligned and holds a
+     * whole number of `elemSize` elements.
+     */
+    bool validSection(const SceneCacheSection& s, size_t fileSize, size_t elemSize) {
+        return s.offset % SCENE_CACHE_ALIGN == 0
+            && s.offset >= payloadStart()
+            && s.offset <= fileSize
+            && s.size <= fileSize - s.offset
+            && s.size % elemSize == 0;
+    }
+
+    /**
+     * Accumulates the cache file in memory. Each array is appended at the next
+     * SCENE_CACHE_ALIGN boundary so it can be used in place once mapped.
+     */
+    struct CacheWriter {
+        std::vector<char> bytes;
+
+        CacheWriter() : bytes(payloadStart(), 0) {}
+
+        SceneCacheSection append(const void* data, size_t size) {
+            SceneCacheSection s;
+            s.offset = (bytes.size() + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN;
+            s.size = size;
+            bytes.resize(s.offset + size, 0);
+            if (size > 0) {
+                memcpy(&bytes[s.offset], data, size);
+            }
+            return s;
+        }
+    };
+}
+
+bool Scene::loadCache(const string& cachePath, uint64_t sceneHash) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!cacheFile.open(cachePath)) {
+        cout << "No scene cache at " << cachePath << endl;
+        return false;
+    }
+
+    char* base = cacheFile.data();
+    size_t fileSize = cacheFile.size();
+    if (fileSize < payloadStart()) {
+        cout << "Scene cache " << cachePath << " is truncated, rebuilding" << endl;
+        cacheFile.close();
+        return false;
+    }
+    // Read in place like every other section; the mapping is page-aligned
+    const SceneCacheHeader& header = *(const SceneCacheHeader*)base;
+
+    if (memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SCENE_CACHE_VERSION || header.layoutHash != layoutHash()) {
+        cout << "Scene cache " << cachePath << " is from a different version, rebuilding" << endl;
+        cacheFile.close();
+        return false;
+    }
+    if (header.sceneHash != sceneHash) {
+        cout << "Scene cache " << cachePath << " is stale, rebuilding" << endl;
+        cacheFile.close();
+        return false;
+    }
+    bool valid = header.fileSize == fileSize
+        && validSection(header.imageName, fileSize, 1)
+        && validSection(header.materials, fileSize, sizeof(Material))
+        && validSection(header.geoms, fileSize, sizeof(Geom))
+        && validSection(header.meshes, fileSize, sizeof(SceneCacheMesh))
+        && header.meshes.size / sizeof(SceneCacheMesh) == header.meshCount
+        && validSection(header.sceneBVH, fileSize, sizeof(BVHNode))
+        && validSection(header.sceneGeomIndices, fileSize, sizeof(int))
+        && utilityCore::hashBytes(base + payloadStart(), fileSize - payloadStart()) == header.payloadHash;
+    const SceneCacheMesh* cachedMeshes = (const SceneCacheMesh*)(base + header.meshes.offset);
+    for (uint32_t i = 0; valid && i < header.meshCount; i++) {
+        const SceneCacheMesh& m = cachedMeshes[i];
+        valid = validSection(m.path, fileSize, 1)
+            && validSection(m.vertices, fileSize, sizeof(MeshVertex))
+            && validSection(m.indices, fileSize, sizeof(glm::uvec3))
+            && validSection(m.triBlocks, fileSize, sizeof(TriangleBlock))
+            && validSection(m.bvhNodes, fileSize, sizeof(BVHNode));
+    }
+    if (!valid) {
+        cout << "Scene cache " << cachePath << " is corrupt, rebuilding" << endl;
+        cacheFile.close();
+        return false;
+    }
+
+    // The scene text is unchanged, but referenced OBJ files may not be
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+        const SceneCacheMesh& m = cachedMeshes[i];
+        string path(base + m.path.offset, m.path.size);
+        uint64_t contentHash = 0;
+        if (!utilityCore::hashFile(path, contentHash) || contentHash != m.contentHash) {
+            cout << "Scene cache " << cachePath << " is stale (" << path << " changed), rebuilding" << endl;
+            cacheFile.close();
+            return false;
+        }
+    }
+
+    // Mesh arrays are used in place; the small arrays are copied out
+    const Material* cachedMaterials = (const Material*)(base + header.materials.offset);
+    materials.assign(cachedMaterials, cachedMaterials + header.materials.size / sizeof(Material));
+    const Geom* cachedGeoms = (const Geom*)(base + header.geoms.offset);
+    geoms.assign(cachedGeoms, cachedGeoms + header.geoms.size / sizeof(Geom));
+    const BVHNode* cachedBVH = (const BVHNode*)(base + header.sceneBVH.offset);
+    sceneBVH.assign(cachedBVH, cachedBVH + header.sceneBVH.size / sizeof(BVHNode));
+    const int* cachedIndices = (const int*)(base + header.sceneGeomIndices.offset);
+    sceneGeomIndices.assign(cachedIndices, cachedIndices + header.sceneGeomIndices.size / sizeof(int));
+
+    int triCount = 0;
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+        const SceneCacheMesh& m = cachedMeshes[i];
+        Mesh mesh;
+        mesh.triCount = m.indices.size / sizeof(glm::uvec3);
+        mesh.vertexCount = m.vertices.size / sizeof(MeshVertex);
+        mesh.vertices = (MeshVertex*)(base + m.vertices.offset);
+        mesh.dev_vertices = NULL;
+        mesh.indices = (glm::uvec3*)(base + m.indices.offset);
+        mesh.dev_indices = NULL;
+        mesh.hasNormals = m.hasNormals != 0;
+        mesh.hasUVs = m.hasUVs != 0;
+        mesh.triBlockCount = m.triBlocks.size / sizeof(TriangleBlock);
+        mesh.triBlocks = (TriangleBlock*)(base + m.triBlocks.offset);
+        mesh.dev_triBlocks = NULL;
+        mesh.bvhNodeCount = m.bvhNodes.size / sizeof(BVHNode);
+        mesh.bvhNodes = (BVHNode*)(base + m.bvhNodes.offset);
+        mesh.dev_bvhNodes = NULL;
+        mesh.boundingBox = m.boundingBox;
+        meshIds[string(base + m.path.offset, m.path.size)] = meshes.size();
+        meshes.push_back(mesh);
+        triCount += mesh.triCount;
+    }
+
+    state.camera = header.camera;
+    state.iterations = header.iterations;
+    state.traceDepth = header.traceDepth;
+    state.rouletteDepth = header.rouletteDepth;
+    state.targetError = header.targetError;
+    state.timeBudget = header.timeBudget;
+    state.stopCheckInterval = header.stopCheckInterval;
+    state.imageName = string(base + header.imageName.offset, header.imageName.size);
+    state.image.resize(state.camera.resolution.x * state.camera.resolution.y);
+    std::fill(state.image.begin(), state.image.end(), glm::vec3());
+
+    auto end = std::chrono::high_resolution_clock::now();
+    cout << "Loaded scene cache " << cachePath << ": " << materials.size() << " materials, "
+        << geoms.size() << " geoms, " << meshes.size() << " meshes (" << triCount << " triangles) in "
+        << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << endl;
+    return true;
+}
+
+void Scene::saveCache(const string& cachePath, uint64_t sceneHash) {
+    SceneCacheHeader header = {};
+    memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.layoutHash = layoutHash();
+    header.sceneHash = sceneHash;
+    header.camera = state.camera;
+    header.iterations = state.iterations;
+    header.traceDepth = state.traceDepth;
+    header.rouletteDepth = state.rouletteDepth;
+    header.targetError = state.targetError;
+    header.timeBudget = state.timeBudget;
+    header.stopCheckInterval = state.stopCheckInterval;
+    header.meshCount = meshes.size();
+
+    // Mesh paths in index order; meshIds maps each canonical path to its mesh
+    std::vector<string> meshPaths(meshes.size());
+    for (std::map<string, int>::iterator it = meshIds.begin(); it != meshIds.end(); ++it) {
+        meshPaths[it->second] = it->first;
+    }
+
+    CacheWriter out;
+    std::vector<SceneCacheMesh> cachedMeshes(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh& mesh = meshes[i];
+        SceneCacheMesh& m = cachedMeshes[i];
+        if (!utilityCore::hashFile(meshPaths[i], m.contentHash)) {
+            cout << "Not writing scene cache: cannot read " << meshPaths[i] << endl;
+            return;
+        }
+        m.path = out.append(meshPaths[i].data(), meshPaths[i].size());
+        m.vertices = out.append(mesh.vertices, mesh.vertexCount * sizeof(MeshVertex));
+        m.indices = out.append(mesh.indices, mesh.triCount * sizeof(glm::uvec3));
+        m.triBlocks = out.append(mesh.triBlocks, mesh.triBlockCount * sizeof(TriangleBlock));
+        m.bvhNodes = out.append(mesh.bvhNodes, mesh.bvhNodeCount * sizeof(BVHNode));
+        m.boundingBox = mesh.boundingBox;
+        m.hasNormals = mesh.hasNormals;
+        m.hasUVs = mesh.hasUVs;
+    }
+    header.imageName = out.append(state.imageName.data(), state.imageName.size());
+    header.materials = out.append(materials.data(), materials.size() * sizeof(Material));
+    header.geoms = out.append(geoms.data(), geoms.size() * sizeof(Geom));
+    header.sceneBVH = out.append(sceneBVH.data(), sceneBVH.size() * sizeof(BVHNode));
+    header.sceneGeomIndices = out.append(sceneGeomIndices.data(), sceneGeomIndices.size() * sizeof(int));
+    header.meshes = out.append(cachedMeshes.data(), cachedMeshes.size() * sizeof(SceneCacheMesh));
+
+    // Pad so the file ends on an alignment boundary too
+    out.bytes.resize((out.bytes.size() + SCENE_CACHE_ALIGN - 1) / SCENE_CACHE_ALIGN * SCENE_CACHE_ALIGN, 0);
+    header.fileSize = out.bytes.size();
+    header.payloadHash = utilityCore::hashBytes(&out.bytes[payloadStart()], out.bytes.size() - payloadStart());
+    memcpy(&out.bytes[0], &header, sizeof(header));
+
+    // Write beside the target and swap it in, so a crash never leaves a
+    // half-written cache under the real name
+    string tmpPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write(out.bytes.data(), out.bytes.size())) {
+            cout << "Not writing scene cache: cannot write " << tmpPath << endl;
+            return;
+        }
+    }
+    remove(cachePath.c_str());
+    if (rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+        cout << "Not writing scene cache: cannot rename " << tmpPath << endl;
+        remove(tmpPath.c_str());
+        return;
+    }
+    cout << "Wrote scene cache " << cachePath << " (" << out.bytes.size() / 1024 << " KB)" << endl;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "sceneStructs.h"
+#include "mappedFile.h"
+
+#define SCENE_CACHE 1
+#define SCENE_CACHE_VERSION 5
+#define SCENE_CACHE_ALIGN 64
+#define SCENE_CACHE_EXTENSION ".cache"
+
+// Byte range of one array in a cache file, relative to the start of the file.
+// Offsets are multiples of SCENE_CACHE_ALIGN.
+struct SceneCacheSection {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// One entry per Scene::meshes. The mesh is valid while the file at `path`
+// still hashes to `contentHash`.
+struct SceneCacheMesh {
+    uint64_t contentHash;
+    SceneCacheSection path;
+    SceneCacheSection vertices;
+    SceneCacheSection indices;
+    SceneCacheSection triBlocks;
+    SceneCacheSection bvhNodes;
+    BoundingBox boundingBox;
+    uint32_t hasNormals;
+    uint32_t hasUVs;
+};
+
+// Fixed-size header at offset 0. Everything after it is covered by
+// payloadHash; layoutHash changes whenever a cached struct changes size, so
+// caches from a different build are rejected rather than misread.
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t meshCount;
+    uint64_t layoutHash;
+    uint64_t fileSize;
+    uint64_t sceneHash;
+    uint64_t payloadHash;
+
+    Camera camera;
+    uint32_t iterations;
+    int32_t traceDepth;
+    int32_t rouletteDepth;
+    float targetError;
+    float timeBudget;
+    int32_t stopCheckInterval;
+    SceneCacheSection imageName;
+    SceneCacheSection materials;
+    SceneCacheSection geoms;
+    SceneCacheSection meshes;
+    SceneCacheSection sceneBVH;
+    SceneCacheSection sceneGeomIndices;
+};
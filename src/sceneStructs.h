@@ -6,6 +6,7 @@
 #include "glm/glm.hpp"
 
 #define BACKGROUND_COLOR (glm::vec3(0.0f))
+#define TRI_BLOCK_WIDTH 4
 #define FLOAT_MIN -1e38f
 #define FLOAT_MAX 1e38f;
 
@@ -36,11 +37,63 @@ struct Triangle {
     glm::vec2 uv[3];
 };
 
+// Welded mesh vertex. The normal is octahedral-encoded and the UV is a pair
+// of halves (see meshEncoding.h), 20 bytes in all.
+struct MeshVertex {
+    glm::vec3 pos;
+    unsigned int nor;
+    unsigned int uv;
+};
+
+// Intersection-only triangle data, precomputed in object space at load.
+// Holds up to TRI_BLOCK_WIDTH triangles of one BVH leaf stored
+// component-wise (vertex 0 and the two edges leaving it) so all lanes can be
+// tested together. triIndex maps a lane back to Mesh::indices; unused lanes
+// have zero edges, which the intersection test rejects as degenerate, and a
+// triIndex of -1.
+struct TriangleBlock {
+    float v0[3][TRI_BLOCK_WIDTH];
+    float e1[3][TRI_BLOCK_WIDTH];
+    float e2[3][TRI_BLOCK_WIDTH];
+    int triIndex[TRI_BLOCK_WIDTH];
+};
+
 struct BoundingBox {
     glm::vec3 min;
     glm::vec3 max;
 };
 
+// Flat BVH node. Children of an interior node are stored next to each other,
+// so the right child is always leftFirst + 1. For a leaf, leftFirst is the
+// index of its first primitive (triangle, or geom for the scene BVH) and
+// primCount the number of primitives; interior nodes have primCount 0.
+struct BVHNode {
+    BoundingBox bounds;
+    int leftFirst;
+    int primCount;
+};
+
+// Indexed triangle mesh loaded from an OBJ file, shared by every OBJ geom
+// that references the same file. Triangle i is indices[i], three entries of
+// vertices. hasNormals/hasUVs say whether the file provided those attributes.
+struct Mesh {
+    int triCount;
+    int vertexCount;
+    MeshVertex* vertices;
+    MeshVertex* dev_vertices;
+    glm::uvec3* indices;
+    glm::uvec3* dev_indices;
+    bool hasNormals;
+    bool hasUVs;
+    int triBlockCount;
+    TriangleBlock* triBlocks;
+    TriangleBlock* dev_triBlocks;
+    int bvhNodeCount;
+    BVHNode* bvhNodes;
+    BVHNode* dev_bvhNodes;
+    BoundingBox boundingBox;
+};
+
 struct Geom {
     enum GeomType type;
     int materialid;
@@ -50,13 +103,18 @@ struct Geom {
     glm::mat4 transform;
     glm::mat4 inverseTransform;
     glm::mat4 invTranspose;
-    int triCount;
-    Triangle* triangles;
-    Triangle* dev_triangles;
+    int meshid;
     BoundingBox boundingBox;
     ImplicitObj implicitobj;
 };
 
+// Emissive geom that next-event estimation samples, with its world-space
+// surface area. Built at scene load (Scene::buildLightList).
+struct Light {
+    int geomId;
+    float area;
+};
+
 struct Material {
     glm::vec3 color;
     struct {
@@ -87,6 +145,10 @@ struct RenderState {
     Camera camera;
     unsigned int iterations;
     int traceDepth;
+    int rouletteDepth;      // bounces before Russian roulette starts; -1 disables it
+    float targetError;      // stop once the framebuffer's relative RMS error gets here; 0 disables it
+    float timeBudget;       // stop after this many seconds of rendering; 0 disables it
+    int stopCheckInterval;  // iterations between tests of the two above
     std::vector<glm::vec3> image;
     std::string imageName;
 };
@@ -94,15 +156,37 @@ struct RenderState {
 struct PathSegment {
     Ray ray;
     glm::vec3 color;
+    glm::vec3 radiance;     // light gathered by next-event estimation so far
+    float bsdfPdf;          // solid-angle pdf of ray.direction if the vertex it left also sampled a light, else 0
     int pixelIndex;
     int remainingBounces;
 };
 
+// Light sample taken while shading a path, traced after the shading stage.
+// The path gains `radiance` if nothing is hit closer than maxT; maxT <= 0
+// means the path took no sample.
+struct ShadowRay {
+    Ray ray;
+    float maxT;
+    glm::vec3 radiance;
+};
+
 // Use with a corresponding PathSegment to do:
 // 1) color contribution computation
 // 2) BSDF evaluation: generate a new ray
+// Only what identifies the hit is kept; resolveHitAttributes turns it into
+// a normal and texture coordinates when the path is shaded.
 struct ShadeableIntersection {
   float t;
-  glm::vec3 surfaceNormal;
   int materialId;
+  int geomId;
+  int primId;           // triangle of a mesh, face axis of a cube
+  glm::vec2 bary;       // barycentrics of a triangle's vertices 1 and 2
+};
+
+// Surface at a hit, rebuilt from a ShadeableIntersection for shading.
+struct HitAttributes {
+  glm::vec3 point;
+  glm::vec3 normal;
+  glm::vec2 uv;
 };
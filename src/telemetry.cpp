@@ -0,0 +1,48 @@
+#include <cstdio>
+
+#include "telemetry.h"
+
+bool saveTelemetryCSV(const std::string& path, const std::vector<IterationTelemetry>& iterations) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "iteration,generate_ms,gather_ms,total_ms,depth,paths_in,paths_out,"
+        "miss,light,depth_limit,roulette,intersect_ms,sort_ms,shade_ms,compact_ms\n");
+    for (const IterationTelemetry& it : iterations) {
+        for (const BounceTelemetry& b : it.bounces) {
+            fprintf(f, "%d,%.4f,%.4f,%.4f,%d,%d,%d,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f\n",
+                it.iteration, it.generateMs, it.gatherMs, it.totalMs,
+                b.depth, b.pathsIn, b.pathsOut,
+                b.terminated[TERMINATED_MISS], b.terminated[TERMINATED_LIGHT], b.terminated[TERMINATED_DEPTH], b.terminated[TERMINATED_ROULETTE],
+                b.intersectMs, b.sortMs, b.shadeMs, b.compactMs);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+bool saveTelemetryJSON(const std::string& path, const std::vector<IterationTelemetry>& iterations) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < iterations.size(); i++) {
+        const IterationTelemetry& it = iterations[i];
+        fprintf(f, "  {\"iteration\": %d, \"generate_ms\": %.4f, \"gather_ms\": %.4f, \"total_ms\": %.4f, \"bounces\": [\n",
+            it.iteration, it.generateMs, it.gatherMs, it.totalMs);
+        for (size_t j = 0; j < it.bounces.size(); j++) {
+            const BounceTelemetry& b = it.bounces[j];
+            fprintf(f, "    {\"depth\": %d, \"paths_in\": %d, \"paths_out\": %d, "
+                "\"terminated\": {\"miss\": %d, \"light\": %d, \"depth_limit\": %d, \"roulette\": %d}, "
+                "\"intersect_ms\": %.4f, \"sort_ms\": %.4f, \"shade_ms\": %.4f, \"compact_ms\": %.4f}%s\n",
+                b.depth, b.pathsIn, b.pathsOut,
+                b.terminated[TERMINATED_MISS], b.terminated[TERMINATED_LIGHT], b.terminated[TERMINATED_DEPTH], b.terminated[TERMINATED_ROULETTE],
+                b.intersectMs, b.sortMs, b.shadeMs, b.compactMs,
+                j + 1 < it.bounces.size() ? "," : "");
+        }
+        fprintf(f, "  ]}%s\n", i + 1 < iterations.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+    return fclose(f) == 0;
+}
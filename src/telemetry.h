@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Why a path stopped during a bounce
+enum TerminationReason {
+    TERMINATED_MISS,        // left the scene
+    TERMINATED_LIGHT,       // hit an emitter
+    TERMINATED_DEPTH,       // used its last bounce
+    TERMINATED_ROULETTE,    // lost at Russian roulette
+    TERMINATION_REASON_COUNT
+};
+
+/** One bounce of the wavefront loop. Stage times are in milliseconds. */
+struct BounceTelemetry {
+    int depth;
+    int pathsIn;            // active paths traced this bounce
+    int pathsOut;           // still active after compaction
+    int terminated[TERMINATION_REASON_COUNT];
+    float intersectMs;
+    float sortMs;           // material sort or shading queue construction
+    float shadeMs;
+    float compactMs;
+};
+
+/** One iteration (sample per pixel) of pathtrace(). */
+struct IterationTelemetry {
+    int iteration;
+    float generateMs;
+    float gatherMs;
+    float totalMs;          // wall clock for the whole call
+    std::vector<BounceTelemetry> bounces;
+};
+
+/**
+ * Writes one row per bounce, prefixed with its iteration's fields.
+ *
+ * @return  false if the file could not be written.
+ */
+bool saveTelemetryCSV(const std::string& path, const std::vector<IterationTelemetry>& iterations);
+
+/** Writes an array of iterations, each with its array of bounces. */
+bool saveTelemetryJSON(const std::string& path, const std::vector<IterationTelemetry>& iterations);
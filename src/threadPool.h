@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads fed from one FIFO queue.
+ *
+ * parallelFor may be called from inside a task: the calling thread works on
+ * the loop itself and only waits for indices already claimed by other
+ * threads, so nested loops cannot deadlock when every worker is busy.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    int size() const { return workers.size(); }
+
+    /** Queues a task to run on some worker. */
+    void submit(const std::function<void()>& task);
+
+    /** Runs body(i) for every i in [0, count), returning when all are done. */
+    void parallelFor(int count, const std::function<void(int)>& body);
+
+    /** Pool shared by the loaders, sized to the hardware thread count. */
+    static ThreadPool& shared();
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+};
@@ -8,6 +8,9 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 
 #include "utilities.h"
 
@@ -110,3 +113,72 @@ std::istream& utilityCore::safeGetline(std::istream& is, std::string& t) {
         }
     }
 }
+
+/**
+ * Absolute path with `.`, `..` and (on POSIX) symlinks resolved, so the same
+ * file referenced through different relative paths maps to one string.
+ * Falls back to the input if the file cannot be resolved.
+ */
+std::string utilityCore::canonicalPath(const std::string& path) {
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    if (_fullpath(resolved, path.c_str(), _MAX_PATH) == NULL) {
+        return path;
+    }
+    return std::string(resolved);
+#else
+    char* resolved = realpath(path.c_str(), NULL);
+    if (resolved == NULL) {
+        return path;
+    }
+    std::string result(resolved);
+    free(resolved);
+    return result;
+#endif
+}
+
+/**
+ * 64-bit content hash, eight bytes per step (FNV-1a style mixing on words
+ * with a final avalanche). Only meant for detecting changed or damaged
+ * files, not for security.
+ */
+uint64_t utilityCore::hashBytes(const void* data, size_t size, uint64_t seed) {
+    const uint64_t prime = 0x100000001b3ULL;
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * prime) ^ size;
+
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, bytes + 8 * i, 8);
+        h = (h ^ w) * prime;
+        h ^= h >> 29;
+    }
+    for (size_t i = 8 * words; i < size; i++) {
+        h = (h ^ bytes[i]) * prime;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * hashBytes over the whole contents of a file.
+ * @return  false if the file cannot be read.
+ */
+bool utilityCore::hashFile(const std::string& path, uint64_t& hash) {
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    std::vector<char> contents((size_t)size);
+    if (size > 0 && !file.read(contents.data(), size)) {
+        return false;
+    }
+    hash = hashBytes(contents.data(), contents.size());
+    return true;
+}
@@ -2,12 +2,15 @@
 
 #include "glm/glm.hpp"
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <ostream>
 #include <iterator>
 #include <sstream>
 #include <string>
 #include <vector>
+#include "telemetry.h"
 
 #define PI                3.1415926535897932384626422832795028841971f
 #define TWO_PI            6.2831853071795864769252867665590057683943f
@@ -17,8 +20,15 @@
 class GuiDataContainer
 {
 public:
-    GuiDataContainer() : TracedDepth(0) {}
+    GuiDataContainer() : TracedDepth(0), ActivePixels(0), RecordTelemetry(false) {}
     int TracedDepth;
+    int ActivePixels;       // pixels that got a path in the latest iteration
+
+    // Per-bounce statistics, appended by pathtrace() while RecordTelemetry
+    // is set. Timing every stage synchronizes the device between stages.
+    bool RecordTelemetry;
+    std::vector<IterationTelemetry> Telemetry;
+    std::string TelemetryBaseName;  // export path without extension
 };
 
 namespace utilityCore {
@@ -30,4 +40,7 @@ namespace utilityCore {
     extern glm::mat4 buildTransformationMatrix(glm::vec3 translation, glm::vec3 rotation, glm::vec3 scale);
     extern std::string convertIntToString(int number);
     extern std::istream& safeGetline(std::istream& is, std::string& t); //Thanks to http://stackoverflow.com/a/6089413
+    extern std::string canonicalPath(const std::string& path);
+    extern uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+    extern bool hashFile(const std::string& path, uint64_t& hash);
 }
@@ -32,6 +32,14 @@ inline int ilog2ceil(int x) {
 
 namespace StreamCompaction {
     namespace Common {
+        /** Default operator for the scan engines. */
+        struct Sum {
+            template <typename T>
+            __host__ __device__ T operator()(const T& a, const T& b) const {
+                return a + b;
+            }
+        };
+
         __global__ void kernMapToBoolean(int n, int *bools, const int *idata);
 
         __global__ void kernScatter(int n, int *odata,
@@ -11,5 +11,107 @@ namespace StreamCompaction {
         int compactWithoutScan(int n, int *odata, const int *idata);
 
         int compactWithScan(int n, int *odata, const int *idata);
+
+        /**
+         * Host counterpart of Efficient::ScanEngine, with the same interface
+         * on host arrays: the reference the GPU engine is checked against, and
+         * the scan CPU builds use. The workspace calls are no-ops.
+         */
+        template <typename T>
+        class ScanEngine
+        {
+        public:
+            ScanEngine() = default;
+            explicit ScanEngine(int n) { reserve(n); }
+
+            void reserve(int n) { capacity_ = std::max(capacity_, n); }
+            void release() { capacity_ = 0; }
+            int capacity() const { return capacity_; }
+
+            /** Scan of n elements with op; odata may alias idata. */
+            template <typename Op>
+            void scan(int n, T *odata, const T *idata, Op op, T identity, bool inclusive) {
+                T running = identity;
+                for (int i = 0; i < n; i++) {
+                    T value = idata[i];
+                    if (inclusive) {
+                        running = op(running, value);
+                        odata[i] = running;
+                    }
+                    else {
+                        odata[i] = running;
+                        running = op(running, value);
+                    }
+                }
+            }
+
+            void exclusiveScan(int n, T *odata, const T *idata) {
+                scan(n, odata, idata, Common::Sum(), T(), false);
+            }
+
+            void inclusiveScan(int n, T *odata, const T *idata) {
+                scan(n, odata, idata, Common::Sum(), T(), true);
+            }
+
+        private:
+            int capacity_ = 0;
+        };
+
+        /**
+         * Host reference for Efficient::compact and friends: same arguments,
+         * host arrays, no workspace.
+         *
+         * @returns the number of elements kept.
+         */
+        template <typename T, typename Pred>
+        int compact(int n, T *odata, const T *idata, Pred pred) {
+            int count = 0;
+            for (int i = 0; i < n; i++) {
+                if (pred(idata[i])) {
+                    odata[count++] = idata[i];
+                }
+            }
+            return count;
+        }
+
+        /** Stable partition: kept elements in order, then the rejected ones. */
+        template <typename T, typename Pred>
+        int partition(int n, T *odata, const T *idata, Pred pred) {
+            int count = compact(n, odata, idata, pred);
+            int rejected = count;
+            for (int i = 0; i < n; i++) {
+                if (!pred(idata[i])) {
+                    odata[rejected++] = idata[i];
+                }
+            }
+            return count;
+        }
+
+        template <typename T, typename U, typename Pred>
+        int compactZipped(int n, T *odataA, U *odataB, const T *idataA, const U *idataB, Pred pred) {
+            int count = 0;
+            for (int i = 0; i < n; i++) {
+                if (pred(idataA[i], idataB[i])) {
+                    odataA[count] = idataA[i];
+                    odataB[count] = idataB[i];
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        template <typename T, typename U, typename Pred>
+        int partitionZipped(int n, T *odataA, U *odataB, const T *idataA, const U *idataB, Pred pred) {
+            int count = compactZipped(n, odataA, odataB, idataA, idataB, pred);
+            int rejected = count;
+            for (int i = 0; i < n; i++) {
+                if (!pred(idataA[i], idataB[i])) {
+                    odataA[rejected] = idataA[i];
+                    odataB[rejected] = idataB[i];
+                    rejected++;
+                }
+            }
+            return count;
+        }
     }
 }
@@ -2,6 +2,10 @@
 
 #include "common.h"
 
+#define SCAN_BLOCK_SIZE 256
+#define SCAN_ITEMS_PER_THREAD 4
+#define SCAN_TILE_SIZE (SCAN_BLOCK_SIZE * SCAN_ITEMS_PER_THREAD)
+
 namespace StreamCompaction {
     namespace Efficient {
         StreamCompaction::Common::PerformanceTimer& timer();
@@ -9,5 +13,311 @@ namespace StreamCompaction {
         void scan(int n, int *odata, const int *idata);
 
         int compact(int n, int *odata, const int *idata);
+
+        /**
+         * Scans one tile of SCAN_TILE_SIZE elements per block: each thread
+         * scans SCAN_ITEMS_PER_THREAD consecutive elements, the thread totals
+         * are scanned in shared memory, and the tile total goes to tileSums
+         * (if not null). Elements past n count as identity. odata may alias
+         * idata.
+         */
+        template <typename T, typename Op>
+        __global__ void kernScanTiles(int n, T *odata, const T *idata, T *tileSums,
+                Op op, T identity, bool inclusive) {
+            __shared__ __align__(16) unsigned char storage[(SCAN_TILE_SIZE + SCAN_BLOCK_SIZE) * sizeof(T)];
+            T *tile = reinterpret_cast<T*>(storage);
+            T *partials = tile + SCAN_TILE_SIZE;
+            const int base = blockIdx.x * SCAN_TILE_SIZE;
+            const int t = threadIdx.x;
+
+            // Coalesced load, then each thread works on consecutive elements
+            for (int i = t; i < SCAN_TILE_SIZE; i += SCAN_BLOCK_SIZE) {
+                tile[i] = base + i < n ? idata[base + i] : identity;
+            }
+            __syncthreads();
+
+            T items[SCAN_ITEMS_PER_THREAD];
+            for (int i = 0; i < SCAN_ITEMS_PER_THREAD; i++) {
+                items[i] = tile[t * SCAN_ITEMS_PER_THREAD + i];
+            }
+            T total = items[0];
+            for (int i = 1; i < SCAN_ITEMS_PER_THREAD; i++) {
+                total = op(total, items[i]);
+            }
+            partials[t] = total;
+            __syncthreads();
+
+            // Inclusive scan of the thread totals
+            for (int offset = 1; offset < SCAN_BLOCK_SIZE; offset <<= 1) {
+                T addend = t >= offset ? partials[t - offset] : identity;
+                __syncthreads();
+                if (t >= offset) {
+                    partials[t] = op(addend, partials[t]);
+                }
+                __syncthreads();
+            }
+
+            T running = t > 0 ? partials[t - 1] : identity;
+            for (int i = 0; i < SCAN_ITEMS_PER_THREAD; i++) {
+                if (inclusive) {
+                    running = op(running, items[i]);
+                    tile[t * SCAN_ITEMS_PER_THREAD + i] = running;
+                }
+                else {
+                    tile[t * SCAN_ITEMS_PER_THREAD + i] = running;
+                    running = op(running, items[i]);
+                }
+            }
+            if (tileSums && t == SCAN_BLOCK_SIZE - 1) {
+                tileSums[blockIdx.x] = partials[t];
+            }
+            __syncthreads();
+
+            for (int i = t; i < SCAN_TILE_SIZE; i += SCAN_BLOCK_SIZE) {
+                if (base + i < n) {
+                    odata[base + i] = tile[i];
+                }
+            }
+        }
+
+        /**
+         * Uniform add: combines every element of tile blockIdx.x + 1 with the
+         * exclusive prefix of the tiles before it. Tile 0 has none.
+         */
+        template <typename T, typename Op>
+        __global__ void kernAddTilePrefix(int n, T *odata, const T *tilePrefix, Op op) {
+            const int tile = blockIdx.x + 1;
+            const T prefix = tilePrefix[tile];
+            const int base = tile * SCAN_TILE_SIZE;
+            for (int i = threadIdx.x; i < SCAN_TILE_SIZE; i += SCAN_BLOCK_SIZE) {
+                if (base + i < n) {
+                    odata[base + i] = op(prefix, odata[base + i]);
+                }
+            }
+        }
+
+        /**
+         * Work-efficient scan of device arrays in three steps: scan every tile
+         * on its own, scan the tile totals (recursively, one level per factor
+         * of SCAN_TILE_SIZE), then add each tile's prefix to it. No padding to
+         * a power of two.
+         *
+         * The tile-total buffers of every level are one allocation made by
+         * reserve(); scans of up to that size do not allocate. Inclusive,
+         * exclusive and custom-operator scans all run through scan(); Op must
+         * be associative and callable on the device, with `identity` as its
+         * identity element. CPU::ScanEngine has the same interface.
+         * Uncopyable.
+         */
+        template <typename T>
+        class ScanEngine
+        {
+        public:
+            ScanEngine() = default;
+            explicit ScanEngine(int n) { reserve(n); }
+            ~ScanEngine() { release(); }
+
+            /** Sizes the workspace for scans of up to n elements. */
+            void reserve(int n) {
+                if (n <= capacity_) {
+                    return;
+                }
+                release();
+                int total = 0;
+                int level = 0;
+                for (int m = (n + SCAN_TILE_SIZE - 1) / SCAN_TILE_SIZE; m > 1; m = (m + SCAN_TILE_SIZE - 1) / SCAN_TILE_SIZE) {
+                    levelOffsets_[level++] = total;
+                    total += m;
+                }
+                if (total > 0) {
+                    cudaMalloc((void**)&tileSums_, sizeof(T) * total);
+                    checkCUDAError("cudaMalloc ScanEngine tile sums failed!");
+                }
+                capacity_ = n;
+            }
+
+            void release() {
+                cudaFree(tileSums_);
+                tileSums_ = nullptr;
+                capacity_ = 0;
+            }
+
+            int capacity() const { return capacity_; }
+
+            /** Scan of n elements with op; dev_odata may alias dev_idata. */
+            template <typename Op>
+            void scan(int n, T *dev_odata, const T *dev_idata, Op op, T identity, bool inclusive) {
+                if (n <= 0) {
+                    return;
+                }
+                reserve(n);
+                scanLevel(0, n, dev_odata, dev_idata, op, identity, inclusive);
+            }
+
+            void exclusiveScan(int n, T *dev_odata, const T *dev_idata) {
+                scan(n, dev_odata, dev_idata, Common::Sum(), T(), false);
+            }
+
+            void inclusiveScan(int n, T *dev_odata, const T *dev_idata) {
+                scan(n, dev_odata, dev_idata, Common::Sum(), T(), true);
+            }
+
+            ScanEngine(const ScanEngine&) = delete;
+            ScanEngine& operator=(const ScanEngine&) = delete;
+
+        private:
+            template <typename Op>
+            void scanLevel(int level, int n, T *dev_odata, const T *dev_idata, Op op, T identity, bool inclusive) {
+                int tiles = (n + SCAN_TILE_SIZE - 1) / SCAN_TILE_SIZE;
+                T *sums = tiles > 1 ? tileSums_ + levelOffsets_[level] : nullptr;
+                kernScanTiles << <tiles, SCAN_BLOCK_SIZE >> > (n, dev_odata, dev_idata, sums, op, identity, inclusive);
+                checkCUDAError("kernScanTiles invocation failed!");
+                if (tiles > 1) {
+                    scanLevel(level + 1, tiles, sums, sums, op, identity, false);
+                    kernAddTilePrefix << <tiles - 1, SCAN_BLOCK_SIZE >> > (n, dev_odata, sums, op);
+                    checkCUDAError("kernAddTilePrefix invocation failed!");
+                }
+            }
+
+            T *tileSums_ = nullptr;
+            int levelOffsets_[8] = {};  // SCAN_TILE_SIZE^8 is far past INT_MAX
+            int capacity_ = 0;
+        };
+
+        /**
+         * Device scratch for the templated compaction below. It grows to the
+         * largest size requested and is kept until release(), so compacting
+         * every bounce does not allocate.
+         * Uncopyable.
+         */
+        class Workspace
+        {
+        public:
+            Workspace() = default;
+            ~Workspace() { release(); }
+
+            /** Makes room to compact n elements. */
+            void reserve(int n);
+            void release();
+
+            int* indices = nullptr;     // keep flags, scanned in place; n + 1 of them
+            int capacity = 0;           // elements that can be compacted
+            ScanEngine<int> scanner;
+
+            Workspace(const Workspace&) = delete;
+            Workspace& operator=(const Workspace&) = delete;
+        };
+
+        /** Writes 1 to flags[k] when pred(idata[k]) holds, else 0. */
+        template <typename T, typename Pred>
+        __global__ void kernMapPredicate(int n, int *flags, const T *idata, Pred pred) {
+            int k = threadIdx.x + (blockIdx.x * blockDim.x);
+            if (k >= n) {
+                return;
+            }
+            flags[k] = pred(idata[k]) ? 1 : 0;
+        }
+
+        template <typename T, typename U, typename Pred>
+        __global__ void kernMapPredicateZipped(int n, int *flags, const T *a, const U *b, Pred pred) {
+            int k = threadIdx.x + (blockIdx.x * blockDim.x);
+            if (k >= n) {
+                return;
+            }
+            flags[k] = pred(a[k], b[k]) ? 1 : 0;
+        }
+
+        /**
+         * Scatter from the exclusive scan of n + 1 flags, the last one 0:
+         * element k was kept iff indices[k + 1] != indices[k], and indices[n]
+         * is the number kept. With keepRejected, the other elements follow the
+         * kept ones in their original order.
+         */
+        template <typename T>
+        __global__ void kernScatterScanned(int n, T *odata, const T *idata, const int *indices, bool keepRejected) {
+            int k = threadIdx.x + (blockIdx.x * blockDim.x);
+            if (k >= n) {
+                return;
+            }
+            int index = indices[k];
+            if (indices[k + 1] != index) {
+                odata[index] = idata[k];
+            }
+            else if (keepRejected) {
+                odata[indices[n] + k - index] = idata[k];
+            }
+        }
+
+        /** Number kept after one of the kernMapPredicate kernels filled ws.indices. */
+        int scanFlags(int n, Workspace &ws);
+
+        template <typename T, typename Pred>
+        int compactImpl(int n, T *dev_odata, const T *dev_idata, Pred pred, Workspace &ws, bool keepRejected) {
+            if (n <= 0) {
+                return 0;
+            }
+            ws.reserve(n);
+            const int compactBlockSize = SCAN_BLOCK_SIZE;
+            dim3 blocksPerGrid((n + compactBlockSize - 1) / compactBlockSize);
+            kernMapPredicate << <blocksPerGrid, compactBlockSize >> > (n, ws.indices, dev_idata, pred);
+            checkCUDAError("kernMapPredicate invocation failed!");
+            int count = scanFlags(n, ws);
+            kernScatterScanned << <blocksPerGrid, compactBlockSize >> > (n, dev_odata, dev_idata, ws.indices, keepRejected);
+            checkCUDAError("kernScatterScanned invocation failed!");
+            return count;
+        }
+
+        template <typename T, typename U, typename Pred>
+        int compactZippedImpl(int n, T *dev_odataA, U *dev_odataB, const T *dev_idataA, const U *dev_idataB,
+                Pred pred, Workspace &ws, bool keepRejected) {
+            if (n <= 0) {
+                return 0;
+            }
+            ws.reserve(n);
+            const int compactBlockSize = SCAN_BLOCK_SIZE;
+            dim3 blocksPerGrid((n + compactBlockSize - 1) / compactBlockSize);
+            kernMapPredicateZipped << <blocksPerGrid, compactBlockSize >> > (n, ws.indices, dev_idataA, dev_idataB, pred);
+            checkCUDAError("kernMapPredicateZipped invocation failed!");
+            int count = scanFlags(n, ws);
+            kernScatterScanned << <blocksPerGrid, compactBlockSize >> > (n, dev_odataA, dev_idataA, ws.indices, keepRejected);
+            kernScatterScanned << <blocksPerGrid, compactBlockSize >> > (n, dev_odataB, dev_idataB, ws.indices, keepRejected);
+            checkCUDAError("kernScatterScanned invocation failed!");
+            return count;
+        }
+
+        /**
+         * Stream compaction of device arrays: copies the elements of dev_idata
+         * for which pred holds to the front of dev_odata, in order. The arrays
+         * must not overlap. pred must be callable on the device.
+         *
+         * @returns  The number of elements kept.
+         */
+        template <typename T, typename Pred>
+        int compact(int n, T *dev_odata, const T *dev_idata, Pred pred, Workspace &ws) {
+            return compactImpl(n, dev_odata, dev_idata, pred, ws, false);
+        }
+
+        /** Stable partition: like compact, then the rejected elements in order. */
+        template <typename T, typename Pred>
+        int partition(int n, T *dev_odata, const T *dev_idata, Pred pred, Workspace &ws) {
+            return compactImpl(n, dev_odata, dev_idata, pred, ws, true);
+        }
+
+        /**
+         * Compacts two parallel arrays (e.g. PathSegment and
+         * ShadeableIntersection) with one map and one scan; pred(a[k], b[k])
+         * decides for both.
+         */
+        template <typename T, typename U, typename Pred>
+        int compactZipped(int n, T *dev_odataA, U *dev_odataB, const T *dev_idataA, const U *dev_idataB,
+                Pred pred, Workspace &ws) {
+            return compactZippedImpl(n, dev_odataA, dev_odataB, dev_idataA, dev_idataB, pred, ws, false);
+        }
+
+        template <typename T, typename U, typename Pred>
+        int partitionZipped(int n, T *dev_odataA, U *dev_odataB, const T *dev_idataA, const U *dev_idataB,
+                Pred pred, Workspace &ws) {
+            return compactZippedImpl(n, dev_odataA, dev_odataB, dev_idataA, dev_idataB, pred, ws, true);
+        }
     }
 }